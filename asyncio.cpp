@@ -0,0 +1,674 @@
+/**
+ * asyncio.cpp
+ *
+ * Implementation of the io_uring I/O backend (see asyncio.h).
+ */
+
+#include "asyncio.h"
+#include "packedstore.h"
+#include "packstats.h"
+#include "progress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+#ifdef REVPK_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// Requested with --io; the backend still falls back per ring if the
+// kernel won't set one up.
+static std::atomic<bool> s_bAsyncIo{true};
+
+bool SetAsyncIo(const std::string& mode)
+{
+    if (mode == "uring")
+        s_bAsyncIo = true;
+    else if (mode == "sync")
+        s_bAsyncIo = false;
+    else
+        return false;
+
+#ifndef REVPK_HAVE_IO_URING
+    if (mode == "uring")
+        std::cerr << "[ReVPK] WARNING: Built without io_uring support, using synchronous I/O.\n";
+#endif
+    return true;
+}
+
+bool AsyncIoEnabled()
+{
+#ifdef REVPK_HAVE_IO_URING
+    return s_bAsyncIo;
+#else
+    return false;
+#endif
+}
+
+#ifdef REVPK_HAVE_IO_URING
+// pread() until nLen bytes are in or the file ends.
+static size_t ReadFully(int nFd, uint8_t* pDst, size_t nLen, uint64_t nOffset)
+{
+    size_t nRead = 0;
+    while (nRead < nLen)
+    {
+        const ssize_t n = pread(nFd, pDst + nRead, nLen - nRead, off_t(nOffset + nRead));
+        if (n <= 0)
+            break;
+        nRead += size_t(n);
+    }
+    return nRead;
+}
+
+// ------------------------------------------------------------------------
+//  CIoRing
+// ------------------------------------------------------------------------
+bool CIoRing::Init(unsigned nEntries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    const int nFd = int(syscall(__NR_io_uring_setup, nEntries, &params));
+    if (nFd < 0)
+        return false;
+    m_nFd = nFd;
+
+    m_nSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_nCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool bSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (bSingleMap)
+        m_nSqRingSize = m_nCqRingSize = std::max(m_nSqRingSize, m_nCqRingSize);
+
+    m_pSqRing = mmap(nullptr, m_nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     m_nFd, IORING_OFF_SQ_RING);
+    if (m_pSqRing == MAP_FAILED)
+    {
+        m_pSqRing = nullptr;
+        Close();
+        return false;
+    }
+
+    if (bSingleMap)
+    {
+        m_pCqRing = m_pSqRing;
+    }
+    else
+    {
+        m_pCqRing = mmap(nullptr, m_nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         m_nFd, IORING_OFF_CQ_RING);
+        if (m_pCqRing == MAP_FAILED)
+        {
+            m_pCqRing = nullptr;
+            Close();
+            return false;
+        }
+    }
+
+    m_nSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* pSqes = mmap(nullptr, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       m_nFd, IORING_OFF_SQES);
+    if (pSqes == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+    m_pSqes = static_cast<io_uring_sqe*>(pSqes);
+
+    uint8_t* pSq = static_cast<uint8_t*>(m_pSqRing);
+    m_pSqHead    = reinterpret_cast<unsigned*>(pSq + params.sq_off.head);
+    m_pSqTail    = reinterpret_cast<unsigned*>(pSq + params.sq_off.tail);
+    m_nSqMask    = *reinterpret_cast<unsigned*>(pSq + params.sq_off.ring_mask);
+    m_pSqArray   = reinterpret_cast<unsigned*>(pSq + params.sq_off.array);
+    m_nSqEntries = params.sq_entries;
+    m_nSqLocalTail = *m_pSqTail;
+
+    uint8_t* pCq = static_cast<uint8_t*>(m_pCqRing);
+    m_pCqHead = reinterpret_cast<unsigned*>(pCq + params.cq_off.head);
+    m_pCqTail = reinterpret_cast<unsigned*>(pCq + params.cq_off.tail);
+    m_nCqMask = *reinterpret_cast<unsigned*>(pCq + params.cq_off.ring_mask);
+    m_pCqes   = reinterpret_cast<io_uring_cqe*>(pCq + params.cq_off.cqes);
+    return true;
+}
+
+void CIoRing::Close()
+{
+    if (m_pSqes)
+        munmap(m_pSqes, m_nSqesSize);
+    if (m_pCqRing && m_pCqRing != m_pSqRing)
+        munmap(m_pCqRing, m_nCqRingSize);
+    if (m_pSqRing)
+        munmap(m_pSqRing, m_nSqRingSize);
+    if (m_nFd >= 0)
+        close(m_nFd);
+
+    m_nFd = -1;
+    m_pSqRing = m_pCqRing = nullptr;
+    m_pSqes = nullptr;
+    m_nToSubmit = 0;
+}
+
+bool CIoRing::RegisterBuffers(const iovec* pIovecs, unsigned nCount)
+{
+    return syscall(__NR_io_uring_register, m_nFd, IORING_REGISTER_BUFFERS, pIovecs, nCount) == 0;
+}
+
+io_uring_sqe* CIoRing::GetSqe()
+{
+    const unsigned nHead = __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+    if (m_nSqLocalTail - nHead >= m_nSqEntries)
+        return nullptr;
+
+    const unsigned iIndex = m_nSqLocalTail & m_nSqMask;
+    io_uring_sqe* pSqe = &m_pSqes[iIndex];
+    std::memset(pSqe, 0, sizeof(*pSqe));
+    m_pSqArray[iIndex] = iIndex;
+    m_nSqLocalTail++;
+    m_nToSubmit++;
+    return pSqe;
+}
+
+static void PrepReadWrite(io_uring_sqe* pSqe, uint8_t nOpcode, uint8_t nFixedOpcode, int nFd,
+                          const void* pBuf, uint32_t nLen, uint64_t nOffset, int iBuffer, uint64_t nUserData)
+{
+    pSqe->opcode    = (iBuffer >= 0) ? nFixedOpcode : nOpcode;
+    pSqe->fd        = nFd;
+    pSqe->addr      = reinterpret_cast<uint64_t>(pBuf);
+    pSqe->len       = nLen;
+    pSqe->off       = nOffset;
+    pSqe->buf_index = uint16_t(iBuffer >= 0 ? iBuffer : 0);
+    pSqe->user_data = nUserData;
+}
+
+bool CIoRing::PrepRead(int nFd, void* pBuf, uint32_t nLen, uint64_t nOffset, int iBuffer, uint64_t nUserData)
+{
+    io_uring_sqe* pSqe = GetSqe();
+    if (!pSqe)
+        return false;
+    PrepReadWrite(pSqe, IORING_OP_READ, IORING_OP_READ_FIXED, nFd, pBuf, nLen, nOffset, iBuffer, nUserData);
+    return true;
+}
+
+bool CIoRing::PrepWrite(int nFd, const void* pBuf, uint32_t nLen, uint64_t nOffset, int iBuffer, uint64_t nUserData)
+{
+    io_uring_sqe* pSqe = GetSqe();
+    if (!pSqe)
+        return false;
+    PrepReadWrite(pSqe, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, nFd, pBuf, nLen, nOffset, iBuffer, nUserData);
+    return true;
+}
+
+bool CIoRing::Submit(unsigned nWaitFor)
+{
+    __atomic_store_n(m_pSqTail, m_nSqLocalTail, __ATOMIC_RELEASE);
+
+    while (m_nToSubmit > 0 || nWaitFor > 0)
+    {
+        const int n = int(syscall(__NR_io_uring_enter, m_nFd, m_nToSubmit, nWaitFor,
+                                  nWaitFor ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0));
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return false;
+        }
+        m_nToSubmit -= std::min(m_nToSubmit, unsigned(n));
+        nWaitFor = 0; // GETEVENTS only returns once they are there
+    }
+    return true;
+}
+
+bool CIoRing::PopCompletion(uint64_t& nUserData, int& nResult)
+{
+    const unsigned nHead = *m_pCqHead;
+    if (nHead == __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+        return false;
+
+    const io_uring_cqe& cqe = m_pCqes[nHead & m_nCqMask];
+    nUserData = cqe.user_data;
+    nResult   = cqe.res;
+    __atomic_store_n(m_pCqHead, nHead + 1, __ATOMIC_RELEASE);
+    return true;
+}
+#endif // REVPK_HAVE_IO_URING
+
+// ------------------------------------------------------------------------
+//  CReadAhead
+// ------------------------------------------------------------------------
+CReadAhead* CReadAhead::Acquire()
+{
+    if (!AsyncIoEnabled())
+        return nullptr;
+
+#ifdef REVPK_HAVE_IO_URING
+    // Set up on first use; a thread that can't have a ring never retries.
+    thread_local std::unique_ptr<CReadAhead> t_pReadAhead;
+    thread_local bool t_bTried = false;
+    if (!t_bTried)
+    {
+        t_bTried = true;
+        std::unique_ptr<CReadAhead> pReadAhead(new CReadAhead());
+        if (pReadAhead->Init())
+            t_pReadAhead = std::move(pReadAhead);
+    }
+
+    if (!t_pReadAhead || t_pReadAhead->m_bInUse || t_pReadAhead->m_bRingFailed)
+        return nullptr;
+    t_pReadAhead->m_bInUse = true;
+    PackStats().AcquireBuffer(2 * VPK_ENTRY_MAX_LEN);
+    return t_pReadAhead.get();
+#else
+    return nullptr;
+#endif
+}
+
+void CReadAhead::Release()
+{
+#ifdef REVPK_HAVE_IO_URING
+    for (int i = 0; i < 2; i++)
+    {
+        Complete(i);
+        m_Buffers[i].m_bValid = false;
+    }
+    PackStats().ReleaseBuffer(2 * VPK_ENTRY_MAX_LEN);
+#endif
+    m_bInUse = false;
+}
+
+CReadAhead::~CReadAhead()
+{
+#ifdef REVPK_HAVE_IO_URING
+    // The ring must be gone before the buffers it has registered.
+    m_Ring.Close();
+#endif
+}
+
+#ifdef REVPK_HAVE_IO_URING
+bool CReadAhead::Init()
+{
+    if (!m_Ring.Init(4))
+        return false;
+
+    iovec iovecs[2];
+    for (int i = 0; i < 2; i++)
+    {
+        m_Buffers[i].m_pData.reset(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        iovecs[i].iov_base = m_Buffers[i].m_pData.get();
+        iovecs[i].iov_len  = VPK_ENTRY_MAX_LEN;
+    }
+    return m_Ring.RegisterBuffers(iovecs, 2);
+}
+
+bool CReadAhead::Submit(int iBuffer, int nFd, uint64_t nOffset, size_t nLen)
+{
+    Buffer_t& buffer = m_Buffers[iBuffer];
+    buffer.m_nFd     = nFd;
+    buffer.m_nOffset = nOffset;
+    buffer.m_nLen    = nLen;
+    buffer.m_bValid  = false;
+
+    if (m_bRingFailed ||
+        !m_Ring.PrepRead(nFd, buffer.m_pData.get(), uint32_t(nLen), nOffset, iBuffer, uint64_t(iBuffer)) ||
+        !m_Ring.Submit())
+        return false;
+
+    buffer.m_bPending = true;
+    return true;
+}
+
+void CReadAhead::Complete(int iBuffer)
+{
+    while (m_Buffers[iBuffer].m_bPending)
+    {
+        uint64_t nUserData;
+        int nResult;
+        while (m_Ring.PopCompletion(nUserData, nResult))
+        {
+            Buffer_t& done = m_Buffers[nUserData];
+            done.m_bPending = false;
+            done.m_bValid   = true;
+            done.m_nResult  = nResult;
+        }
+        if (m_Buffers[iBuffer].m_bPending && !m_Ring.Submit(1))
+        {
+            std::cerr << "[ReVPK] WARNING: io_uring wait failed (" << std::strerror(errno)
+                      << "), reading synchronously.\n";
+            AbandonRing();
+        }
+    }
+}
+
+void CReadAhead::AbandonRing()
+{
+    // Reads still in the ring may land at any time, so their buffers are
+    // left to the kernel and replaced. Marked failed, they are read again
+    // with pread() by Read().
+    m_bRingFailed = true;
+    for (Buffer_t& buffer : m_Buffers)
+    {
+        if (!buffer.m_bPending)
+            continue;
+        (void)buffer.m_pData.release();
+        buffer.m_pData.reset(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        buffer.m_bPending = false;
+        buffer.m_bValid   = true;
+        buffer.m_nResult  = -EIO;
+    }
+}
+#endif
+
+uint8_t* CReadAhead::Read(int nFd, uint64_t nOffset, size_t nLen, size_t nNextLen, size_t& nRead)
+{
+#ifdef REVPK_HAVE_IO_URING
+    // The prefetch from the last Read() if it's what we're after, or a
+    // fresh read into the other buffer.
+    const int iPrefetch = 1 - m_iCurrent;
+    const Buffer_t& prefetch = m_Buffers[iPrefetch];
+    const bool bHit = (prefetch.m_bPending || prefetch.m_bValid) && prefetch.m_nFd == nFd &&
+                      prefetch.m_nOffset == nOffset && prefetch.m_nLen >= nLen;
+
+    m_iCurrent = iPrefetch;
+    Buffer_t& current = m_Buffers[m_iCurrent];
+    if (!bHit)
+    {
+        Complete(m_iCurrent);
+        if (!Submit(m_iCurrent, nFd, nOffset, nLen))
+        {
+            current.m_nResult = -EAGAIN;
+            current.m_bValid  = true;
+        }
+    }
+    Complete(m_iCurrent);
+
+    // Short or failed reads (end of file, or a file type the ring can't
+    // read) are finished with pread().
+    nRead = current.m_nResult > 0 ? std::min(size_t(current.m_nResult), nLen) : 0;
+    if (nRead < nLen)
+        nRead += ReadFully(nFd, current.m_pData.get() + nRead, nLen - nRead, nOffset + nRead);
+
+    // Meanwhile, read what will most likely be asked for next.
+    if (nNextLen > 0)
+    {
+        const int iNext = 1 - m_iCurrent;
+        Complete(iNext);
+        Submit(iNext, nFd, nOffset + nLen, nNextLen);
+    }
+    return current.m_pData.get();
+#else
+    (void)nFd; (void)nOffset; (void)nLen; (void)nNextLen;
+    nRead = 0;
+    return nullptr;
+#endif
+}
+
+// ------------------------------------------------------------------------
+//  CAsyncFileWriter
+// ------------------------------------------------------------------------
+#ifdef REVPK_HAVE_IO_URING
+// Registered buffers the unpack workers decompress into, and the most
+// writes submitted at once.
+static constexpr int      WRITER_BUFFER_COUNT = 16;
+static constexpr unsigned WRITER_RING_ENTRIES = 64;
+#endif
+
+CAsyncFileWriter::~CAsyncFileWriter()
+{
+    Flush();
+
+#ifdef REVPK_HAVE_IO_URING
+    if (m_Thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_bStop = true;
+        }
+        m_QueueCV.notify_all();
+        m_Thread.join();
+    }
+    m_Ring.Close();
+#endif
+}
+
+bool CAsyncFileWriter::Start()
+{
+    if (!AsyncIoEnabled())
+        return false;
+
+#ifdef REVPK_HAVE_IO_URING
+    if (!m_Ring.Init(WRITER_RING_ENTRIES))
+        return false;
+
+    std::vector<iovec> iovecs(WRITER_BUFFER_COUNT);
+    for (int i = 0; i < WRITER_BUFFER_COUNT; i++)
+    {
+        m_Buffers.emplace_back(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        m_FreeBuffers.push_back(i);
+        iovecs[i].iov_base = m_Buffers[i].get();
+        iovecs[i].iov_len  = VPK_ENTRY_MAX_LEN;
+    }
+    if (!m_Ring.RegisterBuffers(iovecs.data(), unsigned(iovecs.size())))
+    {
+        m_Ring.Close();
+        m_Buffers.clear();
+        m_FreeBuffers.clear();
+        return false;
+    }
+
+    m_bStarted = true;
+    m_Thread = std::thread([this]() { WriterThread(); });
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint8_t* CAsyncFileWriter::GetBuffer(int& iBuffer)
+{
+#ifdef REVPK_HAVE_IO_URING
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_BufferCV.wait(lock, [this]() { return !m_FreeBuffers.empty(); });
+    iBuffer = m_FreeBuffers.back();
+    m_FreeBuffers.pop_back();
+    return m_Buffers[iBuffer].get();
+#else
+    iBuffer = -1;
+    return nullptr;
+#endif
+}
+
+void CAsyncFileWriter::PutBuffer(int iBuffer)
+{
+#ifdef REVPK_HAVE_IO_URING
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_FreeBuffers.push_back(iBuffer);
+    }
+    m_BufferCV.notify_one();
+#else
+    (void)iBuffer;
+#endif
+}
+
+void CAsyncFileWriter::Write(int nFd, std::shared_ptr<void> pOwner, const std::string& name,
+                             int iBuffer, const uint8_t* pData, size_t nLen, uint64_t nOffset)
+{
+#ifdef REVPK_HAVE_IO_URING
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Queue.push_back({ nFd, std::move(pOwner), &name, iBuffer,
+                            iBuffer >= 0 ? m_Buffers[iBuffer].get() : pData, nLen, nOffset });
+    }
+    m_QueueCV.notify_one();
+#else
+    (void)nFd; (void)pOwner; (void)name; (void)iBuffer; (void)pData; (void)nLen; (void)nOffset;
+#endif
+}
+
+bool CAsyncFileWriter::Flush()
+{
+    if (!m_bStarted)
+        return true;
+
+#ifdef REVPK_HAVE_IO_URING
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_IdleCV.wait(lock, [this]() { return m_Queue.empty() && m_nInFlight == 0; });
+    return !m_bFailed;
+#else
+    return true;
+#endif
+}
+
+#ifdef REVPK_HAVE_IO_URING
+void CAsyncFileWriter::Finish(Request_t& request, int nResult)
+{
+    // A short write is finished with pwrite(); io_uring only stops early
+    // on errors like a full disk, which pwrite() then reports.
+    size_t nWritten = nResult > 0 ? size_t(nResult) : 0;
+    while (nWritten < request.m_nLen)
+    {
+        const ssize_t n = pwrite(request.m_nFd, request.m_pData + nWritten,
+                                 request.m_nLen - nWritten, off_t(request.m_nOffset + nWritten));
+        if (n <= 0)
+            break;
+        nWritten += size_t(n);
+    }
+
+    // Bytes only: the time is spent in the kernel, next to decompression.
+    PackStats().AddTime(CPackStats::kTimerWrite, 0, nWritten);
+    Progress().Advance(0, nWritten);
+
+    const bool bFailed = nWritten < request.m_nLen;
+    if (bFailed)
+        std::cerr << "[ReVPK] ERROR: Failed to write " << *request.m_pName << "\n";
+
+    // Closes the file if this was its last fragment.
+    request.m_pOwner.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (bFailed)
+            m_bFailed = true;
+        if (request.m_iBuffer >= 0)
+            m_FreeBuffers.push_back(request.m_iBuffer);
+        m_nInFlight--;
+    }
+    if (request.m_iBuffer >= 0)
+        m_BufferCV.notify_one();
+}
+
+void CAsyncFileWriter::AbandonRing()
+{
+    // Writes still in the ring may yet be carried out, so they are all
+    // finished with pwrite() of the same bytes, and their buffers are left
+    // to the kernel and replaced before going back on the free list.
+    m_bRingFailed = true;
+    for (std::unique_ptr<Request_t>& pSlot : m_Slots)
+    {
+        std::unique_ptr<Request_t> pRequest = std::move(pSlot);
+        if (!pRequest)
+            continue;
+        if (pRequest->m_iBuffer >= 0)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            (void)m_Buffers[pRequest->m_iBuffer].release();
+            m_Buffers[pRequest->m_iBuffer].reset(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        }
+        Finish(*pRequest, 0);
+    }
+    m_Slots.clear();
+    m_FreeSlots.clear();
+}
+
+void CAsyncFileWriter::WriterThread()
+{
+    std::vector<Request_t> batch;
+    size_t nInRing = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if (m_Queue.empty() && m_nInFlight == 0)
+                m_IdleCV.notify_all();
+            m_QueueCV.wait(lock, [&]() { return m_bStop || !m_Queue.empty() || nInRing > 0; });
+            if (m_bStop && m_Queue.empty() && m_nInFlight == 0)
+                return;
+            batch.swap(m_Queue);
+            m_nInFlight += batch.size();
+        }
+
+        if (m_bRingFailed)
+        {
+            for (Request_t& request : batch)
+                Finish(request, 0);
+            batch.clear();
+            continue;
+        }
+
+        // Queue the whole batch; what doesn't fit in the ring waits for room.
+        size_t iNext = 0;
+        for (; iNext < batch.size() && nInRing < WRITER_RING_ENTRIES; iNext++)
+        {
+            size_t iSlot;
+            if (!m_FreeSlots.empty())
+            {
+                iSlot = m_FreeSlots.back();
+                m_FreeSlots.pop_back();
+            }
+            else
+            {
+                iSlot = m_Slots.size();
+                m_Slots.emplace_back();
+            }
+
+            Request_t& request = batch[iNext];
+            if (!m_Ring.PrepWrite(request.m_nFd, request.m_pData, uint32_t(request.m_nLen), request.m_nOffset,
+                                  request.m_iBuffer, uint64_t(iSlot)))
+            {
+                m_FreeSlots.push_back(iSlot);
+                break;
+            }
+            m_Slots[iSlot].reset(new Request_t(std::move(request)));
+            nInRing++;
+        }
+
+        // Put back what didn't fit, in front of anything queued meanwhile.
+        const bool bRingFull = iNext < batch.size();
+        if (bRingFull)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Queue.insert(m_Queue.begin(), std::make_move_iterator(batch.begin() + iNext),
+                           std::make_move_iterator(batch.end()));
+            m_nInFlight -= batch.size() - iNext;
+        }
+        batch.clear();
+
+        // With nothing new submitted, or no room for more, wait for a write
+        // to finish.
+        const bool bWait = (iNext == 0 || bRingFull) && nInRing > 0;
+        if (!m_Ring.Submit(bWait ? 1 : 0))
+        {
+            std::cerr << "[ReVPK] WARNING: io_uring submit failed (" << std::strerror(errno)
+                      << "), writing synchronously.\n";
+            AbandonRing();
+            nInRing = 0;
+            continue;
+        }
+
+        uint64_t nUserData;
+        int nResult;
+        while (m_Ring.PopCompletion(nUserData, nResult))
+        {
+            std::unique_ptr<Request_t> pRequest = std::move(m_Slots[nUserData]);
+            m_FreeSlots.push_back(size_t(nUserData));
+            nInRing--;
+            Finish(*pRequest, nResult);
+        }
+    }
+}
+#endif // REVPK_HAVE_IO_URING
@@ -0,0 +1,216 @@
+/**
+ * asyncio.h
+ *
+ * Optional io_uring backend for the two I/O-bound paths: reading input files
+ * when packing and writing extracted files when unpacking. It is compiled in
+ * when CMake finds <linux/io_uring.h> (REVPK_HAVE_IO_URING) and used unless
+ * --io=sync is given or the kernel refuses to set up a ring (old kernels,
+ * seccomp'd containers); then everything goes through pread()/pwrite().
+ *
+ *   CReadAhead        per-thread ring with two registered buffers. While a
+ *                     worker hashes or compresses one fragment of a file, the
+ *                     kernel is already reading the next (see CFragmentReader).
+ *   CAsyncFileWriter  ring and thread shared by the unpack workers. Workers
+ *                     decompress into one of its registered buffers and hand
+ *                     it over; the writer submits whatever has queued up in
+ *                     one batch, so workers don't wait for their writes.
+ *
+ * The ring is driven through the raw syscalls, so there's no liburing
+ * dependency.
+ */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef REVPK_HAVE_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct iovec;
+
+// ------------------------------------------------------------------
+// CIoRing:
+//  One submission/completion queue pair. Not thread-safe; every user
+//  owns its ring.
+// ------------------------------------------------------------------
+class CIoRing
+{
+public:
+    CIoRing() = default;
+    ~CIoRing() { Close(); }
+
+    CIoRing(const CIoRing&) = delete;
+    CIoRing& operator=(const CIoRing&) = delete;
+
+    bool Init(unsigned nEntries);
+    void Close();
+
+    // Register buffers for the *Fixed operations; iBuffer indexes pIovecs.
+    bool RegisterBuffers(const iovec* pIovecs, unsigned nCount);
+
+    // Queue an operation; false when the submission queue is full. A
+    // negative iBuffer reads or writes an unregistered buffer.
+    bool PrepRead(int nFd, void* pBuf, uint32_t nLen, uint64_t nOffset, int iBuffer, uint64_t nUserData);
+    bool PrepWrite(int nFd, const void* pBuf, uint32_t nLen, uint64_t nOffset, int iBuffer, uint64_t nUserData);
+
+    // Submit everything queued, then wait until nWaitFor completions are ready.
+    bool Submit(unsigned nWaitFor = 0);
+    // Take the oldest completion; nResult is bytes done or -errno.
+    bool PopCompletion(uint64_t& nUserData, int& nResult);
+
+private:
+    io_uring_sqe* GetSqe();
+
+    int           m_nFd = -1;
+    void*         m_pSqRing = nullptr;
+    size_t        m_nSqRingSize = 0;
+    void*         m_pCqRing = nullptr;   // same mapping as m_pSqRing on newer kernels
+    size_t        m_nCqRingSize = 0;
+    io_uring_sqe* m_pSqes = nullptr;
+    size_t        m_nSqesSize = 0;
+
+    unsigned*     m_pSqHead = nullptr;
+    unsigned*     m_pSqTail = nullptr;
+    unsigned      m_nSqMask = 0;
+    unsigned*     m_pSqArray = nullptr;
+    unsigned      m_nSqEntries = 0;
+    unsigned      m_nSqLocalTail = 0;   // queued but not yet published to the kernel
+    unsigned      m_nToSubmit = 0;
+
+    unsigned*     m_pCqHead = nullptr;
+    unsigned*     m_pCqTail = nullptr;
+    unsigned      m_nCqMask = 0;
+    io_uring_cqe* m_pCqes = nullptr;
+};
+#endif // REVPK_HAVE_IO_URING
+
+// Use io_uring when available (default) or always pread()/pwrite().
+bool SetAsyncIo(const std::string& mode);
+bool AsyncIoEnabled();
+
+// ------------------------------------------------------------------
+// CReadAhead:
+//  Reads a file a range at a time and prefetches the range after it.
+//  Each thread has one, leased by one reader at a time.
+// ------------------------------------------------------------------
+class CReadAhead
+{
+public:
+    // This thread's read-ahead, or nullptr if io_uring is off or unavailable
+    // or another reader on this thread holds it.
+    static CReadAhead* Acquire();
+    // Wait for the prefetch in flight and hand the read-ahead back.
+    void Release();
+
+    // nLen (<= VPK_ENTRY_MAX_LEN) bytes of nFd at nOffset, valid until the
+    // next Read(); nRead comes up short at the end of the file. Starts
+    // reading the nNextLen bytes after it in the background.
+    uint8_t* Read(int nFd, uint64_t nOffset, size_t nLen, size_t nNextLen, size_t& nRead);
+
+    ~CReadAhead();
+
+private:
+#ifdef REVPK_HAVE_IO_URING
+    struct Buffer_t
+    {
+        std::unique_ptr<uint8_t[]> m_pData;
+        int      m_nFd = -1;
+        uint64_t m_nOffset = 0;
+        size_t   m_nLen = 0;
+        int      m_nResult = 0;
+        bool     m_bPending = false;
+        bool     m_bValid = false;
+    };
+
+    bool Init();
+    bool Submit(int iBuffer, int nFd, uint64_t nOffset, size_t nLen);
+    void Complete(int iBuffer); // wait until iBuffer's read is done
+    void AbandonRing();         // the ring can't be reaped; pread() from now on
+
+    CIoRing  m_Ring;
+    Buffer_t m_Buffers[2];
+    int      m_iCurrent = 0;   // handed out by the last Read()
+    bool     m_bRingFailed = false;
+#endif
+    bool     m_bInUse = false;
+};
+
+// ------------------------------------------------------------------
+// CAsyncFileWriter:
+//  Writes fragments of extracted files in the background. Start() fails
+//  if io_uring is off or unavailable; then write synchronously.
+// ------------------------------------------------------------------
+class CAsyncFileWriter
+{
+public:
+    CAsyncFileWriter() = default;
+    ~CAsyncFileWriter(); // flushes
+
+    CAsyncFileWriter(const CAsyncFileWriter&) = delete;
+    CAsyncFileWriter& operator=(const CAsyncFileWriter&) = delete;
+
+    bool Start();
+
+    // A free registered buffer of VPK_ENTRY_MAX_LEN bytes; blocks while all
+    // of them are queued. Give it back with Write() or PutBuffer().
+    uint8_t* GetBuffer(int& iBuffer);
+    void     PutBuffer(int iBuffer);
+
+    // Write nLen bytes at nOffset of nFd, from buffer iBuffer or, with
+    // iBuffer < 0, from pData, which must stay valid until Flush(). pOwner
+    // keeps the file open until the write is done; name is for errors and
+    // must outlive the write.
+    void Write(int nFd, std::shared_ptr<void> pOwner, const std::string& name,
+               int iBuffer, const uint8_t* pData, size_t nLen, uint64_t nOffset);
+
+    // Wait until everything queued is written; false if any write failed.
+    bool Flush();
+
+private:
+#ifdef REVPK_HAVE_IO_URING
+    struct Request_t
+    {
+        int                   m_nFd;
+        std::shared_ptr<void> m_pOwner;
+        const std::string*    m_pName;
+        int                   m_iBuffer;
+        const uint8_t*        m_pData;
+        size_t                m_nLen;
+        uint64_t              m_nOffset;
+    };
+
+    void WriterThread();
+    void Finish(Request_t& request, int nResult);
+    void AbandonRing(); // the ring can't be submitted to; pwrite() from now on
+
+    CIoRing                    m_Ring;
+    std::vector<std::unique_ptr<uint8_t[]>> m_Buffers;
+    std::vector<int>           m_FreeBuffers;
+    std::vector<Request_t>     m_Queue;      // handed over, not yet submitted
+    size_t                     m_nInFlight = 0; // taken from m_Queue, not finished
+
+    // Requests in the ring, indexed by their user data (writer thread only).
+    std::vector<std::unique_ptr<Request_t>> m_Slots;
+    std::vector<size_t>        m_FreeSlots;
+    bool                       m_bRingFailed = false; // writer thread only
+
+    std::thread                m_Thread;
+    std::mutex                 m_Mutex;
+    std::condition_variable    m_QueueCV;    // requests queued, or stopping
+    std::condition_variable    m_BufferCV;   // buffer freed
+    std::condition_variable    m_IdleCV;     // nothing queued or in flight
+    bool                       m_bStop = false;
+    bool                       m_bFailed = false;
+#endif
+    bool                       m_bStarted = false;
+};
+
+#endif // ASYNCIO_H
@@ -0,0 +1,467 @@
+/**
+ * bench.cpp
+ *
+ * Implementation of `revpk bench` (see bench.h).
+ */
+
+#include "bench.h"
+#include "packedstore.h"
+#include "keyvalues.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+using BenchClock_t = std::chrono::steady_clock;
+
+/** One unit of work of a per-fragment stage. */
+struct BenchFragment_t
+{
+    std::vector<uint8_t> m_Raw;    // uncompressed bytes
+    std::vector<uint8_t> m_Packed; // output of the last compress stage
+    bool                 m_bPacked = false;
+};
+
+static double SecondsSince(BenchClock_t::time_point start)
+{
+    return std::chrono::duration<double>(BenchClock_t::now() - start).count();
+}
+
+// 1, 2, 4, ... and nMax itself.
+static std::vector<unsigned> GetThreadCounts(unsigned nMax)
+{
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < nMax; n *= 2)
+        counts.push_back(n);
+    counts.push_back(nMax);
+    return counts;
+}
+
+// Run work(i) for every i in [0, nCount) on nThreads threads. Fills the
+// latency of each item in milliseconds and returns the wall time in seconds.
+static double RunParallel(size_t nCount, unsigned nThreads,
+                          const std::function<void(size_t)>& work, std::vector<double>& latencies)
+{
+    latencies.assign(nCount, 0.0);
+    std::atomic<size_t> next{0};
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < nCount; i = next++)
+        {
+            const BenchClock_t::time_point start = BenchClock_t::now();
+            work(i);
+            latencies[i] = SecondsSince(start) * 1000.0;
+        }
+    };
+
+    const BenchClock_t::time_point start = BenchClock_t::now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nThreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+    return SecondsSince(start);
+}
+
+static void PrintHeader()
+{
+    std::cout << std::left << std::setw(26) << "stage" << std::right
+              << std::setw(8) << "threads" << std::setw(10) << "MB/s"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "max ms"
+              << std::setw(8) << "ratio" << "\n";
+}
+
+// nBytes is the uncompressed size the stage went through; ratio is packed/raw (0: none).
+static void PrintResult(const std::string& stage, unsigned nThreads, uint64_t nBytes,
+                        double seconds, std::vector<double>& latencies, double ratio = 0.0)
+{
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) -> double
+    {
+        if (latencies.empty())
+            return 0.0;
+        return latencies[std::min(latencies.size() - 1, size_t(p * double(latencies.size())))];
+    };
+
+    std::cout << std::left << std::setw(26) << stage << std::right << std::fixed
+              << std::setw(8) << nThreads
+              << std::setw(10) << std::setprecision(1) << (seconds > 0.0 ? nBytes / seconds / (1024.0 * 1024.0) : 0.0)
+              << std::setprecision(3)
+              << std::setw(10) << percentile(0.50) << std::setw(10) << percentile(0.90)
+              << std::setw(10) << percentile(0.99) << std::setw(10) << percentile(1.0)
+              << std::setprecision(3) << std::setw(8);
+    if (ratio > 0.0)
+        std::cout << ratio;
+    else
+        std::cout << "-";
+    std::cout << "\n" << std::defaultfloat;
+}
+
+// ------------------------------------------------------------------------
+//  Input
+// ------------------------------------------------------------------------
+// Read the manifest's files (the "read" stage) and cut them into fragments.
+static bool LoadManifestInput(const VPKBenchConfig_t& config, const std::vector<unsigned>& threadCounts,
+                              std::vector<BenchFragment_t>& fragments, std::vector<VPKEntryBlock_t>& entryBlocks)
+{
+    std::vector<VPKKeyValues_t> buildList;
+    if (!LoadKeyValuesManifest(config.m_ManifestFile, buildList))
+    {
+        std::cerr << "[ReVPK] ERROR: Could not load manifest: " << config.m_ManifestFile << "\n";
+        return false;
+    }
+
+    // Take files in manifest order until the byte budget is used up; of a
+    // first file bigger than the budget, only the start is read.
+    // Manifest paths are opened as-is, like the packers do.
+    std::vector<const VPKKeyValues_t*> files;
+    std::vector<uint64_t> fileSizes;
+    uint64_t totalBytes = 0;
+    for (const VPKKeyValues_t& kv : buildList)
+    {
+        std::error_code ec;
+        uint64_t size = fs::file_size(kv.m_EntryPath, ec);
+        if (ec || size == 0)
+            continue;
+        if (totalBytes + size > config.m_nMaxBytes)
+        {
+            if (totalBytes)
+                break;
+            size = config.m_nMaxBytes;
+        }
+
+        files.push_back(&kv);
+        fileSizes.push_back(size);
+        totalBytes += size;
+    }
+
+    std::vector<std::vector<uint8_t>> fileData(files.size());
+    std::vector<double> latencies;
+    for (unsigned nThreads : threadCounts)
+    {
+        // Only the first run can hit a cold page cache. Files that can't be
+        // read (any more) come back empty and are skipped below.
+        std::atomic<uint64_t> readBytes{0};
+        const double seconds = RunParallel(files.size(), nThreads, [&](size_t i)
+            {
+                std::vector<uint8_t>& data = fileData[i];
+                data.resize(size_t(fileSizes[i]));
+                std::ifstream ifs(files[i]->m_EntryPath, std::ios::binary);
+                if (ifs)
+                    ifs.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+                if (!ifs)
+                    data.clear();
+                readBytes += data.size();
+            }, latencies);
+        PrintResult("read", nThreads, readBytes.load(), seconds, latencies);
+    }
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const std::vector<uint8_t>& data = fileData[i];
+        if (data.empty())
+        {
+            std::cerr << "[ReVPK] WARNING: Could not read " << files[i]->m_EntryPath << ", skipping it.\n";
+            continue;
+        }
+
+        entryBlocks.emplace_back(data.data(), data.size(), 0, files[i]->m_iPreloadSize, 0,
+                                 files[i]->m_nLoadFlags, files[i]->m_nTextureFlags,
+                                 files[i]->m_EntryPath.c_str());
+
+        for (size_t pos = 0; pos < data.size(); pos += VPK_ENTRY_MAX_LEN)
+        {
+            BenchFragment_t frag;
+            frag.m_Raw.assign(data.begin() + pos, data.begin() + std::min(data.size(), pos + VPK_ENTRY_MAX_LEN));
+            fragments.push_back(std::move(frag));
+        }
+    }
+    return true;
+}
+
+// Read the stored fragments of a VPK (the "read" stage) and decompress them.
+static bool LoadVpkInput(const VPKBenchConfig_t& config, const std::vector<unsigned>& threadCounts,
+                         CPackedStoreBuilder& builder, std::vector<BenchFragment_t>& fragments,
+                         std::vector<VPKEntryBlock_t>& entryBlocks)
+{
+    VPKDir_t vpkDir(config.m_DirFile);
+    if (vpkDir.Failed())
+    {
+        std::cerr << "[ReVPK] ERROR: Could not parse VPK directory: " << config.m_DirFile << "\n";
+        return false;
+    }
+    builder.LoadZstdDicts(vpkDir);
+    entryBlocks = vpkDir.m_EntryBlocks;
+
+    struct StoredFragment_t
+    {
+        uint16_t                    m_iPackFileIndex;
+        const VPKChunkDescriptor_t* m_pDescriptor;
+    };
+    std::vector<StoredFragment_t> stored;
+    std::map<uint16_t, int> packFds;
+    uint64_t totalBytes = 0;
+    uint64_t totalStored = 0;
+
+    for (const VPKEntryBlock_t& block : vpkDir.m_EntryBlocks)
+    {
+        if (totalBytes >= config.m_nMaxBytes)
+            break;
+
+        for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
+        {
+            if (frag.m_nCompressedSize == 0 || frag.m_nUncompressedSize > VPK_ENTRY_MAX_LEN)
+                continue;
+
+            if (packFds.find(block.m_iPackFileIndex) == packFds.end())
+            {
+                const std::string packFile = (fs::path(vpkDir.m_DirFilePath).parent_path() /
+                                              vpkDir.GetPackFileNameForIndex(block.m_iPackFileIndex)).string();
+                const int fd = open(packFile.c_str(), O_RDONLY);
+                if (fd < 0)
+                    std::cerr << "[ReVPK] WARNING: Cannot open pack file " << packFile << "\n";
+                packFds[block.m_iPackFileIndex] = fd;
+            }
+            if (packFds[block.m_iPackFileIndex] < 0)
+                continue;
+
+            stored.push_back({ block.m_iPackFileIndex, &frag });
+            totalBytes  += frag.m_nUncompressedSize;
+            totalStored += frag.m_nCompressedSize;
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> storedData(stored.size());
+    std::vector<double> latencies;
+    for (unsigned nThreads : threadCounts)
+    {
+        const double seconds = RunParallel(stored.size(), nThreads, [&](size_t i)
+            {
+                const VPKChunkDescriptor_t& frag = *stored[i].m_pDescriptor;
+                storedData[i].resize(size_t(frag.m_nCompressedSize));
+                const ssize_t got = pread(packFds[stored[i].m_iPackFileIndex], storedData[i].data(),
+                                          storedData[i].size(), off_t(frag.m_nPackFileOffset));
+                if (got != ssize_t(storedData[i].size()))
+                    storedData[i].clear();
+            }, latencies);
+        PrintResult("read", nThreads, totalStored, seconds, latencies);
+    }
+
+    for (auto& it : packFds)
+    {
+        if (it.second >= 0)
+            close(it.second);
+    }
+
+    std::vector<uint8_t> rawBuf(VPK_ENTRY_MAX_LEN);
+    for (size_t i = 0; i < stored.size(); i++)
+    {
+        const VPKChunkDescriptor_t& frag = *stored[i].m_pDescriptor;
+        const std::vector<uint8_t>& data = storedData[i];
+        if (data.empty())
+            continue;
+
+        BenchFragment_t benchFrag;
+        size_t rawLen = data.size();
+        if (frag.m_nCompressedSize == frag.m_nUncompressedSize)
+            benchFrag.m_Raw = data;
+        else if (builder.DecompressChunk(data.data(), data.size(), rawBuf.data(), rawLen))
+            benchFrag.m_Raw.assign(rawBuf.begin(), rawBuf.begin() + rawLen);
+        else
+            continue;
+        fragments.push_back(std::move(benchFrag));
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------
+//  Stages
+// ------------------------------------------------------------------------
+// Compress every fragment with codec at each thread count, then decompress
+// the output of the last run.
+static void BenchCodec(const std::string& name, const VPKCodec_t& codec, const CPackedStoreBuilder& builder,
+                       const std::vector<unsigned>& threadCounts, std::vector<BenchFragment_t>& fragments,
+                       uint64_t totalBytes)
+{
+    std::vector<double> latencies;
+    for (unsigned nThreads : threadCounts)
+    {
+        const double seconds = RunParallel(fragments.size(), nThreads, [&](size_t i)
+            {
+                thread_local std::vector<uint8_t> packedBuf(VPK_ENTRY_MAX_LEN);
+                BenchFragment_t& frag = fragments[i];
+                size_t packedLen = 0;
+                frag.m_bPacked = builder.CompressChunk(frag.m_Raw.data(), frag.m_Raw.size(),
+                                                       packedBuf.data(), packedLen, codec);
+                frag.m_Packed.assign(packedBuf.begin(), packedBuf.begin() + (frag.m_bPacked ? packedLen : 0));
+            }, latencies);
+
+        uint64_t packedBytes = 0;
+        for (const BenchFragment_t& frag : fragments)
+            packedBytes += frag.m_bPacked ? frag.m_Packed.size() : frag.m_Raw.size();
+        PrintResult(name + " compress", nThreads, totalBytes, seconds, latencies,
+                    double(packedBytes) / double(totalBytes));
+    }
+
+    // Fragments that didn't shrink are stored raw and never decompressed.
+    std::vector<size_t> packed;
+    uint64_t packedRawBytes = 0;
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+        if (fragments[i].m_bPacked)
+        {
+            packed.push_back(i);
+            packedRawBytes += fragments[i].m_Raw.size();
+        }
+    }
+
+    for (unsigned nThreads : threadCounts)
+    {
+        std::atomic<size_t> failures{0};
+        const double seconds = RunParallel(packed.size(), nThreads, [&](size_t i)
+            {
+                thread_local std::vector<uint8_t> rawBuf(VPK_ENTRY_MAX_LEN);
+                const BenchFragment_t& frag = fragments[packed[i]];
+                size_t rawLen = 0;
+                if (!builder.DecompressChunk(frag.m_Packed.data(), frag.m_Packed.size(), rawBuf.data(), rawLen) ||
+                    rawLen != frag.m_Raw.size())
+                {
+                    failures++;
+                }
+            }, latencies);
+        PrintResult(name + " decompress", nThreads, packedRawBytes, seconds, latencies);
+
+        if (failures)
+            std::cerr << "[ReVPK] WARNING: " << failures << " fragments failed to decompress with " << name << "\n";
+    }
+}
+
+// Write and re-parse a directory of entryBlocks a few times.
+static void BenchDirectory(const VPKBenchConfig_t& config, const std::vector<VPKEntryBlock_t>& entryBlocks)
+{
+    const std::string dirFile = (fs::temp_directory_path() /
+        ("revpk_bench_" + std::to_string(getpid()) + ".pak000_dir.vpk")).string();
+
+    std::vector<double> writeTimes;
+    std::vector<double> parseTimes;
+    for (int i = 0; i < std::max(1, config.m_nDirRepeat); i++)
+    {
+        BenchClock_t::time_point start = BenchClock_t::now();
+        VPKDir_t writer;
+        writer.BuildDirectoryFile(dirFile, entryBlocks);
+        writeTimes.push_back(SecondsSince(start) * 1000.0);
+
+        start = BenchClock_t::now();
+        VPKDir_t reader(dirFile);
+        parseTimes.push_back(SecondsSince(start) * 1000.0);
+        if (reader.Failed() || reader.m_EntryBlocks.size() != entryBlocks.size())
+            std::cerr << "[ReVPK] WARNING: Directory did not round-trip.\n";
+    }
+
+    std::error_code ec;
+    const uint64_t dirSize = fs::file_size(dirFile, ec);
+    fs::remove(dirFile, ec);
+
+    auto report = [&](const char* stage, std::vector<double>& times)
+    {
+        const double best = *std::min_element(times.begin(), times.end());
+        std::cout << std::left << std::setw(26) << stage << std::right << std::fixed << std::setprecision(3)
+                  << " best " << best << " ms of " << times.size() << " runs, "
+                  << std::setprecision(0) << (best > 0.0 ? entryBlocks.size() / (best / 1000.0) : 0.0)
+                  << " entries/s\n" << std::defaultfloat;
+    };
+
+    std::cout << "\n[ReVPK] Directory: " << entryBlocks.size() << " entries, " << dirSize << " bytes\n";
+    report("dir write", writeTimes);
+    report("dir parse", parseTimes);
+}
+
+// ------------------------------------------------------------------------
+//  RunBench
+// ------------------------------------------------------------------------
+bool RunBench(const VPKBenchConfig_t& config)
+{
+    const unsigned nMaxThreads = (config.m_nMaxThreads > 0)
+        ? unsigned(config.m_nMaxThreads)
+        : std::max(1u, std::thread::hardware_concurrency());
+    const std::vector<unsigned> threadCounts = GetThreadCounts(nMaxThreads);
+
+    // Workers run one fragment each, so LZHAM gets no helper threads.
+    CPackedStoreBuilder builder;
+    builder.InitLzEncoder(0, "uber");
+
+    PrintHeader();
+
+    std::vector<BenchFragment_t> fragments;
+    std::vector<VPKEntryBlock_t> entryBlocks;
+    const bool bLoaded = config.m_DirFile.empty()
+        ? LoadManifestInput(config, threadCounts, fragments, entryBlocks)
+        : LoadVpkInput(config, threadCounts, builder, fragments, entryBlocks);
+    if (!bLoaded || fragments.empty())
+    {
+        std::cerr << "[ReVPK] ERROR: Nothing to benchmark.\n";
+        return false;
+    }
+
+    uint64_t totalBytes = 0;
+    for (const BenchFragment_t& frag : fragments)
+        totalBytes += frag.m_Raw.size();
+
+    std::cout << "[ReVPK] " << fragments.size() << " fragments, " << (totalBytes / 1024) << " KiB\n";
+
+    std::vector<double> latencies;
+    for (unsigned nThreads : threadCounts)
+    {
+        const double seconds = RunParallel(fragments.size(), nThreads, [&](size_t i)
+            {
+                compute_crc32(fragments[i].m_Raw.data(), fragments[i].m_Raw.size());
+            }, latencies);
+        PrintResult("crc32", nThreads, totalBytes, seconds, latencies);
+    }
+    for (unsigned nThreads : threadCounts)
+    {
+        const double seconds = RunParallel(fragments.size(), nThreads, [&](size_t i)
+            {
+                compute_chunk_hash(fragments[i].m_Raw.data(), fragments[i].m_Raw.size());
+            }, latencies);
+        PrintResult("xxh64", nThreads, totalBytes, seconds, latencies);
+    }
+
+    static const char* const lzhamLevels[LZHAM_TOTAL_COMP_LEVELS] = {
+        "fastest", "faster", "default", "better", "uber"
+    };
+    for (int level = 0; level < int(LZHAM_TOTAL_COMP_LEVELS); level++)
+    {
+        VPKCodec_t codec;
+        codec.m_eMethod = kCompressionLZHAM;
+        codec.m_nLzhamLevel = level;
+        BenchCodec(std::string("lzham:") + lzhamLevels[level], codec, builder, threadCounts, fragments, totalBytes);
+    }
+
+    for (int level : { 1, 3, VPKZstdParams_t().m_nLevel, 12, 19 })
+    {
+        VPKCodec_t codec;
+        codec.m_eMethod = kCompressionZSTD;
+        codec.m_nZstdLevel = level;
+        BenchCodec("zstd:" + std::to_string(level), codec, builder, threadCounts, fragments, totalBytes);
+    }
+
+    BenchDirectory(config, entryBlocks);
+    return true;
+}
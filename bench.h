@@ -0,0 +1,31 @@
+/**
+ * bench.h
+ *
+ * `revpk bench`: throughput and per-fragment latency of the tool's hot paths
+ * (reading, CRC32, dedup hashing, LZHAM and ZSTD at each level, directory
+ * parse and write) on real data, either the files of a pack manifest or the
+ * contents of an existing VPK. Every per-fragment stage is run with 1, 2,
+ * 4, ... up to the maximum number of threads, to size build machines and
+ * catch regressions.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdint>
+#include <string>
+
+struct VPKBenchConfig_t
+{
+    std::string m_DirFile;       // bench the contents of this directory file...
+    std::string m_ManifestFile;  // ...or the files of this manifest
+
+    int      m_nMaxThreads = 0;                 // <= 0: all cores
+    uint64_t m_nMaxBytes   = 32 * 1024 * 1024;  // stop loading input past this
+    int      m_nDirRepeat  = 3;                 // runs of the directory stages
+};
+
+// Load the input and print a table per stage; false if there was nothing to bench.
+bool RunBench(const VPKBenchConfig_t& config);
+
+#endif // BENCH_H
@@ -0,0 +1,267 @@
+/**
+ * chunkcache.cpp
+ *
+ * Implementation of the persistent compressed-fragment cache (see chunkcache.h).
+ */
+
+#include "chunkcache.h"
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <xxhash.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk layout of chunks.idx: a header followed by fixed-size records.
+static constexpr uint32_t CHUNKCACHE_MAGIC   = 0x49434352; // 'RCCI'
+static constexpr uint32_t CHUNKCACHE_VERSION = 2;
+static constexpr uint32_t CHUNKCACHE_FLAG_COMPRESSED = 1 << 0;
+
+struct ChunkCacheHeader_t
+{
+    uint32_t m_nMagic;
+    uint32_t m_nVersion;
+};
+
+struct ChunkCacheRecord_t
+{
+    uint64_t m_nRawHash;
+    uint64_t m_nCodecKey;
+    uint64_t m_nBlobOffset;
+    uint32_t m_nRawSize;
+    uint32_t m_nBlobSize;
+    uint32_t m_nFlags;
+    uint32_t m_nBlobHash; // XXH32 of the blob, checked before it is used
+};
+static_assert(sizeof(ChunkCacheHeader_t) == 8,  "chunk cache header must be 8 bytes");
+static_assert(sizeof(ChunkCacheRecord_t) == 40, "chunk cache record must be 40 bytes");
+
+// ------------------------------------------------------------------------
+//  CChunkCache
+// ------------------------------------------------------------------------
+CChunkCache::CChunkCache()
+: m_nBlobFd(-1), m_nIndexFd(-1), m_nBlobSize(0), m_nHits(0), m_nMisses(0)
+{
+}
+
+CChunkCache::~CChunkCache()
+{
+    Close();
+}
+
+bool CChunkCache::Open(const std::string& cacheDir)
+{
+    namespace fs = std::filesystem;
+    Close();
+
+    std::error_code ec;
+    fs::create_directories(cacheDir, ec);
+    if (ec)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot create chunk cache directory: " << cacheDir << "\n";
+        return false;
+    }
+
+    const std::string blobPath  = (fs::path(cacheDir) / "chunks.bin").string();
+    const std::string indexPath = (fs::path(cacheDir) / "chunks.idx").string();
+
+    m_nIndexFd = open(indexPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+    if (m_nIndexFd < 0)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot open chunk cache in " << cacheDir << "\n";
+        return false;
+    }
+
+    // Blobs are appended at an offset cached below, so only one run may use
+    // the cache at a time. The lock goes away with the descriptor.
+    if (flock(m_nIndexFd, LOCK_EX | LOCK_NB) != 0)
+    {
+        std::cerr << "[ReVPK] ERROR: Chunk cache in " << cacheDir << " is in use by another process.\n";
+        Close();
+        return false;
+    }
+
+    m_nBlobFd = open(blobPath.c_str(), O_RDWR | O_CREAT, 0666);
+    if (m_nBlobFd < 0)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot open chunk cache in " << cacheDir << "\n";
+        Close();
+        return false;
+    }
+
+    struct stat blobStat, indexStat;
+    if (fstat(m_nBlobFd, &blobStat) != 0 || fstat(m_nIndexFd, &indexStat) != 0)
+    {
+        Close();
+        return false;
+    }
+    m_nBlobSize = static_cast<uint64_t>(blobStat.st_size);
+
+    std::vector<uint8_t> indexData(static_cast<size_t>(indexStat.st_size));
+    if (!indexData.empty() &&
+        pread(m_nIndexFd, indexData.data(), indexData.size(), 0) != (ssize_t)indexData.size())
+    {
+        indexData.clear();
+    }
+
+    ChunkCacheHeader_t header = {};
+    if (indexData.size() >= sizeof(header))
+        std::memcpy(&header, indexData.data(), sizeof(header));
+
+    if (header.m_nMagic != CHUNKCACHE_MAGIC || header.m_nVersion != CHUNKCACHE_VERSION)
+    {
+        // Missing, foreign or outdated cache: start over.
+        if (!indexData.empty())
+            std::cout << "[ReVPK] Chunk cache in " << cacheDir << " is outdated, resetting it.\n";
+
+        header.m_nMagic   = CHUNKCACHE_MAGIC;
+        header.m_nVersion = CHUNKCACHE_VERSION;
+
+        if (ftruncate(m_nBlobFd, 0) != 0 || ftruncate(m_nIndexFd, 0) != 0 ||
+            write(m_nIndexFd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+        {
+            std::cerr << "[ReVPK] ERROR: Cannot initialize chunk cache in " << cacheDir << "\n";
+            Close();
+            return false;
+        }
+        m_nBlobSize = 0;
+        return true;
+    }
+
+    // Load all complete records. Ones that point past the end of the blob
+    // store (e.g. after an interrupted run) are skipped.
+    const size_t numRecords = (indexData.size() - sizeof(header)) / sizeof(ChunkCacheRecord_t);
+    m_Index.reserve(numRecords);
+
+    for (size_t i = 0; i < numRecords; i++)
+    {
+        ChunkCacheRecord_t record;
+        std::memcpy(&record, indexData.data() + sizeof(header) + i * sizeof(record), sizeof(record));
+
+        if (record.m_nBlobOffset + record.m_nBlobSize > m_nBlobSize)
+            continue;
+
+        Key_t key = { record.m_nRawHash, record.m_nCodecKey, record.m_nRawSize };
+        Value_t value = { record.m_nBlobOffset, record.m_nBlobSize, record.m_nBlobHash,
+                          (record.m_nFlags & CHUNKCACHE_FLAG_COMPRESSED) != 0 };
+        m_Index[key] = value;
+    }
+
+    // Drop a partially written trailing record so new ones stay aligned.
+    const size_t validSize = sizeof(header) + numRecords * sizeof(ChunkCacheRecord_t);
+    if (validSize != indexData.size() && ftruncate(m_nIndexFd, validSize) != 0)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot repair chunk cache index in " << cacheDir << "\n";
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void CChunkCache::Close()
+{
+    if (m_nBlobFd >= 0)
+        close(m_nBlobFd);
+    if (m_nIndexFd >= 0)
+        close(m_nIndexFd);
+
+    m_nBlobFd  = -1;
+    m_nIndexFd = -1;
+    m_nBlobSize = 0;
+    m_Index.clear();
+}
+
+size_t CChunkCache::GetEntries() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Index.size();
+}
+
+bool CChunkCache::Lookup(uint64_t nRawHash, uint32_t nRawSize, uint64_t nCodecKey,
+                         uint8_t* pDst, size_t nDstCapacity, size_t& nDstLen, bool& bCompressed)
+{
+    Value_t value;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto it = m_Index.find(Key_t{ nRawHash, nCodecKey, nRawSize });
+        if (it == m_Index.end())
+        {
+            m_nMisses++;
+            return false;
+        }
+        value = it->second;
+    }
+
+    bCompressed = value.m_bCompressed;
+    if (bCompressed)
+    {
+        // Blobs are never rewritten, so this read needs no lock.
+        if (value.m_nBlobSize > nDstCapacity ||
+            pread(m_nBlobFd, pDst, value.m_nBlobSize, value.m_nBlobOffset) != (ssize_t)value.m_nBlobSize)
+        {
+            m_nMisses++;
+            return false;
+        }
+
+        // A torn or corrupt blob must not end up in a pack. Drop its record
+        // so the fragment is compressed and stored again.
+        if (XXH32(pDst, value.m_nBlobSize, 0) != value.m_nBlobHash)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Index.erase(Key_t{ nRawHash, nCodecKey, nRawSize });
+            m_nMisses++;
+            return false;
+        }
+        nDstLen = value.m_nBlobSize;
+    }
+
+    m_nHits++;
+    return true;
+}
+
+void CChunkCache::Store(uint64_t nRawHash, uint32_t nRawSize, uint64_t nCodecKey,
+                        const uint8_t* pData, size_t nLen)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const Key_t key = { nRawHash, nCodecKey, nRawSize };
+    if (m_Index.find(key) != m_Index.end())
+        return; // another worker stored it first
+
+    Value_t value = { m_nBlobSize, 0, 0, pData != nullptr };
+    if (pData)
+    {
+        // Append the blob before its index record, so a record never
+        // points at bytes that aren't on disk.
+        if (pwrite(m_nBlobFd, pData, nLen, m_nBlobSize) != (ssize_t)nLen)
+        {
+            std::cerr << "[ReVPK] WARNING: Failed to write to chunk cache.\n";
+            return;
+        }
+        value.m_nBlobSize = static_cast<uint32_t>(nLen);
+        value.m_nBlobHash = XXH32(pData, nLen, 0);
+        m_nBlobSize += nLen;
+    }
+
+    ChunkCacheRecord_t record = {};
+    record.m_nRawHash    = nRawHash;
+    record.m_nCodecKey   = nCodecKey;
+    record.m_nBlobOffset = value.m_nBlobOffset;
+    record.m_nRawSize    = nRawSize;
+    record.m_nBlobSize   = value.m_nBlobSize;
+    record.m_nFlags      = value.m_bCompressed ? CHUNKCACHE_FLAG_COMPRESSED : 0;
+    record.m_nBlobHash   = value.m_nBlobHash;
+
+    if (write(m_nIndexFd, &record, sizeof(record)) != (ssize_t)sizeof(record))
+    {
+        std::cerr << "[ReVPK] WARNING: Failed to write to chunk cache index.\n";
+        return;
+    }
+
+    m_Index.emplace(key, value);
+}
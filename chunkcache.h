@@ -0,0 +1,97 @@
+/**
+ * chunkcache.h
+ *
+ * Persistent, content-addressed cache of compressed fragments, so repacks
+ * only compress fragments that actually changed. Lives in two files:
+ *  - chunks.bin: append-only blob store of compressed fragment bytes
+ *  - chunks.idx: append-only index of fixed-size records pointing into it
+ *
+ * Entries are keyed by (raw fragment hash, raw size, codec key); the codec
+ * key identifies the compressor and its settings. Fragments that did not
+ * compress are recorded too, so they are not retried on the next run.
+ *
+ * Only one process may use a cache directory at a time (flock on chunks.idx),
+ * and every blob is checked against its recorded hash before it is used.
+ */
+
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+class CChunkCache
+{
+public:
+    CChunkCache();
+    ~CChunkCache();
+
+    CChunkCache(const CChunkCache&) = delete;
+    CChunkCache& operator=(const CChunkCache&) = delete;
+
+    // Open (or create) the cache in cacheDir and load its index.
+    bool Open(const std::string& cacheDir);
+    void Close();
+    bool IsOpen() const { return m_nBlobFd >= 0; }
+
+    // Look up a fragment. On a hit, bCompressed tells whether the fragment
+    // compressed; if so its bytes are copied into pDst (nDstCapacity bytes)
+    // and nDstLen is set.
+    bool Lookup(uint64_t nRawHash, uint32_t nRawSize, uint64_t nCodecKey,
+                uint8_t* pDst, size_t nDstCapacity, size_t& nDstLen, bool& bCompressed);
+
+    // Record the compressed bytes of a fragment, or that it didn't compress (pData == nullptr).
+    void Store(uint64_t nRawHash, uint32_t nRawSize, uint64_t nCodecKey,
+               const uint8_t* pData, size_t nLen);
+
+    size_t GetHits()    const { return m_nHits.load(); }
+    size_t GetMisses()  const { return m_nMisses.load(); }
+    size_t GetEntries() const;
+
+private:
+    struct Key_t
+    {
+        uint64_t m_nRawHash;
+        uint64_t m_nCodecKey;
+        uint32_t m_nRawSize;
+
+        bool operator==(const Key_t& other) const
+        {
+            return m_nRawHash == other.m_nRawHash &&
+                   m_nCodecKey == other.m_nCodecKey &&
+                   m_nRawSize == other.m_nRawSize;
+        }
+    };
+
+    struct KeyHash_t
+    {
+        size_t operator()(const Key_t& key) const
+        {
+            return static_cast<size_t>(key.m_nRawHash ^ (key.m_nCodecKey * 0x9E3779B97F4A7C15ULL));
+        }
+    };
+
+    struct Value_t
+    {
+        uint64_t m_nBlobOffset;
+        uint32_t m_nBlobSize;
+        uint32_t m_nBlobHash;
+        bool     m_bCompressed;
+    };
+
+    int      m_nBlobFd;
+    int      m_nIndexFd;
+    uint64_t m_nBlobSize; // next append offset in chunks.bin
+
+    mutable std::mutex                               m_Mutex;
+    std::unordered_map<Key_t, Value_t, KeyHash_t>    m_Index;
+
+    std::atomic<size_t> m_nHits;
+    std::atomic<size_t> m_nMisses;
+};
+
+#endif // CHUNKCACHE_H
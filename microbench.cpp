@@ -0,0 +1,220 @@
+/**
+ * microbench.cpp
+ *
+ * revpk_bench: microbenchmarks for the metadata paths that dominate `ls`,
+ * multi-language unpack and directory writes. Runs offline on synthetic
+ * directories (10k, 100k and 500k entries by default), so no game data is
+ * needed and results are comparable between commits.
+ *
+ *   revpk_bench [numEntries...]
+ */
+
+#include "packedstore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+using BenchClock_t = std::chrono::steady_clock;
+
+static constexpr int BENCH_RUNS = 3;
+
+/** Best wall time of BENCH_RUNS runs of fn, in milliseconds. */
+template <typename Fn>
+static double BestOf(Fn&& fn)
+{
+    double best = 0.0;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        const BenchClock_t::time_point start = BenchClock_t::now();
+        fn();
+        const double ms = std::chrono::duration<double, std::milli>(BenchClock_t::now() - start).count();
+        best = (i == 0) ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+static void Report(const char* name, size_t nCount, double ms)
+{
+    std::cout << "  " << std::left << std::setw(28) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(12) << ms << " ms"
+              << std::setprecision(1) << std::setw(12) << (ms * 1e6 / double(nCount)) << " ns/entry\n"
+              << std::defaultfloat;
+}
+
+// ------------------------------------------------------------------------
+//  Synthetic input
+// ------------------------------------------------------------------------
+// Paths spread over a few extensions and a directory tree about as deep and
+// wide as a real map's, so the tree builder sees realistic grouping.
+static std::vector<std::string> MakeEntryPaths(size_t nCount)
+{
+    static const char* const extensions[] = { "nut", "vmt", "vtf", "txt", "rui", "mdl", "bsp_lump", "cfg" };
+    static const char* const roots[] = { "scripts/vscripts", "materials/models", "models/weapons",
+                                         "resource/ui", "maps/graphs", "sound" };
+
+    std::vector<std::string> paths;
+    paths.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++)
+    {
+        const char* ext  = extensions[i % (sizeof(extensions) / sizeof(extensions[0]))];
+        const char* root = roots[(i / 7) % (sizeof(roots) / sizeof(roots[0]))];
+        paths.push_back(std::string(root) + "/dir" + std::to_string((i / 64) % 2048) +
+                        "/file" + std::to_string(i) + "." + ext);
+    }
+    return paths;
+}
+
+// Entries with mostly a single small fragment, every 16th one spanning
+// three; pack offsets are made up.
+static std::vector<VPKEntryBlock_t> MakeEntryBlocks(const std::vector<std::string>& paths,
+                                                    const std::vector<uint8_t>& data)
+{
+    std::vector<VPKEntryBlock_t> blocks;
+    blocks.reserve(paths.size());
+    uint64_t offset = 0;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        const size_t len = 256 + (i * 131) % (data.size() - 256);
+        blocks.emplace_back(data.data(), len, offset, 0, uint16_t(i % 4), 3, 0, paths[i].c_str());
+        VPKEntryBlock_t& block = blocks.back();
+        if (i % 16 == 0)
+        {
+            block.m_Fragments.push_back(block.m_Fragments.back());
+            block.m_Fragments.push_back(block.m_Fragments.back());
+        }
+        for (VPKChunkDescriptor_t& frag : block.m_Fragments)
+        {
+            frag.m_nPackFileOffset = offset;
+            offset += frag.m_nCompressedSize;
+        }
+    }
+    return blocks;
+}
+
+// ------------------------------------------------------------------------
+//  Benchmarks
+// ------------------------------------------------------------------------
+static void RunBenchmarks(size_t nEntries)
+{
+    std::cout << "[ReVPK] " << nEntries << " entries\n";
+
+    std::vector<uint8_t> data(4096);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint8_t((i * 2654435761u) >> 13);
+
+    const std::vector<std::string> paths = MakeEntryPaths(nEntries);
+
+    std::vector<VPKEntryBlock_t> blocks;
+    Report("VPKEntryBlock_t()", nEntries, BestOf([&]() { blocks = MakeEntryBlocks(paths, data); }));
+
+    VPKDir_t::CTreeBuilder tree;
+    Report("CTreeBuilder::BuildTree", nEntries, BestOf([&]()
+        {
+            tree = VPKDir_t::CTreeBuilder();
+            tree.BuildTree(blocks);
+        }));
+
+    const std::string dirFile = (fs::temp_directory_path() /
+        ("englishclient_revpk_bench_" + std::to_string(getpid()) + ".bsp.pak000_dir.vpk")).string();
+    Report("CTreeBuilder::WriteTree", nEntries, BestOf([&]()
+        {
+            std::ofstream ofs(dirFile, std::ios::binary);
+            tree.WriteTree(ofs);
+        }));
+
+    VPKDir_t writer;
+    Report("BuildDirectoryFile", nEntries, BestOf([&]() { writer.BuildDirectoryFile(dirFile, blocks); }));
+
+    size_t nParsed = 0;
+    Report("VPKDir_t::Init", nEntries, BestOf([&]()
+        {
+            VPKDir_t reader(dirFile);
+            nParsed = reader.m_EntryBlocks.size();
+        }));
+    if (nParsed != nEntries)
+        std::cerr << "[ReVPK] WARNING: Parsed " << nParsed << " of " << nEntries << " entries.\n";
+
+    const VPKDir_t parsed(dirFile);
+    size_t nFound = 0;
+    Report("VPKDir_t::FindEntry", nEntries, BestOf([&]()
+        {
+            nFound = 0;
+            for (const std::string& path : paths)
+                nFound += parsed.FindEntry(path) ? 1 : 0;
+        }));
+
+    std::error_code ec;
+    fs::remove(dirFile, ec);
+
+    // Dedup: hash every entry's data, insert into an empty table, then look
+    // all of them up again (every lookup hits).
+    std::vector<uint64_t> hashes(nEntries);
+    Report("compute_chunk_hash", nEntries, BestOf([&]()
+        {
+            for (size_t i = 0; i < nEntries; i++)
+            {
+                const VPKChunkDescriptor_t& frag = blocks[i].m_Fragments.front();
+                hashes[i] = compute_chunk_hash(data.data(), size_t(frag.m_nUncompressedSize)) ^ i;
+            }
+        }));
+
+    CChunkDedupTable table;
+    Report("CChunkDedupTable insert", nEntries, BestOf([&]()
+        {
+            table.Clear();
+            for (size_t i = 0; i < nEntries; i++)
+            {
+                VPKChunkDescriptor_t desc = blocks[i].m_Fragments.front();
+                table.FindOrInsert(hashes[i], desc, [](VPKChunkDescriptor_t&) {});
+            }
+        }));
+
+    size_t nHits = 0;
+    Report("CChunkDedupTable find", nEntries, BestOf([&]()
+        {
+            nHits = 0;
+            VPKChunkDescriptor_t desc;
+            for (size_t i = 0; i < nEntries; i++)
+                nHits += table.Find(hashes[i], desc) ? 1 : 0;
+        }));
+
+    size_t nNameBytes = 0;
+    Report("GetPackFileNameForIndex", nEntries, BestOf([&]()
+        {
+            nNameBytes = 0;
+            for (size_t i = 0; i < nEntries; i++)
+                nNameBytes += parsed.GetPackFileNameForIndex(uint16_t(i % 4)).size();
+        }));
+
+    if (nFound != nEntries || nHits != nEntries || nNameBytes == 0)
+        std::cerr << "[ReVPK] WARNING: Lookups came back short.\n";
+    std::cout << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+    {
+        const size_t nEntries = std::strtoull(argv[i], nullptr, 10);
+        if (nEntries)
+            sizes.push_back(nEntries);
+    }
+    if (sizes.empty())
+        sizes = { 10000, 100000, 500000 };
+
+    for (size_t nEntries : sizes)
+        RunBenchmarks(nEntries);
+    return 0;
+}
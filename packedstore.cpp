@@ -5,18 +5,34 @@
  */
 #include "keyvalues.h"
 #include "packedstore.h"
+#include "chunkcache.h"
+#include "policy.h"
+#include "progress.h"
+#include "threadpool.h"
+#include "asyncio.h"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <string_view>
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
 #include <thread>
 #include <mutex>
 #include <queue>
+#include <unordered_set>
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <future>
 #include <xxhash.h>
+// POSIX file mapping
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 // OpenSSL for SHA
 #include <openssl/sha.h>
 // Zlib for CRC32
@@ -25,46 +41,55 @@
 // --------------------
 
 /** Helper: do real CRC32 using Zlib. */
-static uint32_t compute_crc32(const uint8_t* data, size_t len)
+uint32_t compute_crc32(const uint8_t* data, size_t len)
 {
     return crc32_z(0, data, len);
 }
 
-/** Helper: do real SHA1 using OpenSSL. Returns hex string. */
-std::string compute_sha1_hex(const uint8_t* data, size_t len)
+/** Helper: 64-bit content hash used as the chunk dedup key. */
+uint64_t compute_chunk_hash(const uint8_t* data, size_t len)
 {
-    XXH64_hash_t hash = XXH64(data, len, 0);  // 0 is the seed
-    // Convert to string for map key - using hex for readability
-    char buffer[17];  // 16 chars + null terminator
-snprintf(buffer, sizeof(buffer), "%016lx", hash);
-
-    return std::string(buffer);
+    return XXH64(data, len, 0);  // 0 is the seed
 }
 
 /**
  * Determine LZHAM compression level from string
  */
 // --- ZSTD support ---
-static lzham_compress_level parseCompressionLevel(const char* levelStr, CPackedStoreBuilder* pBuilder)
+static bool parseCompressionLevel(const char* levelStr, CPackedStoreBuilder* pBuilder, lzham_compress_level& outLevel)
 {
+    outLevel = LZHAM_COMP_LEVEL_DEFAULT;
     if (!levelStr)
-        return LZHAM_COMP_LEVEL_DEFAULT;
+        return true;
 
     std::string s(levelStr);
-    if (s == "zstd")
+    if (s == "zstd" || s.rfind("zstd:", 0) == 0)
     {
-        // We'll tell the builder we want ZSTD:
+        // We'll tell the builder we want ZSTD, at the level after the colon if given:
         pBuilder->m_eCompressionMethod = kCompressionZSTD;
-        // Just return a dummy LZHAM level to keep old code happy:
-        return LZHAM_COMP_LEVEL_DEFAULT;
+        if (s.size() > 4)
+        {
+            char* pEnd = nullptr;
+            const long nLevel = std::strtol(s.c_str() + 5, &pEnd, 10);
+            if (pEnd == s.c_str() + 5 || *pEnd != '\0' ||
+                nLevel < ZSTD_minCLevel() || nLevel > ZSTD_maxCLevel())
+            {
+                std::cerr << "[ReVPK] ERROR: Invalid ZSTD level '" << (s.c_str() + 5) << "' (expected "
+                          << ZSTD_minCLevel() << " to " << ZSTD_maxCLevel() << ").\n";
+                return false;
+            }
+            pBuilder->m_ZstdParams.m_nLevel = int(nLevel);
+        }
+        // Just keep the dummy LZHAM level to keep old code happy
+        return true;
     }
     // Otherwise, handle LZHAM:
-    if      (s == "fastest") return LZHAM_COMP_LEVEL_FASTEST;
-    else if (s == "faster")  return LZHAM_COMP_LEVEL_FASTER;
-    else if (s == "better")  return LZHAM_COMP_LEVEL_BETTER;
-    else if (s == "uber")    return LZHAM_COMP_LEVEL_UBER;
+    if      (s == "fastest") outLevel = LZHAM_COMP_LEVEL_FASTEST;
+    else if (s == "faster")  outLevel = LZHAM_COMP_LEVEL_FASTER;
+    else if (s == "better")  outLevel = LZHAM_COMP_LEVEL_BETTER;
+    else if (s == "uber")    outLevel = LZHAM_COMP_LEVEL_UBER;
 
-    return LZHAM_COMP_LEVEL_DEFAULT;
+    return true;
 }
 // --------------------
 
@@ -75,30 +100,37 @@ VPKEntryBlock_t::VPKEntryBlock_t(const uint8_t* pData, size_t nLen, uint64_t /*n
                                  uint16_t iPreloadSize, uint16_t iPackFileIndex,
                                  uint32_t nLoadFlags, uint16_t nTextureFlags,
                                  const char* pEntryPath)
+: VPKEntryBlock_t(uint64_t(nLen), pData, iPreloadSize, iPackFileIndex,
+                  nLoadFlags, nTextureFlags, pEntryPath)
+{
+    // compute CRC on entire file
+    m_nFileCRC = compute_crc32(pData, nLen);
+}
+
+VPKEntryBlock_t::VPKEntryBlock_t(uint64_t nLen, const uint8_t* pPreloadData,
+                                 uint16_t iPreloadSize, uint16_t iPackFileIndex,
+                                 uint32_t nLoadFlags, uint16_t nTextureFlags,
+                                 const char* pEntryPath)
 {
+    m_nFileCRC = 0;
     m_iPreloadSize = iPreloadSize;
     m_iPackFileIndex = iPackFileIndex;
     m_EntryPath = (pEntryPath ? pEntryPath : "");
     m_PreloadData.clear();
 
-    // compute CRC on entire file
-    m_nFileCRC = compute_crc32(pData, nLen);
-
     // handle preload data
     if (iPreloadSize > 0 && iPreloadSize <= nLen) {
         m_PreloadData.resize(iPreloadSize);
-        std::memcpy(m_PreloadData.data(), pData, iPreloadSize);
+        std::memcpy(m_PreloadData.data(), pPreloadData, iPreloadSize);
     }
 
     // break remaining data into 1 MiB chunks
-    size_t totalLeft = (nLen > iPreloadSize) ? nLen - iPreloadSize : 0;
-    const uint8_t* pFragmentData = (nLen > iPreloadSize) ? pData + iPreloadSize : nullptr;
-    size_t currentMemOffset = 0;  // Track memory offset instead of pack offset
-    const size_t chunkSz = VPK_ENTRY_MAX_LEN;
+    uint64_t totalLeft = (nLen > iPreloadSize) ? nLen - iPreloadSize : 0;
+    const uint64_t chunkSz = VPK_ENTRY_MAX_LEN;
 
     while (totalLeft > 0)
     {
-        size_t csize = (totalLeft >= chunkSz) ? chunkSz : totalLeft;
+        uint64_t csize = (totalLeft >= chunkSz) ? chunkSz : totalLeft;
 
         VPKChunkDescriptor_t desc(nLoadFlags, nTextureFlags,
                                   0,           // Pack offset will be set later
@@ -108,277 +140,1898 @@ VPKEntryBlock_t::VPKEntryBlock_t(const uint8_t* pData, size_t nLen, uint64_t /*n
         m_Fragments.push_back(desc);
 
         totalLeft -= csize;
-        currentMemOffset += csize;
     }
 }
 
+VPKEntryBlock_t PackedStore_BeginEntryBlock(CFragmentReader& reader, const VPKKeyValues_t& kv,
+                                            uint16_t iPackFileIndex)
+{
+    const uint64_t nLen = reader.GetSize();
+    const uint8_t* pPreloadData = nullptr;
+    if (kv.m_iPreloadSize > 0 && kv.m_iPreloadSize <= nLen)
+        pPreloadData = reader.Read(kv.m_iPreloadSize);
+    else if (kv.m_iPreloadSize > nLen)
+        reader.Read(size_t(nLen)); // all of it goes nowhere, but into the CRC
+
+    return VPKEntryBlock_t(nLen, pPreloadData, kv.m_iPreloadSize, iPackFileIndex,
+                           kv.m_nLoadFlags, kv.m_nTextureFlags, kv.m_EntryPath.c_str());
+}
+
 // ------------------------------------------------------------------------
 //  CPackedStoreBuilder: init LZHAM
 // ------------------------------------------------------------------------
-void CPackedStoreBuilder::InitLzEncoder(int maxHelperThreads, const char* compressionLevel)
+bool CPackedStoreBuilder::InitLzEncoder(int maxHelperThreads, const char* compressionLevel)
 {
     // --- ZSTD support ---
     // First, zero out the LZHAM encoder config
     std::memset(&m_Encoder, 0, sizeof(m_Encoder));
     m_Encoder.m_struct_size        = sizeof(m_Encoder);
     m_Encoder.m_dict_size_log2     = VPK_DICT_SIZE;
-    // Temporarily parse level
-    m_Encoder.m_level = parseCompressionLevel(compressionLevel, this);
-    // If we remain LZHAM, set up the rest
-    if (!IsUsingZSTD())
-    {
-        m_Encoder.m_max_helper_threads = (maxHelperThreads < 0) ? -1 : maxHelperThreads;
-        m_Encoder.m_compress_flags     = LZHAM_COMP_FLAG_DETERMINISTIC_PARSING;
-    }
+    // Set up the rest even for ZSTD, since a compression policy may pick LZHAM
+    m_Encoder.m_max_helper_threads = (maxHelperThreads < 0) ? -1 : maxHelperThreads;
+    m_Encoder.m_compress_flags     = LZHAM_COMP_FLAG_DETERMINISTIC_PARSING;
     // --------------------
+
+    // Temporarily parse level
+    return parseCompressionLevel(compressionLevel, this, m_Encoder.m_level);
 }
 
 void CPackedStoreBuilder::InitLzDecoder()
 {
     // Prepare the decompression parameters.
-    lzham_decompress_params dec_params;
-    std::memset(&dec_params, 0, sizeof(dec_params));
-    dec_params.m_struct_size       = sizeof(dec_params);
-    dec_params.m_dict_size_log2    = VPK_DICT_SIZE;  // defined elsewhere (e.g. 20 for 1 MB dictionary)
-    dec_params.m_decompress_flags  = LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED;
+    std::memset(&m_DecoderParams, 0, sizeof(m_DecoderParams));
+    m_DecoderParams.m_struct_size       = sizeof(m_DecoderParams);
+    m_DecoderParams.m_dict_size_log2    = VPK_DICT_SIZE;  // defined elsewhere (e.g. 20 for 1 MB dictionary)
+    // Fragments are always decompressed whole into a VPK_ENTRY_MAX_LEN buffer.
+    m_DecoderParams.m_decompress_flags  = LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED;
     // (Other fields such as m_cpucache_total_lines and m_cpucache_line_size can be left at 0)
+}
+
+// ------------------------------------------------------------------------
+//  ZSTD settings and per-thread contexts
+// ------------------------------------------------------------------------
+static bool CheckZstdParam(ZSTD_cParameter param, int nValue, const char* pName)
+{
+    const ZSTD_bounds bounds = ZSTD_cParam_getBounds(param);
+    if (ZSTD_isError(bounds.error) || nValue < bounds.lowerBound || nValue > bounds.upperBound)
+    {
+        std::cerr << "[ReVPK] ERROR: ZSTD " << pName << " " << nValue << " is out of range";
+        if (!ZSTD_isError(bounds.error))
+            std::cerr << " [" << bounds.lowerBound << ", " << bounds.upperBound << "]";
+        std::cerr << ".\n";
+        return false;
+    }
+    return true;
+}
+
+bool CPackedStoreBuilder::SetZstdParams(const VPKZstdParams_t& params)
+{
+    if (!CheckZstdParam(ZSTD_c_compressionLevel, params.m_nLevel, "level"))
+        return false;
+    if (params.m_nWindowLog && !CheckZstdParam(ZSTD_c_windowLog, params.m_nWindowLog, "window log"))
+        return false;
+    if (params.m_nStrategy && !CheckZstdParam(ZSTD_c_strategy, params.m_nStrategy, "strategy"))
+        return false;
+    if (params.m_nWorkers && !CheckZstdParam(ZSTD_c_nbWorkers, params.m_nWorkers, "worker count"))
+        return false; // upper bound is 0 when libzstd was built without threads
+
+    m_ZstdParams = params;
+    return true;
+}
+
+// Setting up a context costs a noticeable share of compressing a small
+// fragment, so each thread keeps one of each and reuses it.
+struct ZstdContexts_t
+{
+    ZSTD_CCtx*      m_pCCtx = nullptr;
+    ZSTD_DCtx*      m_pDCtx = nullptr;
+    ZSTD_CCtx*      m_pProbeCCtx = nullptr; // compressibility probe, level 1
+    VPKZstdParams_t m_CCtxParams; // what m_pCCtx is configured with
+
+    ~ZstdContexts_t()
+    {
+        ZSTD_freeCCtx(m_pCCtx);
+        ZSTD_freeDCtx(m_pDCtx);
+        ZSTD_freeCCtx(m_pProbeCCtx);
+    }
+};
+
+static thread_local ZstdContexts_t t_ZstdContexts;
+
+static ZSTD_CCtx* GetZstdCCtx(const VPKZstdParams_t& params)
+{
+    ZstdContexts_t& ctx = t_ZstdContexts;
+    if (ctx.m_pCCtx && ctx.m_CCtxParams == params)
+        return ctx.m_pCCtx;
+
+    if (!ctx.m_pCCtx)
+    {
+        ctx.m_pCCtx = ZSTD_createCCtx();
+        if (!ctx.m_pCCtx)
+            return nullptr;
+    }
+
+    // Parameters stick across frames, so they only need setting when they change.
+    ZSTD_CCtx_reset(ctx.m_pCCtx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(ctx.m_pCCtx, ZSTD_c_compressionLevel, params.m_nLevel);
+    // Dictionary IDs are stored after R1D_marker, not in the frame.
+    ZSTD_CCtx_setParameter(ctx.m_pCCtx, ZSTD_c_dictIDFlag, 0);
+    if (params.m_nWindowLog)
+        ZSTD_CCtx_setParameter(ctx.m_pCCtx, ZSTD_c_windowLog, params.m_nWindowLog);
+    if (params.m_nStrategy)
+        ZSTD_CCtx_setParameter(ctx.m_pCCtx, ZSTD_c_strategy, params.m_nStrategy);
+    if (params.m_nWorkers)
+        ZSTD_CCtx_setParameter(ctx.m_pCCtx, ZSTD_c_nbWorkers, params.m_nWorkers);
+
+    ctx.m_CCtxParams = params;
+    return ctx.m_pCCtx;
+}
+
+static ZSTD_CCtx* GetZstdProbeCCtx()
+{
+    ZstdContexts_t& ctx = t_ZstdContexts;
+    if (!ctx.m_pProbeCCtx)
+        ctx.m_pProbeCCtx = ZSTD_createCCtx();
+    return ctx.m_pProbeCCtx;
+}
+
+static ZSTD_DCtx* GetZstdDCtx()
+{
+    ZstdContexts_t& ctx = t_ZstdContexts;
+    if (!ctx.m_pDCtx)
+        ctx.m_pDCtx = ZSTD_createDCtx();
+    return ctx.m_pDCtx;
+}
 
-    // Call the official LZHAM decoder initialization function.
-    lzham_decompress_state_ptr decoder_state = lzham_decompress_init(&dec_params);
-    if (decoder_state == nullptr)
+// ------------------------------------------------------------------------
+//  Per-thread LZHAM compressor
+// ------------------------------------------------------------------------
+// lzham_compress_memory() builds a full compressor (dictionary tables and
+// helper threads) per fragment and tears it down again. Instead each thread
+// keeps one and resets it with lzham_compress_reinit(), which starts a new
+// stream exactly like a fresh compressor, so the output stays the same.
+struct LzhamCompressor_t
+{
+    lzham_compress_state_ptr m_pState = nullptr;
+    lzham_compress_params    m_Params; // what m_pState was created with
+    bool                     m_bUsed = false; // needs a reinit before the next fragment
+
+    ~LzhamCompressor_t()
+    {
+        if (m_pState)
+            lzham_compress_deinit(m_pState);
+    }
+};
+
+// One per level, so a compression policy mixing levels doesn't thrash them.
+static thread_local LzhamCompressor_t t_LzhamCompressors[LZHAM_TOTAL_COMP_LEVELS];
+
+static lzham_compress_state_ptr GetLzhamCompressor(const lzham_compress_params& params)
+{
+    LzhamCompressor_t& comp = t_LzhamCompressors[std::min<unsigned>(params.m_level, LZHAM_TOTAL_COMP_LEVELS - 1)];
+    if (comp.m_pState && std::memcmp(&comp.m_Params, &params, sizeof(params)) != 0)
+    {
+        lzham_compress_deinit(comp.m_pState);
+        comp.m_pState = nullptr;
+    }
+
+    if (comp.m_pState && comp.m_bUsed)
     {
-        std::cerr << "[ReVPK] ERROR: Failed to initialize LZHAM decoder." << std::endl;
-        // You might want to handle the error (throw, exit, etc.)
+        lzham_compress_state_ptr pReset = lzham_compress_reinit(comp.m_pState);
+        if (!pReset)
+            lzham_compress_deinit(comp.m_pState); // start over below
+        comp.m_pState = pReset;
+    }
+
+    if (!comp.m_pState)
+    {
+        comp.m_pState = lzham_compress_init(&params);
+        if (!comp.m_pState)
+        {
+            std::cerr << "[ReVPK] ERROR: Failed to initialize LZHAM compressor.\n";
+            return nullptr;
+        }
+        comp.m_Params = params;
     }
+
+    comp.m_bUsed = true;
+    return comp.m_pState;
 }
 
+// ------------------------------------------------------------------------
+//  Per-thread LZHAM decompressor
+// ------------------------------------------------------------------------
+// Same idea for extraction: lzham_decompress_memory() allocates the decoder
+// tables per fragment, so each thread keeps one state and resets it with
+// lzham_decompress_reinit().
+struct LzhamDecompressor_t
+{
+    lzham_decompress_state_ptr m_pState = nullptr;
+    bool                       m_bUsed = false;
+
+    ~LzhamDecompressor_t()
+    {
+        if (m_pState)
+            lzham_decompress_deinit(m_pState);
+    }
+};
+
+static thread_local LzhamDecompressor_t t_LzhamDecompressor;
+
+static lzham_decompress_state_ptr GetLzhamDecompressor(const lzham_decompress_params& params)
+{
+    LzhamDecompressor_t& decomp = t_LzhamDecompressor;
+    if (decomp.m_pState && decomp.m_bUsed)
+    {
+        // Reinit also applies params, in case they changed.
+        lzham_decompress_state_ptr pReset = lzham_decompress_reinit(decomp.m_pState, &params);
+        if (!pReset)
+            lzham_decompress_deinit(decomp.m_pState); // start over below
+        decomp.m_pState = pReset;
+    }
+
+    if (!decomp.m_pState)
+    {
+        decomp.m_pState = lzham_decompress_init(&params);
+        if (!decomp.m_pState)
+        {
+            std::cerr << "[ReVPK] ERROR: Failed to initialize LZHAM decoder.\n";
+            return nullptr;
+        }
+    }
+
+    decomp.m_bUsed = true;
+    return decomp.m_pState;
+}
 
 // ------------------------------------------------------------------------
 //  Deduplicate chunk
 // ------------------------------------------------------------------------
 bool CPackedStoreBuilder::Deduplicate(const uint8_t* pEntryBuffer, VPKChunkDescriptor_t& descriptor, size_t finalSize)
 {
-    const std::string chunkHash = compute_sha1_hex(pEntryBuffer, finalSize);
+    const uint64_t chunkHash = compute_chunk_hash(pEntryBuffer, finalSize);
+    return m_ChunkTable.FindOrInsert(chunkHash, descriptor, [](VPKChunkDescriptor_t&) {});
+}
+
+// ------------------------------------------------------------------------
+//  CChunkDedupTable
+// ------------------------------------------------------------------------
+bool CChunkDedupTable::Find(uint64_t nHash, VPKChunkDescriptor_t& outDesc) const
+{
+    const Shard_t& shard = GetShard(nHash);
+    std::unique_lock<std::mutex> lock = PackStats().Lock(shard.m_Mutex, CPackStats::kLockDedup);
+
+    auto it = shard.m_Map.find(nHash);
+    if (it == shard.m_Map.end())
+        return false;
+
+    outDesc = it->second;
+    return true;
+}
+
+void CChunkDedupTable::Clear()
+{
+    for (Shard_t& shard : m_Shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.m_Mutex);
+        shard.m_Map.clear();
+    }
+}
+
+// ------------------------------------------------------------------------
+//  Compress chunk
+// ------------------------------------------------------------------------
+// In auto mode LZHAM must beat ZSTD by this much (percent of the ZSTD size)
+// to be picked, since ZSTD decodes several times faster.
+static constexpr int AUTO_LZHAM_MIN_GAIN_PCT = 3;
+
+// Runs the ZSTD candidate of auto mode next to the worker's LZHAM pass.
+// Created on first use with one thread per compression worker.
+static ThreadPool& GetCandidatePool(unsigned int numWorkers)
+{
+    static ThreadPool pool(numWorkers);
+    return pool;
+}
+
+static bool CompressZstd(const VPKZstdParams_t& params, const ZSTD_CDict* pCDict, uint32_t nDictId,
+                         const uint8_t* pSrc, size_t nSrcLen, uint8_t* pDst, size_t& nDstLen)
+{
+    // We'll put the marker at the beginning of pDst,
+    // and compress into pDst + markerSize.
+    size_t markerSize = sizeof(R1D_marker);
+    std::memcpy(pDst, &R1D_marker, markerSize);
+
+    // With a dictionary, its ID follows the marker (where a plain frame
+    // has its magic number).
+    if (pCDict)
+    {
+        std::memcpy(pDst + markerSize, &nDictId, sizeof(nDictId));
+        markerSize += sizeof(nDictId);
+    }
+
+    // We must not exceed VPK_ENTRY_MAX_LEN - markerSize
+    size_t zstdBound = ZSTD_compressBound(nSrcLen);
+    if (zstdBound + markerSize > VPK_ENTRY_MAX_LEN)
+        zstdBound = VPK_ENTRY_MAX_LEN - markerSize;
+
+    ZSTD_CCtx* pCCtx = GetZstdCCtx(params);
+    if (!pCCtx)
+        return false;
+
+    ZSTD_CCtx_refCDict(pCCtx, pCDict); // nullptr drops the previous one
+    size_t zstdResult = ZSTD_compress2(pCCtx, pDst + markerSize, zstdBound,
+                                       pSrc, nSrcLen);
+    if (ZSTD_isError(zstdResult) || zstdResult + markerSize >= nSrcLen)
+        return false;
+
+    nDstLen = zstdResult + markerSize;
+    return true;
+}
+
+static bool CompressLzham(const lzham_compress_params& params,
+                          const uint8_t* pSrc, size_t nSrcLen, uint8_t* pDst, size_t& nDstLen)
+{
+    lzham_compress_state_ptr pState = GetLzhamCompressor(params);
+    if (!pState)
+        return false;
+
+    // LZHAM: the output may not grow past the input size. Feed the whole
+    // fragment as the final input and drain until the stream is finished.
+    const uint8_t* pIn = pSrc;
+    size_t inLeft  = nSrcLen;
+    uint8_t* pOut  = pDst;
+    size_t outLeft = nSrcLen;
+
+    lzham_compress_status_t st;
+    do
+    {
+        size_t inBytes  = inLeft;
+        size_t outBytes = outLeft;
+        st = lzham_compress(pState, pIn, &inBytes, pOut, &outBytes, true);
+
+        pIn  += inBytes;
+        inLeft -= inBytes;
+        pOut += outBytes;
+        outLeft -= outBytes;
+
+        if (st == LZHAM_COMP_STATUS_HAS_MORE_OUTPUT && outLeft == 0)
+            return false; // didn't shrink
+        if (inBytes == 0 && outBytes == 0 && st < LZHAM_COMP_STATUS_FIRST_SUCCESS_OR_FAILURE_CODE)
+            return false; // no progress
+    } while (st < LZHAM_COMP_STATUS_FIRST_SUCCESS_OR_FAILURE_CODE);
+
+    const size_t compSize = nSrcLen - outLeft;
+    if (st != LZHAM_COMP_STATUS_SUCCESS || compSize >= nSrcLen)
+        return false;
+
+    nDstLen = compSize;
+    return true;
+}
+
+bool CPackedStoreBuilder::CompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                                        uint8_t* pDst, size_t& nDstLen) const
+{
+    return CompressChunk(pSrc, nSrcLen, pDst, nDstLen, GetDefaultCodec());
+}
+
+bool CPackedStoreBuilder::CompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                                        uint8_t* pDst, size_t& nDstLen, const VPKCodec_t& codec) const
+{
+    if (codec.m_eMethod == kCompressionNone)
+        return false;
+
+    CPackStats::CScopedTimer timer(codec.m_bAuto ? CPackStats::kTimerCompressAuto
+                                   : codec.m_eMethod == kCompressionZSTD ? CPackStats::kTimerCompressZSTD
+                                   : CPackStats::kTimerCompressLZHAM, nSrcLen);
+
+    VPKZstdParams_t zstdParams = m_ZstdParams;
+    zstdParams.m_nLevel = codec.m_nZstdLevel;
+    const ZSTD_CDict* pCDict = codec.m_nDictId ? m_ZstdDicts.GetCDict(codec.m_nDictId, codec.m_nZstdLevel) : nullptr;
+
+    lzham_compress_params lzhamParams = m_Encoder;
+    lzhamParams.m_level = static_cast<lzham_compress_level>(codec.m_nLzhamLevel);
+
+    if (!codec.m_bAuto)
+    {
+        if (codec.m_eMethod == kCompressionZSTD)
+            return CompressZstd(zstdParams, pCDict, codec.m_nDictId, pSrc, nSrcLen, pDst, nDstLen);
+        return CompressLzham(lzhamParams, pSrc, nSrcLen, pDst, nDstLen);
+    }
+
+    // Auto: ZSTD on the candidate pool while LZHAM runs on this thread.
+    thread_local std::vector<uint8_t> zstdBuf(VPK_ENTRY_MAX_LEN);
+    uint8_t* pZstdDst = zstdBuf.data();
+    size_t zstdLen = 0;
+
+    // The pool is shared by every worker; wait for our own candidate only.
+    bool bZstd = false;
+    CTaskGroup zstdDone;
+    ThreadPool& candidatePool = GetCandidatePool(GetWorkerCount());
+    candidatePool.enqueue(zstdDone, [&]() {
+        bZstd = CompressZstd(zstdParams, pCDict, codec.m_nDictId,
+                             pSrc, nSrcLen, pZstdDst, zstdLen);
+    });
+
+    size_t lzhamLen = 0;
+    const bool bLzham = CompressLzham(lzhamParams, pSrc, nSrcLen, pDst, lzhamLen);
+    candidatePool.wait(zstdDone);
+
+    if (bZstd && (!bLzham || lzhamLen * 100 > zstdLen * (100 - AUTO_LZHAM_MIN_GAIN_PCT)))
+    {
+        std::memcpy(pDst, pZstdDst, zstdLen);
+        nDstLen = zstdLen;
+        return true;
+    }
+    if (bLzham)
+    {
+        nDstLen = lzhamLen;
+        return true;
+    }
+    return false;
+}
+
+// ------------------------------------------------------------------------
+//  Compressibility probe
+// ------------------------------------------------------------------------
+// Smaller fragments are just compressed; probing would cost about as much.
+static constexpr size_t PROBE_MIN_FRAGMENT_SIZE = 64 * 1024;
+// The probe looks at this many samples spread evenly over the fragment.
+static constexpr size_t PROBE_SAMPLE_SIZE  = 4 * 1024;
+static constexpr size_t PROBE_SAMPLE_COUNT = 4;
+// Samples below this byte entropy (bits per byte) are worth compressing.
+static constexpr double PROBE_MAX_ENTROPY = 7.5;
+// Otherwise ZSTD level 1 must shrink the samples by at least this much (percent).
+static constexpr size_t PROBE_MIN_SAVING_PCT = 2;
+
+bool CPackedStoreBuilder::IsWorthCompressing(const std::string& entryPath,
+                                             const uint8_t* pSrc, size_t nSrcLen) const
+{
+    if (!m_bProbeCompressibility || nSrcLen < PROBE_MIN_FRAGMENT_SIZE)
+        return true;
+
+    const size_t stride = (nSrcLen - PROBE_SAMPLE_SIZE) / (PROBE_SAMPLE_COUNT - 1);
+    const size_t sampledBytes = PROBE_SAMPLE_SIZE * PROBE_SAMPLE_COUNT;
+
+    // Byte histogram entropy: catches text, geometry, uncompressed textures...
+    uint32_t histogram[256] = {};
+    for (size_t s = 0; s < PROBE_SAMPLE_COUNT; s++)
+    {
+        const uint8_t* pSample = pSrc + s * stride;
+        for (size_t i = 0; i < PROBE_SAMPLE_SIZE; i++)
+            histogram[pSample[i]]++;
+    }
 
-    auto it = m_ChunkHashMap.find(chunkHash);
-    if (it != m_ChunkHashMap.end())
+    double entropy = 0.0;
+    for (uint32_t count : histogram)
     {
-        descriptor = it->second;
+        if (count)
+        {
+            const double p = double(count) / double(sampledBytes);
+            entropy -= p * std::log2(p);
+        }
+    }
+    if (entropy < PROBE_MAX_ENTROPY)
         return true;
+
+    // ...but evenly spread bytes can still repeat, so try the samples for real.
+    ZSTD_CCtx* pCCtx = GetZstdProbeCCtx();
+    if (!pCCtx)
+        return true;
+
+    thread_local std::vector<uint8_t> probeBuf(ZSTD_compressBound(PROBE_SAMPLE_SIZE));
+    size_t probedBytes = 0;
+    for (size_t s = 0; s < PROBE_SAMPLE_COUNT; s++)
+    {
+        const size_t result = ZSTD_compressCCtx(pCCtx, probeBuf.data(), probeBuf.size(),
+                                                pSrc + s * stride, PROBE_SAMPLE_SIZE, 1);
+        if (ZSTD_isError(result))
+            return true;
+        probedBytes += result;
     }
+    if (probedBytes * 100 < sampledBytes * (100 - PROBE_MIN_SAVING_PCT))
+        return true;
 
-    m_ChunkHashMap.insert({ chunkHash, descriptor });
+    std::lock_guard<std::mutex> lock(m_ProbeMutex);
+    VPKProbeSkips_t& skips = m_ProbeSkips[PackedStore_GetExtension(entryPath)];
+    skips.m_nFragments++;
+    skips.m_nBytes += nSrcLen;
     return false;
 }
 
+std::map<std::string, VPKProbeSkips_t> CPackedStoreBuilder::GetProbeSkips() const
+{
+    std::lock_guard<std::mutex> lock(m_ProbeMutex);
+    return m_ProbeSkips;
+}
+
 // ------------------------------------------------------------------------
-//  CPackedStoreBuilder::PackStore
+//  Compress chunk through the persistent chunk cache
 // ------------------------------------------------------------------------
-void CPackedStoreBuilder::PackStore(const VPKPair_t& vpkPair, const char* workspaceName, const char* buildPath)
+uint64_t CPackedStoreBuilder::GetCodecKey() const
+{
+    return GetCodecKey(GetDefaultCodec());
+}
+
+uint64_t CPackedStoreBuilder::GetCodecKey(const VPKCodec_t& codec) const
+{
+    // Anything that changes the compressed bytes must be part of this string.
+    // Output doesn't depend on the ZSTD worker count, only on whether workers are used.
+    char zstdDesc[128];
+    snprintf(zstdDesc, sizeof(zstdDesc), "zstd:level=%d:wlog=%d:strategy=%d:mt=%d:max=%zu",
+             codec.m_nZstdLevel, m_ZstdParams.m_nWindowLog, m_ZstdParams.m_nStrategy,
+             m_ZstdParams.m_nWorkers > 0 ? 1 : 0, VPK_ENTRY_MAX_LEN);
+    if (codec.m_nDictId)
+    {
+        const size_t len = std::strlen(zstdDesc);
+        snprintf(zstdDesc + len, sizeof(zstdDesc) - len, ":dict=%08x", codec.m_nDictId);
+    }
+
+    char lzhamDesc[96];
+    snprintf(lzhamDesc, sizeof(lzhamDesc), "lzham:level=%d:dict=%u:flags=%u",
+             codec.m_nLzhamLevel, m_Encoder.m_dict_size_log2, m_Encoder.m_compress_flags);
+
+    char codecDesc[256];
+    if (codec.m_bAuto)
+        snprintf(codecDesc, sizeof(codecDesc), "auto:%s:%s:gain=%d", zstdDesc, lzhamDesc, AUTO_LZHAM_MIN_GAIN_PCT);
+    else
+        snprintf(codecDesc, sizeof(codecDesc), "%s", codec.m_eMethod == kCompressionZSTD ? zstdDesc : lzhamDesc);
+
+    return XXH64(codecDesc, std::strlen(codecDesc), 0);
+}
+
+bool CPackedStoreBuilder::CompressChunkCached(const std::string& entryPath, uint64_t nRawHash,
+                                              const uint8_t* pSrc, size_t nSrcLen,
+                                              uint8_t* pDst, size_t& nDstLen) const
+{
+    return CompressChunkCached(entryPath, nRawHash, pSrc, nSrcLen, pDst, nDstLen, GetDefaultCodec());
+}
+
+bool CPackedStoreBuilder::CompressChunkCached(const std::string& entryPath, uint64_t nRawHash,
+                                              const uint8_t* pSrc, size_t nSrcLen,
+                                              uint8_t* pDst, size_t& nDstLen, const VPKCodec_t& codec) const
+{
+    if (codec.m_eMethod == kCompressionNone)
+        return false;
+    if (!m_pChunkCache)
+        return IsWorthCompressing(entryPath, pSrc, nSrcLen) && CompressChunk(pSrc, nSrcLen, pDst, nDstLen, codec);
+
+    const uint64_t codecKey = GetCodecKey(codec);
+    bool bCompressed = false;
+    if (m_pChunkCache->Lookup(nRawHash, uint32_t(nSrcLen), codecKey,
+                              pDst, VPK_ENTRY_MAX_LEN, nDstLen, bCompressed))
+    {
+        return bCompressed;
+    }
+
+    // The probe's verdict isn't cached: it depends on --no-probe, not on the codec.
+    if (!IsWorthCompressing(entryPath, pSrc, nSrcLen))
+        return false;
+
+    // Miss: compress, and remember incompressible fragments as well.
+    bCompressed = CompressChunk(pSrc, nSrcLen, pDst, nDstLen, codec);
+    m_pChunkCache->Store(nRawHash, uint32_t(nSrcLen), codecKey,
+                         bCompressed ? pDst : nullptr, bCompressed ? nDstLen : 0);
+    return bCompressed;
+}
+
+// ------------------------------------------------------------------------
+//  Per-entry codec
+// ------------------------------------------------------------------------
+VPKCodec_t CPackedStoreBuilder::GetDefaultCodec() const
+{
+    VPKCodec_t codec;
+    codec.m_eMethod     = m_eCompressionMethod;
+    codec.m_nZstdLevel  = m_ZstdParams.m_nLevel;
+    codec.m_nLzhamLevel = int(m_Encoder.m_level);
+    return codec;
+}
+
+VPKCodec_t CPackedStoreBuilder::GetCodecForEntry(const std::string& entryPath, uint64_t nSize) const
+{
+    VPKCodec_t codec = GetDefaultCodec();
+    if (m_pPolicy)
+        m_pPolicy->Apply(entryPath, nSize, codec);
+
+    if (codec.m_eMethod == kCompressionZSTD)
+        codec.m_nDictId = m_ZstdDicts.GetDictIdForPath(entryPath);
+    return codec;
+}
+
+// ------------------------------------------------------------------------
+//  ZSTD dictionaries
+// ------------------------------------------------------------------------
+bool CPackedStoreBuilder::SaveZstdDicts(const std::string& dirPath) const
+{
+    if (m_ZstdDicts.Empty())
+        return true;
+
+    VPKDir_t namingDir;
+    namingDir.m_DirFilePath = dirPath;
+    return m_ZstdDicts.Save((std::filesystem::path(dirPath).parent_path() / namingDir.GetDictFileName()).string());
+}
+
+void CPackedStoreBuilder::LoadZstdDicts(const VPKDir_t& vpkDir)
+{
+    const std::filesystem::path dictPath =
+        std::filesystem::path(vpkDir.m_DirFilePath).parent_path() / vpkDir.GetDictFileName();
+
+    std::error_code ec;
+    if (std::filesystem::exists(dictPath, ec))
+        m_ZstdDicts.Load(dictPath.string(), false);
+}
+
+// ------------------------------------------------------------------------
+//  Worker count
+// ------------------------------------------------------------------------
+unsigned int CPackedStoreBuilder::GetWorkerCount() const
+{
+    return (m_nWorkerThreads > 0)
+        ? static_cast<unsigned int>(m_nWorkerThreads)
+        : std::max(2u, std::thread::hardware_concurrency()) - 1;
+}
+
+// ------------------------------------------------------------------------
+//  CPackedStoreBuilder::WritePackFile
+// ------------------------------------------------------------------------
+bool CPackedStoreBuilder::WritePackFile(const std::vector<VPKKeyValues_t>& buildList,
+                                        uint16_t firstPackFileIndex, const std::string& dirPath,
+                                        std::vector<VPKEntryBlock_t>& entryBlocks,
+                                        const std::vector<std::vector<uint64_t>>& keptChunkHashes)
 {
     namespace fs = std::filesystem;
 
-    // 1) Read the KeyValues manifest
-    std::string baseName = PackedStore_GetDirBaseName(vpkPair.m_DirName);
-    fs::path manifestFile = fs::path(workspaceName) / "manifest" / (baseName + ".vdf");
+    // Archives are named after the directory file, like Valve's pak000_XXX.
+    VPKDir_t namingDir;
+    namingDir.m_DirFilePath = dirPath;
+    const fs::path buildDir = fs::path(dirPath).parent_path();
+
+    CPackArchiveSet archives([&namingDir, &buildDir](uint16_t iIndex)
+        {
+            return (buildDir / namingDir.GetPackFileNameForIndex(iIndex)).string();
+        },
+        firstPackFileIndex, m_nMaxArchiveSize);
+
+    // A patch whose changes all dedup into the existing archives doesn't need
+    // a new one; BeginEntry() creates it on first use.
+    if (keptChunkHashes.empty() && !archives.Open())
+        return false;
+
+    entryBlocks.reserve(entryBlocks.size() + buildList.size());
+
+    uint64_t totalBytes = 0;
+    for (const VPKKeyValues_t& kv : buildList)
+    {
+        std::error_code ec;
+        const uintmax_t size = fs::file_size(kv.m_EntryPath, ec);
+        if (!ec)
+            totalBytes += size;
+    }
+    Progress().AddTotal(buildList.size(), totalBytes);
+
+    size_t sharedBytes = 0;
+    size_t sharedChunks = 0;
+
+    // Read + compress each file on the worker pool. Writes stay on this
+    // thread, in manifest order, so pack offsets (and therefore the output
+    // bytes) are identical to a serial build.
+    //
+    // Fragments are deduplicated on their raw bytes *before* compression:
+    // a worker only compresses a fragment if it is neither in the dedup
+    // table yet nor already being compressed by another worker. In the
+    // latter case it shares that worker's result.
+    //
+    // Files are streamed a fragment at a time, and each fragment is read
+    // once: hashed, compressed and handed to the writer as soon as it's done.
+    // Only when there is more than one archive to pick from (split or patch)
+    // does a first pass hash the whole file, so the writer can place the
+    // entry in an archive that already holds all of its chunks.
+    const bool bPrehash = m_nMaxArchiveSize > 0 || !keptChunkHashes.empty();
+
+    using ChunkData_t = std::shared_future<std::vector<uint8_t>>;
+
+    struct FragmentData_t
+    {
+        uint64_t    m_nHash = 0; // raw hash of the fragment
+        ChunkData_t m_Data;      // final bytes; invalid if already stored
+    };
+
+    struct PackJob_t
+    {
+        bool                     m_bReady = false;
+        bool                     m_bValid = false;
+        VPKEntryBlock_t          m_Block;
+        std::vector<uint64_t>    m_FragmentHashes; // raw hash of each fragment, with bPrehash only
+        std::vector<std::shared_future<FragmentData_t>> m_FragmentData; // once the worker gets to it
+        std::shared_future<uint32_t> m_FileCRC;    // once the whole file has been read
+    };
+
+    std::vector<PackJob_t> jobs(buildList.size());
+    std::mutex jobMutex;
+    std::condition_variable jobReadyCV;
+
+    // Fragments handed to the writer but not written yet. Workers ahead of
+    // the writer wait while there are too many; the one it is waiting on never does.
+    // That job can't be stuck behind a blocked one, since the pool starts jobs
+    // in the order they were queued (see threadpool.h).
+    size_t numPendingFragments = 0;
+    size_t writingJob = 0;
+    std::condition_variable pendingCV;
+
+    // Chunks claimed by a worker but not yet written, keyed by raw hash.
+    std::unordered_map<uint64_t, ChunkData_t> inFlightChunks;
+    std::mutex inFlightMutex;
+
+    // Archive holding the first copy of each chunk in m_ChunkTable (writer only).
+    std::unordered_map<uint64_t, uint16_t> chunkArchives;
+
+    // Chunks of the entries kept from an earlier build: an entry made only of
+    // them points at their archive, other ones copy them from there instead
+    // of compressing them again.
+    for (size_t i = 0; i < keptChunkHashes.size(); i++)
+    {
+        const VPKEntryBlock_t& block = entryBlocks[i];
+        if (!archives.AddExisting(block.m_iPackFileIndex))
+            continue;
+
+        CChunkDedupTable& archiveTable = archives.GetChunkTable(block.m_iPackFileIndex);
+        for (size_t f = 0; f < block.m_Fragments.size(); f++)
+        {
+            const uint64_t chunkHash = keptChunkHashes[i][f];
+            VPKChunkDescriptor_t desc = block.m_Fragments[f];
+            archiveTable.FindOrInsert(chunkHash, desc, [](VPKChunkDescriptor_t&) {});
+
+            desc = block.m_Fragments[f];
+            if (!m_ChunkTable.FindOrInsert(chunkHash, desc, [](VPKChunkDescriptor_t&) {}))
+                chunkArchives.emplace(chunkHash, block.m_iPackFileIndex);
+        }
+    }
+
+    const unsigned int numWorkers = GetWorkerCount();
+    // Limit how far the readers may run ahead of the writer.
+    const size_t maxJobsInFlight = size_t(numWorkers) * 4;
+    const size_t maxPendingFragments = size_t(numWorkers) * 4;
+
+    auto compressFile = [&](size_t jobIndex)
+    {
+        thread_local std::vector<uint8_t> compBuf(VPK_ENTRY_MAX_LEN);
+
+        const VPKKeyValues_t& kv = buildList[jobIndex];
+        PackJob_t result;
+        std::vector<std::promise<FragmentData_t>> fragmentData;
+        std::promise<uint32_t> fileCRC;
+
+        // Open input file and hash its fragments if needed
+        CFragmentReader reader;
+        if (!reader.Open(kv.m_EntryPath))
+        {
+            std::cerr << "[ReVPK] WARNING: Could not open " << kv.m_EntryPath << "\n";
+        }
+        else if (reader.GetSize() == 0)
+        {
+            std::cerr << "[ReVPK] WARNING: " << kv.m_EntryPath << " is empty.\n";
+        }
+        else
+        {
+            // Create entry block
+            result.m_Block = PackedStore_BeginEntryBlock(reader, kv, firstPackFileIndex);
+            if (bPrehash)
+            {
+                for (const auto& frag : result.m_Block.m_Fragments)
+                {
+                    CByteBudget::CScopedBytes hold(InFlightBudget(), frag.m_nUncompressedSize);
+                    const uint8_t* pChunk = reader.Read(frag.m_nUncompressedSize);
+                    result.m_FragmentHashes.push_back(compute_chunk_hash(pChunk, frag.m_nUncompressedSize));
+                }
+                fileCRC.set_value(reader.GetCRC());
+            }
+            result.m_bValid = true;
+            result.m_FileCRC = fileCRC.get_future().share();
+
+            fragmentData.resize(result.m_Block.m_Fragments.size());
+            for (auto& data : fragmentData)
+                result.m_FragmentData.push_back(data.get_future().share());
+        }
+
+        // The writer can place the entry now; the fragments follow.
+        const std::vector<VPKChunkDescriptor_t> fragments = result.m_Block.m_Fragments;
+        const std::vector<uint64_t> fragmentHashes = result.m_FragmentHashes;
+        const uint64_t fragmentOffset = result.m_Block.m_PreloadData.size();
+        const bool bValid = result.m_bValid;
+        {
+            std::unique_lock<std::mutex> lock = PackStats().Lock(jobMutex, CPackStats::kLockJobs);
+            result.m_bReady = true;
+            jobs[jobIndex] = std::move(result);
+            jobReadyCV.notify_all();
+        }
+
+        const VPKCodec_t codec = GetCodecForEntry(kv.m_EntryPath, reader.GetSize());
+        uint64_t offset = fragmentOffset;
+        for (size_t f = 0; f < fragments.size(); f++)
+        {
+            const size_t chunkSize = size_t(fragments[f].m_nUncompressedSize);
+            const uint64_t chunkOffset = offset;
+            offset += chunkSize;
+
+            {
+                std::unique_lock<std::mutex> lock = PackStats().Lock(jobMutex, CPackStats::kLockJobs);
+                pendingCV.wait(lock, [&]() {
+                    return numPendingFragments < maxPendingFragments || writingJob == jobIndex; });
+                numPendingFragments++;
+            }
+
+            // Read and hash the fragment, unless the pre-pass already did;
+            // then only chunks that need compressing are read again.
+            CByteBudget::CScopedBytes hold(InFlightBudget(), chunkSize);
+            const uint8_t* pChunk = bPrehash ? nullptr : reader.Read(chunkSize);
+            const uint64_t chunkHash = bPrehash ? fragmentHashes[f] : compute_chunk_hash(pChunk, chunkSize);
+
+            // Claim the chunk unless it is stored or already being compressed.
+            std::promise<std::vector<uint8_t>> claim;
+            {
+                std::unique_lock<std::mutex> lock = PackStats().Lock(inFlightMutex, CPackStats::kLockJobs);
+                VPKChunkDescriptor_t existing;
+                if (m_ChunkTable.Find(chunkHash, existing))
+                {
+                    fragmentData[f].set_value(FragmentData_t{ chunkHash, ChunkData_t() });
+                    continue;
+                }
+
+                auto it = inFlightChunks.find(chunkHash);
+                if (it != inFlightChunks.end())
+                {
+                    fragmentData[f].set_value(FragmentData_t{ chunkHash, it->second });
+                    continue;
+                }
+
+                ChunkData_t data = claim.get_future().share();
+                inFlightChunks.emplace(chunkHash, data);
+                fragmentData[f].set_value(FragmentData_t{ chunkHash, data });
+            }
+
+            if (!pChunk)
+            {
+                reader.Seek(chunkOffset);
+                pChunk = reader.Read(chunkSize);
+            }
+
+            // Compress the chunk; fall back to storing it as-is
+            size_t compSize = 0;
+            if (kv.m_bUseCompression &&
+                CompressChunkCached(kv.m_EntryPath, chunkHash, pChunk, chunkSize, compBuf.data(), compSize, codec))
+            {
+                claim.set_value(std::vector<uint8_t>(compBuf.data(), compBuf.data() + compSize));
+                PackStats().AddFragment(true);
+            }
+            else
+            {
+                claim.set_value(std::vector<uint8_t>(pChunk, pChunk + chunkSize));
+                PackStats().AddFragment(false);
+            }
+        }
+        if (bValid && !bPrehash)
+            fileCRC.set_value(reader.GetCRC());
+        Progress().Advance(1, reader.GetSize());
+    };
+
+    ThreadPool pool(numWorkers);
+    size_t nextJob = 0;
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        // Keep the pool fed while we wait on the next job in order.
+        for (; nextJob < jobs.size() && nextJob < i + maxJobsInFlight; nextJob++)
+            pool.enqueue([&compressFile, nextJob]() { compressFile(nextJob); });
+
+        PackJob_t job;
+        {
+            std::unique_lock<std::mutex> lock = PackStats().Lock(jobMutex, CPackStats::kLockJobs);
+            writingJob = i;
+            pendingCV.notify_all();
+            jobReadyCV.wait(lock, [&]() { return jobs[i].m_bReady; });
+            job = std::move(jobs[i]);
+        }
+        if (!job.m_bValid)
+            continue;
+
+        entryBlocks.push_back(std::move(job.m_Block));
+        VPKEntryBlock_t& block = entryBlocks.back();
+
+        // All fragments of an entry go to the same archive. Fully duplicated
+        // entries go to an archive that already holds all of their chunks.
+        if (!bPrehash || !archives.FindArchiveHolding(job.m_FragmentHashes, block.m_iPackFileIndex))
+        {
+            uint64_t entrySize = 0;
+            for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
+                entrySize += frag.m_nUncompressedSize;
+
+            block.m_iPackFileIndex = archives.BeginEntry(entrySize);
+        }
+        CChunkDedupTable& archiveTable = archives.GetChunkTable(block.m_iPackFileIndex);
+
+        // Process each chunk
+        for (size_t f = 0; f < block.m_Fragments.size(); f++)
+        {
+            VPKChunkDescriptor_t& frag = block.m_Fragments[f];
+            const FragmentData_t fragment = job.m_FragmentData[f].get();
+            const uint64_t chunkHash = fragment.m_nHash;
+            const ChunkData_t& fragmentData = fragment.m_Data;
+            {
+                std::unique_lock<std::mutex> lock = PackStats().Lock(jobMutex, CPackStats::kLockJobs);
+                numPendingFragments--;
+                pendingCV.notify_all();
+            }
+
+            // --- Deduplication Logic ---
+            const bool bShared = archiveTable.Find(chunkHash, frag);
+            PackStats().AddDedup(bShared);
+            if (bShared)
+            {
+                // Existing chunk:
+                sharedBytes += frag.m_nUncompressedSize;
+                sharedChunks++;
+                continue;
+            }
+
+            // New to this archive: the claiming worker may still be compressing
+            // it, or it was stored in an earlier archive and is copied from there.
+            std::vector<uint8_t> finalData;
+            VPKChunkDescriptor_t stored;
+            if (fragmentData.valid())
+            {
+                finalData = fragmentData.get();
+            }
+            else if (m_ChunkTable.Find(chunkHash, stored))
+            {
+                finalData.resize(stored.m_nCompressedSize);
+                if (!archives.Read(chunkArchives[chunkHash], stored.m_nPackFileOffset,
+                                   finalData.data(), finalData.size()))
+                {
+                    std::cerr << "[ReVPK] ERROR: Failed to read back chunk for " << block.m_EntryPath << "\n";
+                }
+            }
+
+            frag.m_nCompressedSize = finalData.size();
+            frag.m_nPackFileOffset = archives.Allocate(block.m_iPackFileIndex, finalData.size());
+            archives.Write(block.m_iPackFileIndex, frag.m_nPackFileOffset, std::move(finalData));
+            archiveTable.FindOrInsert(chunkHash, frag, [](VPKChunkDescriptor_t&) {});
+
+            // Publish to the table before dropping the in-flight copy, so
+            // workers always find the chunk in one or the other.
+            VPKChunkDescriptor_t published = frag;
+            if (!m_ChunkTable.FindOrInsert(chunkHash, published, [](VPKChunkDescriptor_t&) {}))
+                chunkArchives.emplace(chunkHash, block.m_iPackFileIndex);
+
+            std::unique_lock<std::mutex> lock = PackStats().Lock(inFlightMutex, CPackStats::kLockJobs);
+            inFlightChunks.erase(chunkHash);
+        }
+        block.m_nFileCRC = job.m_FileCRC.get();
+    }
+    pool.wait();
+    if (!archives.Close())
+        return false;
+
+    // Log statistics
+    std::cout << "[ReVPK] Packed " << buildList.size()
+        << " files into " << archives.GetArchiveCount() << " pack file(s)"
+        << " (" << archives.GetTotalSize() << " bytes total, "
+        << sharedBytes << " bytes deduplicated in "
+        << sharedChunks << " shared chunks)\n";
+
+    m_ChunkTable.Clear();
+    return true;
+}
+
+// ------------------------------------------------------------------------
+//  CPackedStoreBuilder::PackStore
+// ------------------------------------------------------------------------
+void CPackedStoreBuilder::PackStore(const VPKPair_t& vpkPair, const char* workspaceName, const char* buildPath)
+{
+    namespace fs = std::filesystem;
+
+    // 1) Read the KeyValues manifest
+    std::string baseName = PackedStore_GetDirBaseName(vpkPair.m_DirName);
+    fs::path manifestFile = fs::path(workspaceName) / "manifest" / (baseName + ".vdf");
+
+    std::vector<VPKKeyValues_t> buildList;
+    if (!LoadKeyValuesManifest(manifestFile.string(), buildList))
+    {
+        std::cerr << "[ReVPK] ERROR: Could not load manifest: " << manifestFile << "\n";
+        return;
+    }
+
+    // 2) Create the pack file
+    fs::path packPath = fs::path(buildPath) / vpkPair.m_PackName;
+    fs::path dirPath = fs::path(buildPath) / vpkPair.m_DirName;
+
+    try
+    {
+        fs::create_directories(packPath.parent_path());
+    }
+    catch (...)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot create directory: " << packPath.parent_path() << "\n";
+        return;
+    }
+
+    std::vector<VPKEntryBlock_t> entryBlocks;
+    if (!WritePackFile(buildList, 0, dirPath.string(), entryBlocks) ||
+        !SaveZstdDicts(dirPath.string()))
+        return;
+
+    // Build directory file
+    VPKDir_t dir;
+    dir.BuildDirectoryFile(dirPath.string(), entryBlocks);
+}
+
+// ------------------------------------------------------------------------
+//  CPackedStoreBuilder::PatchStore
+// ------------------------------------------------------------------------
+
+/**
+ * Check a file on disk against an entry of the existing directory: same size
+ * and CRC32. It is read along the entry's layout (preload bytes, then one
+ * fragment at a time), and the raw hash of each fragment goes to chunkHashes.
+ */
+static bool MatchesEntry(const std::string& filePath, const VPKEntryBlock_t& block,
+                         std::vector<uint64_t>& chunkHashes)
+{
+    CFragmentReader reader;
+    if (!reader.Open(filePath))
+        return false;
+
+    uint64_t nEntrySize = block.m_iPreloadSize;
+    for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
+    {
+        if (frag.m_nUncompressedSize > VPK_ENTRY_MAX_LEN)
+            return false;
+        nEntrySize += frag.m_nUncompressedSize;
+    }
+
+    // A file that grew or shrank can't match; don't read it.
+    if (reader.GetSize() != nEntrySize)
+        return false;
+
+    if (block.m_iPreloadSize > 0)
+        reader.Read(block.m_iPreloadSize);
+
+    chunkHashes.clear();
+    for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
+    {
+        const size_t nLen = size_t(frag.m_nUncompressedSize);
+        chunkHashes.push_back(compute_chunk_hash(reader.Read(nLen), nLen));
+    }
+    return reader.GetCRC() == block.m_nFileCRC;
+}
+
+void CPackedStoreBuilder::PatchStore(const VPKPair_t& vpkPair, const char* workspaceName, const char* buildPath)
+{
+    namespace fs = std::filesystem;
+
+    fs::path dirPath = fs::path(buildPath) / vpkPair.m_DirName;
+    if (!fs::exists(dirPath))
+    {
+        std::cout << "[ReVPK] No existing directory " << dirPath.filename().string()
+                  << ", doing a full pack.\n";
+        PackStore(vpkPair, workspaceName, buildPath);
+        return;
+    }
+
+    VPKDir_t oldDir(dirPath.string());
+    if (oldDir.Failed())
+    {
+        std::cerr << "[ReVPK] WARNING: Could not parse " << dirPath << ", doing a full pack.\n";
+        PackStore(vpkPair, workspaceName, buildPath);
+        return;
+    }
+
+    // 1) Read the KeyValues manifest
+    std::string baseName = PackedStore_GetDirBaseName(vpkPair.m_DirName);
+    fs::path manifestFile = fs::path(workspaceName) / "manifest" / (baseName + ".vdf");
+
+    std::vector<VPKKeyValues_t> buildList;
+    if (!LoadKeyValuesManifest(manifestFile.string(), buildList))
+    {
+        std::cerr << "[ReVPK] ERROR: Could not load manifest: " << manifestFile << "\n";
+        return;
+    }
+
+    // 2) Compare every manifest entry against the existing directory. An entry
+    //    is reused if its size and CRC match and its pack file is still there.
+    std::set<uint16_t> availablePacks;
+    uint16_t newPackFileIndex = 0;
+    for (uint16_t packFileIndex : oldDir.m_PakFileIndices)
+    {
+        if (fs::exists(fs::path(buildPath) / oldDir.GetPackFileNameForIndex(packFileIndex)))
+            availablePacks.insert(packFileIndex);
+        if (packFileIndex != 0x1337)
+            newPackFileIndex = std::max<uint16_t>(newPackFileIndex, packFileIndex + 1);
+    }
+
+    std::vector<const VPKEntryBlock_t*> reusedBlocks(buildList.size(), nullptr);
+    std::vector<std::vector<uint64_t>> reusedHashes(buildList.size());
+    {
+        ThreadPool pool(GetWorkerCount());
+
+        for (size_t i = 0; i < buildList.size(); i++)
+        {
+            pool.enqueue([&, i]()
+            {
+                const VPKKeyValues_t& kv = buildList[i];
+                const VPKEntryBlock_t* pOld = oldDir.FindEntry(kv.m_EntryPath);
+                if (!pOld || pOld->m_iPreloadSize != kv.m_iPreloadSize ||
+                    availablePacks.find(pOld->m_iPackFileIndex) == availablePacks.end())
+                    return;
+
+                if (!MatchesEntry(kv.m_EntryPath, *pOld, reusedHashes[i]))
+                    return;
+
+                reusedBlocks[i] = pOld;
+            });
+        }
+        pool.wait();
+    }
+
+    std::vector<VPKKeyValues_t> changedList;
+    std::vector<VPKEntryBlock_t> entryBlocks;
+    std::vector<std::vector<uint64_t>> keptChunkHashes; // parallel to entryBlocks
+    // Old entries still in the manifest; a path listed twice counts once.
+    std::unordered_set<const VPKEntryBlock_t*> keptOldEntries;
+    for (size_t i = 0; i < buildList.size(); i++)
+    {
+        const VPKKeyValues_t& kv = buildList[i];
+        if (const VPKEntryBlock_t* pOld = oldDir.FindEntry(kv.m_EntryPath))
+            keptOldEntries.insert(pOld);
+
+        if (!reusedBlocks[i])
+        {
+            changedList.push_back(kv);
+            continue;
+        }
+
+        // Reused as-is, except for flags the manifest may have changed.
+        keptChunkHashes.push_back(std::move(reusedHashes[i]));
+        entryBlocks.push_back(*reusedBlocks[i]);
+        for (VPKChunkDescriptor_t& frag : entryBlocks.back().m_Fragments)
+        {
+            frag.m_nLoadFlags    = kv.m_nLoadFlags;
+            frag.m_nTextureFlags = kv.m_nTextureFlags;
+        }
+    }
+
+    std::cout << "[ReVPK] PATCH: " << entryBlocks.size() << " unchanged, "
+              << changedList.size() << " new or changed, "
+              << (oldDir.m_EntryBlocks.size() - keptOldEntries.size()) << " removed entries.\n";
+
+    // 3) Append the new or changed entries to a new pack file, sharing the
+    //    chunks of the reused entries. Dictionaries of the existing packs are
+    //    kept for the entries reused from them.
+    if (!changedList.empty())
+    {
+        LoadZstdDicts(oldDir);
+        if (!WritePackFile(changedList, newPackFileIndex, dirPath.string(), entryBlocks, keptChunkHashes) ||
+            !SaveZstdDicts(dirPath.string()))
+            return;
+    }
+
+    // 4) Rewrite only the directory file
+    VPKDir_t dir;
+    dir.BuildDirectoryFile(dirPath.string(), entryBlocks);
+}
+
+// ------------------------------------------------------------------------
+//  CPackFileView
+// ------------------------------------------------------------------------
+bool CPackFileView::Open(const std::string& filePath)
+{
+    Close();
+
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_nSize = static_cast<uint64_t>(st.st_size);
+    if (m_nSize > 0)
+    {
+        void* pMapping = mmap(nullptr, m_nSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (pMapping == MAP_FAILED)
+        {
+            close(fd);
+            m_nSize = 0;
+            return false;
+        }
+        m_pData = static_cast<const uint8_t*>(pMapping);
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    m_bOpen = true;
+    return true;
+}
+
+void CPackFileView::Close()
+{
+    if (m_pData)
+        munmap(const_cast<uint8_t*>(m_pData), m_nSize);
+
+    m_pData = nullptr;
+    m_nSize = 0;
+    m_bOpen = false;
+}
+
+// ------------------------------------------------------------------------
+//  CFragmentReader
+// ------------------------------------------------------------------------
+bool CFragmentReader::Open(const std::string& filePath)
+{
+    Close();
+
+    m_nFd = open(filePath.c_str(), O_RDONLY);
+    if (m_nFd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(m_nFd, &st) != 0)
+    {
+        Close();
+        return false;
+    }
+
+    m_FilePath = filePath;
+    m_nSize = static_cast<uint64_t>(st.st_size);
+    posix_fadvise(m_nFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    m_pReadAhead = CReadAhead::Acquire();
+    return true;
+}
+
+void CFragmentReader::Close()
+{
+    if (m_pReadAhead)
+        m_pReadAhead->Release();
+    if (m_nFd >= 0)
+        close(m_nFd);
+    PackStats().ReleaseBuffer(m_Buffer.size());
+
+    m_nFd = -1;
+    m_nSize = m_nPos = 0;
+    m_nCRCEnd = 0;
+    m_nCRC = 0;
+    m_nBufferOffset = 0;
+    m_nBufferLen = 0;
+    m_pBuffer = nullptr;
+    m_Buffer = std::vector<uint8_t>();
+    m_pReadAhead = nullptr;
+}
+
+const uint8_t* CFragmentReader::Read(size_t nLen)
+{
+    assert(nLen <= VPK_ENTRY_MAX_LEN);
+    const uint64_t nOffset = m_nPos;
+    m_nPos += nLen;
+
+    if (!m_pBuffer || nOffset < m_nBufferOffset || nOffset + nLen > m_nBufferOffset + m_nBufferLen)
+    {
+        uint8_t* pBuffer = nullptr;
+        size_t nRead = 0;
+        {
+            CPackStats::CScopedTimer timer(CPackStats::kTimerRead, nLen);
+            if (m_pReadAhead && nLen > 0)
+            {
+                // Fragments follow each other, so the next read most likely
+                // starts where this one ends.
+                const uint64_t nNext = nOffset + nLen;
+                const size_t nNextLen = (nNext < m_nSize)
+                    ? size_t(std::min<uint64_t>(VPK_ENTRY_MAX_LEN, m_nSize - nNext)) : 0;
+                pBuffer = m_pReadAhead->Read(m_nFd, nOffset, nLen, nNextLen, nRead);
+            }
+            else
+            {
+                if (m_Buffer.size() < nLen)
+                {
+                    PackStats().AcquireBuffer(nLen - m_Buffer.size());
+                    m_Buffer.resize(nLen);
+                }
+                pBuffer = m_Buffer.data();
+                while (nRead < nLen)
+                {
+                    const ssize_t n = pread(m_nFd, pBuffer + nRead, nLen - nRead, off_t(nOffset + nRead));
+                    if (n <= 0)
+                        break;
+                    nRead += size_t(n);
+                }
+            }
+        }
+        if (nRead < nLen)
+        {
+            std::cerr << "[ReVPK] WARNING: " << m_FilePath << " ended early, reading it as zeros.\n";
+            std::memset(pBuffer + nRead, 0, nLen - nRead);
+        }
+
+        m_pBuffer = pBuffer;
+        m_nBufferOffset = nOffset;
+        m_nBufferLen = nLen;
+    }
+
+    const uint8_t* pData = m_pBuffer + (nOffset - m_nBufferOffset);
+    if (nOffset <= m_nCRCEnd && nOffset + nLen > m_nCRCEnd)
+    {
+        const uint64_t nSkip = m_nCRCEnd - nOffset;
+        m_nCRC = crc32_z(m_nCRC, pData + nSkip, size_t(nLen - nSkip));
+        m_nCRCEnd = nOffset + nLen;
+    }
+    return pData;
+}
+
+// ------------------------------------------------------------------------
+//  CPackArchiveSet
+// ------------------------------------------------------------------------
+CPackArchiveSet::CPackArchiveSet(PathFn_t fnArchivePath, uint16_t iFirstIndex, uint64_t nMaxArchiveSize)
+: m_fnArchivePath(std::move(fnArchivePath))
+, m_iFirstIndex(iFirstIndex)
+, m_nMaxArchiveSize(nMaxArchiveSize)
+, m_bWriteFailed(false)
+{
+}
+
+CPackArchiveSet::~CPackArchiveSet()
+{
+    Close();
+}
+
+bool CPackArchiveSet::Open()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Archives.empty() ? OpenArchive(m_iFirstIndex) : true;
+}
+
+bool CPackArchiveSet::AddExisting(uint16_t iIndex)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Existing.find(iIndex) != m_Existing.end())
+        return true;
+
+    auto pArchive = std::make_unique<Archive_t>();
+    pArchive->m_Path = m_fnArchivePath(iIndex);
+    pArchive->m_nFd  = open(pArchive->m_Path.c_str(), O_RDONLY);
+    if (pArchive->m_nFd < 0)
+    {
+        std::cerr << "[ReVPK] WARNING: Cannot open existing pack file: " << pArchive->m_Path << "\n";
+        return false;
+    }
+
+    m_Existing.emplace(iIndex, std::move(pArchive));
+    return true;
+}
+
+bool CPackArchiveSet::OpenArchive(uint16_t iIndex)
+{
+    auto pArchive = std::make_unique<Archive_t>();
+    pArchive->m_Path = m_fnArchivePath(iIndex);
+    pArchive->m_nFd  = open(pArchive->m_Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+    // An archive that can't be created is still added, so the indices handed
+    // out stay valid; writes to it are dropped and Close() reports the failure.
+    const bool bOpened = pArchive->m_nFd >= 0;
+    if (!bOpened)
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot open pack file for writing: " << pArchive->m_Path << "\n";
+        m_bWriteFailed = true;
+    }
+    else
+    {
+        Archive_t* pRaw = pArchive.get();
+        pArchive->m_Writer = std::thread([this, pRaw]() { WriterThread(pRaw); });
+    }
+
+    m_Archives.push_back(std::move(pArchive));
+    return bOpened;
+}
+
+void CPackArchiveSet::WriterThread(Archive_t* pArchive)
+{
+    std::unique_lock<std::mutex> lock(pArchive->m_QueueMutex);
+    while (true)
+    {
+        pArchive->m_QueueCV.wait(lock, [pArchive]() { return pArchive->m_bStop || !pArchive->m_Queue.empty(); });
+        if (pArchive->m_Queue.empty())
+            return; // stopped and drained
+
+        auto item = std::move(pArchive->m_Queue.front());
+        pArchive->m_Queue.pop_front();
+        pArchive->m_bBusy = true;
+        lock.unlock();
+
+        const std::vector<uint8_t>& data = item.second;
+        {
+            CPackStats::CScopedTimer timer(CPackStats::kTimerWrite, data.size());
+            if (pwrite(pArchive->m_nFd, data.data(), data.size(), item.first) != (ssize_t)data.size())
+            {
+                std::cerr << "[ReVPK] ERROR: Failed to write to " << pArchive->m_Path << "\n";
+                m_bWriteFailed = true;
+            }
+        }
+        PackStats().ReleaseBuffer(data.size());
+        InFlightBudget().Release(data.size());
+
+        lock.lock();
+        pArchive->m_bBusy = false;
+        if (pArchive->m_Queue.empty())
+            pArchive->m_DrainedCV.notify_all();
+    }
+}
+
+bool CPackArchiveSet::Close()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto& pArchive : m_Archives)
+    {
+        {
+            std::lock_guard<std::mutex> queueLock(pArchive->m_QueueMutex);
+            pArchive->m_bStop = true;
+        }
+        pArchive->m_QueueCV.notify_all();
+        if (pArchive->m_Writer.joinable())
+            pArchive->m_Writer.join();
+
+        if (pArchive->m_nFd >= 0)
+        {
+            close(pArchive->m_nFd);
+            pArchive->m_nFd = -1;
+        }
+    }
+
+    for (auto& existing : m_Existing)
+    {
+        if (existing.second->m_nFd >= 0)
+        {
+            close(existing.second->m_nFd);
+            existing.second->m_nFd = -1;
+        }
+    }
+    return !m_bWriteFailed;
+}
+
+uint16_t CPackArchiveSet::BeginEntry(uint64_t nMaxBytes)
+{
+    std::unique_lock<std::mutex> lock = PackStats().Lock(m_Mutex, CPackStats::kLockArchives);
+    if (m_Archives.empty())
+        OpenArchive(m_iFirstIndex);
+    Archive_t* pCurrent = m_Archives.back().get();
+
+    // Bytes already allocated plus the entry's uncompressed size as its worst
+    // case, so an archive only outgrows the cap for an entry bigger than it.
+    const uint64_t nUsed = pCurrent->m_nOffset.load();
+    if (m_nMaxArchiveSize > 0 && nUsed > 0 && nUsed + nMaxBytes > m_nMaxArchiveSize)
+    {
+        OpenArchive(uint16_t(m_iFirstIndex + m_Archives.size()));
+        pCurrent = m_Archives.back().get();
+    }
+
+    return uint16_t(m_iFirstIndex + m_Archives.size() - 1);
+}
+
+CPackArchiveSet::Archive_t* CPackArchiveSet::GetArchive(uint16_t iIndex) const
+{
+    std::unique_lock<std::mutex> lock = PackStats().Lock(m_Mutex, CPackStats::kLockArchives);
+    auto it = m_Existing.find(iIndex);
+    if (it != m_Existing.end())
+        return it->second.get();
+    return m_Archives[iIndex - m_iFirstIndex].get();
+}
+
+uint64_t CPackArchiveSet::Allocate(uint16_t iIndex, uint64_t nBytes)
+{
+    return GetArchive(iIndex)->m_nOffset.fetch_add(nBytes);
+}
+
+void CPackArchiveSet::Write(uint16_t iIndex, uint64_t nOffset, std::vector<uint8_t> data)
+{
+    Archive_t* pArchive = GetArchive(iIndex);
+    if (pArchive->m_nFd < 0)
+        return; // could not be created, see OpenArchive()
+
+    InFlightBudget().Acquire(data.size()); // waits for the writers to catch up
+    PackStats().AcquireBuffer(data.size());
+    {
+        std::unique_lock<std::mutex> lock = PackStats().Lock(pArchive->m_QueueMutex, CPackStats::kLockArchives);
+        pArchive->m_Queue.emplace_back(nOffset, std::move(data));
+    }
+    pArchive->m_QueueCV.notify_one();
+}
+
+bool CPackArchiveSet::Read(uint16_t iIndex, uint64_t nOffset, uint8_t* pDst, size_t nLen)
+{
+    Archive_t* pArchive = GetArchive(iIndex);
+    {
+        std::unique_lock<std::mutex> lock(pArchive->m_QueueMutex);
+        pArchive->m_DrainedCV.wait(lock, [pArchive]() { return pArchive->m_Queue.empty() && !pArchive->m_bBusy; });
+    }
+    return pread(pArchive->m_nFd, pDst, nLen, nOffset) == (ssize_t)nLen;
+}
+
+bool CPackArchiveSet::FindArchiveHolding(const std::vector<uint64_t>& chunkHashes, uint16_t& outIndex) const
+{
+    // Don't hold m_Mutex while probing the tables: packmulti calls Allocate(),
+    // which takes it, from its FindOrInsert() callback, while a shard lock is held.
+    std::vector<std::pair<uint16_t, const Archive_t*>> archives;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (size_t i = 0; i < m_Archives.size(); i++)
+            archives.emplace_back(uint16_t(m_iFirstIndex + i), m_Archives[i].get());
+        for (const auto& existing : m_Existing)
+            archives.emplace_back(existing.first, existing.second.get());
+    }
+
+    for (size_t i = 0; i < archives.size(); i++)
+    {
+        const CChunkDedupTable& chunkTable = archives[i].second->m_ChunkTable;
+        bool bHoldsAll = true;
+        for (uint64_t chunkHash : chunkHashes)
+        {
+            VPKChunkDescriptor_t desc;
+            if (!chunkTable.Find(chunkHash, desc))
+            {
+                bHoldsAll = false;
+                break;
+            }
+        }
+
+        if (bHoldsAll)
+        {
+            outIndex = archives[i].first;
+            return true;
+        }
+    }
+    return false;
+}
+
+CChunkDedupTable& CPackArchiveSet::GetChunkTable(uint16_t iIndex)
+{
+    return GetArchive(iIndex)->m_ChunkTable;
+}
+
+size_t CPackArchiveSet::GetArchiveCount() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Archives.size();
+}
+
+uint64_t CPackArchiveSet::GetTotalSize() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    uint64_t nTotal = 0;
+    for (const auto& pArchive : m_Archives)
+        nTotal += pArchive->m_nOffset.load();
+    return nTotal;
+}
+
+/** Pack file mappings of one directory, keyed by pack file index. */
+using PackFileViewMap_t = std::map<uint16_t, std::unique_ptr<CPackFileView>>;
+
+static void OpenPackFileViews(const VPKDir_t& vpkDir, PackFileViewMap_t& views)
+{
+    namespace fs = std::filesystem;
+    fs::path baseDir = fs::path(vpkDir.m_DirFilePath).parent_path();
+
+    for (uint16_t packFileIndex : vpkDir.m_PakFileIndices)
+    {
+        fs::path packPath = baseDir / vpkDir.GetPackFileNameForIndex(packFileIndex);
+
+        auto view = std::make_unique<CPackFileView>();
+        if (!view->Open(packPath.string()))
+        {
+            std::cerr << "[ReVPK] ERROR: Could not open chunk file: " << packPath << "\n";
+            continue;
+        }
+        views[packFileIndex] = std::move(view);
+    }
+}
+
+// ------------------------------------------------------------------------
+//  Decompress chunk
+// ------------------------------------------------------------------------
+bool CPackedStoreBuilder::DecompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                                          uint8_t* pDst, size_t& nDstLen) const
+{
+    // Check for ZSTD marker.
+    if (nSrcLen >= sizeof(R1D_marker))
+    {
+        uint64_t possibleMarker = 0;
+        std::memcpy(&possibleMarker, pSrc, sizeof(R1D_marker));
+        if (possibleMarker == R1D_marker)
+        {
+            CPackStats::CScopedTimer timer(CPackStats::kTimerDecompressZSTD);
+            size_t markerSize = sizeof(R1D_marker);
+            ZSTD_DCtx* pDCtx = GetZstdDCtx();
+            if (!pDCtx)
+                return false;
+
+            // A dictionary ID instead of the frame's magic number selects
+            // the dictionary the fragment was compressed with.
+            const ZSTD_DDict* pDDict = nullptr;
+            uint32_t dictId = 0;
+            if (nSrcLen >= markerSize + sizeof(dictId))
+            {
+                std::memcpy(&dictId, pSrc + markerSize, sizeof(dictId));
+                if (dictId != ZSTD_MAGICNUMBER)
+                {
+                    pDDict = m_ZstdDicts.GetDDict(dictId);
+                    if (!pDDict)
+                    {
+                        std::cerr << "[ReVPK] ERROR: Chunk needs ZSTD dictionary " << dictId
+                                  << ", which is not loaded.\n";
+                        return false;
+                    }
+                    markerSize += sizeof(dictId);
+                }
+            }
+
+            size_t dResult = pDDict
+                ? ZSTD_decompress_usingDDict(pDCtx, pDst, VPK_ENTRY_MAX_LEN,
+                                             pSrc + markerSize, nSrcLen - markerSize, pDDict)
+                : ZSTD_decompressDCtx(pDCtx, pDst, VPK_ENTRY_MAX_LEN,
+                                      pSrc + markerSize, nSrcLen - markerSize);
+            if (ZSTD_isError(dResult))
+            {
+                std::cerr << "[ReVPK] ERROR decompressing ZSTD chunk.\n";
+                return false;
+            }
+            nDstLen = dResult;
+            timer.SetBytes(nDstLen);
+            return true;
+        }
+    }
+
+    // For LZHAM, use this thread's decoder state.
+    CPackStats::CScopedTimer timer(CPackStats::kTimerDecompressLZHAM);
+    lzham_decompress_state_ptr pState = GetLzhamDecompressor(m_DecoderParams);
+    if (!pState)
+        return false;
+
+    // Unbuffered mode: the whole fragment goes in and out in one call.
+    size_t inLen = nSrcLen;
+    nDstLen = VPK_ENTRY_MAX_LEN;
+    lzham_decompress_status_t st = lzham_decompress(pState, pSrc, &inLen,
+                                                    pDst, &nDstLen, true);
+    if (st != LZHAM_DECOMP_STATUS_SUCCESS)
+    {
+        std::cerr << "[ReVPK] ERROR decompressing LZHAM chunk.\n";
+        return false;
+    }
+    timer.SetBytes(nDstLen);
+    return true;
+}
+
+// ------------------------------------------------------------------------
+//  Unpack a single entry block
+// ------------------------------------------------------------------------
+// Entries being extracted at once. Each one holds a slot from the moment
+// it's queued until its file is closed, which keeps a big VPK well below
+// the open file limit (RLIMIT_NOFILE, often 1024).
+static constexpr size_t UNPACK_MAX_OPEN_FILES = 256;
+
+class CUnpackFileSlots
+{
+public:
+    void Acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_CV.wait(lock, [this]() { return m_nUsed < UNPACK_MAX_OPEN_FILES; });
+        m_nUsed++;
+    }
 
-    std::vector<VPKKeyValues_t> buildList;
-    if (!LoadKeyValuesManifest(manifestFile.string(), buildList))
+    void Release()
     {
-        std::cerr << "[ReVPK] ERROR: Could not load manifest: " << manifestFile << "\n";
-        return;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_nUsed--;
+        }
+        m_CV.notify_one();
     }
 
-    // 2) Create the pack file
-    fs::path packPath = fs::path(buildPath) / vpkPair.m_PackName;
-    fs::path dirPath = fs::path(buildPath) / vpkPair.m_DirName;
+private:
+    std::mutex              m_Mutex;
+    std::condition_variable m_CV;
+    size_t                  m_nUsed = 0;
+};
 
-    try
+static CUnpackFileSlots& UnpackFileSlots()
+{
+    static CUnpackFileSlots slots;
+    return slots;
+}
+
+// Size of an entry once extracted; deduplicated chunks are skipped.
+static uint64_t GetUnpackedSize(const VPKEntryBlock_t& block)
+{
+    uint64_t fileSize = block.m_PreloadData.size();
+    for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
     {
-        fs::create_directories(packPath.parent_path());
+        if (frag.m_nPackFileOffset == 0 && frag.m_nCompressedSize == 0)
+            continue; // skip deduplicated chunk
+        fileSize += frag.m_nUncompressedSize;
     }
-    catch (...)
+    return fileSize;
+}
+
+// Output file shared by the fragment tasks of one entry. The first task to
+// run creates it and the last one to finish closes it, so only entries that
+// are actually being extracted keep a descriptor open.
+struct UnpackOutputFile_t
+{
+    const VPKEntryBlock_t* m_pBlock = nullptr;
+    std::string m_Path;
+    std::mutex  m_Mutex;
+    bool        m_bOpened = false; // creation was attempted
+    int         m_nFd = -1;
+
+    UnpackOutputFile_t(const VPKEntryBlock_t& block, const std::string& path)
+    : m_pBlock(&block), m_Path(path)
     {
-        std::cerr << "[ReVPK] ERROR: Cannot create directory: " << packPath.parent_path() << "\n";
-        return;
+        UnpackFileSlots().Acquire();
     }
 
-    std::ofstream ofsPack(packPath, std::ios::binary);
-    if (!ofsPack.is_open())
+    ~UnpackOutputFile_t()
     {
-        std::cerr << "[ReVPK] ERROR: Cannot open pack file for writing: " << packPath << "\n";
-        return;
+        if (m_nFd >= 0)
+            close(m_nFd);
+        Progress().Advance(1, 0);
+        UnpackFileSlots().Release();
     }
 
-    std::vector<VPKEntryBlock_t> entryBlocks;
-    entryBlocks.reserve(buildList.size());
+    // Create the file, size it and write the preload data; the other tasks
+    // of the entry wait until that's done. False if it failed (reported once).
+    bool Open()
+    {
+        namespace fs = std::filesystem;
 
-    // Buffers for chunk operations
-    std::unique_ptr<uint8_t[]> chunkBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
-    std::unique_ptr<uint8_t[]> compBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_bOpened)
+            return m_nFd >= 0;
+        m_bOpened = true;
 
-    size_t sharedBytes = 0;
-    size_t sharedChunks = 0;
-    uint16_t packFileIndex = 0; // single .vpk scenario
+        std::error_code ec;
+        fs::create_directories(fs::path(m_Path).parent_path(), ec);
 
-    // 3) Process each file from manifest
-    for (const auto& kv : buildList)
-    {
-        // Open and read input file
-        std::ifstream ifFile(kv.m_EntryPath, std::ios::binary);
-        if (!ifFile.good())
+        m_nFd = open(m_Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (m_nFd < 0)
         {
-            std::cerr << "[ReVPK] WARNING: Could not open " << kv.m_EntryPath << "\n";
-            continue;
+            std::cerr << "[ReVPK] ERROR: Could not open output file for writing: " << m_Path << "\n";
+            return false;
         }
 
-        ifFile.seekg(0, std::ios::end);
-        std::streamoff len = ifFile.tellg();
-        ifFile.seekg(0, std::ios::beg);
-
-        if (len <= 0)
+        // Every fragment lands at the preload size plus the sizes of the fragments
+        // before it, so the file can be sized up front and written out of order.
+        if (ftruncate(m_nFd, static_cast<off_t>(GetUnpackedSize(*m_pBlock))) != 0)
         {
-            std::cerr << "[ReVPK] WARNING: " << kv.m_EntryPath << " is empty.\n";
-            continue;
+            std::cerr << "[ReVPK] ERROR: Could not allocate output file: " << m_Path << "\n";
+            close(m_nFd);
+            m_nFd = -1;
+            return false;
         }
 
-        // Read entire file
-        std::unique_ptr<uint8_t[]> fileData(new uint8_t[len]);
-        ifFile.read(reinterpret_cast<char*>(fileData.get()), len);
-        ifFile.close();
-
-        // Create entry block
-        VPKEntryBlock_t blk(fileData.get(), size_t(len), 0,
-                            kv.m_iPreloadSize, packFileIndex,
-                            kv.m_nLoadFlags, kv.m_nTextureFlags,
-                            kv.m_EntryPath.c_str());
-        entryBlocks.push_back(blk);
-
-        // Process each chunk
-        size_t memoryOffset = 0;
-        for (auto& frag : entryBlocks.back().m_Fragments)
+        // Write preload data first if present
+        const std::vector<uint8_t>& preload = m_pBlock->m_PreloadData;
+        if (!preload.empty())
         {
-            // Copy chunk to working buffer
-            std::memcpy(chunkBuf.get(),
-                        fileData.get() + memoryOffset,
-                        frag.m_nUncompressedSize);
-
-            // --- ZSTD support ---
-            // 1) Attempt compression if enabled
-            bool compressedOk = false;
-            size_t compSize = frag.m_nUncompressedSize;
-
-            if (kv.m_bUseCompression)
+            CPackStats::CScopedTimer timer(CPackStats::kTimerWrite, preload.size());
+            if (pwrite(m_nFd, preload.data(), preload.size(), 0) != (ssize_t)preload.size())
             {
-                if (IsUsingZSTD())
-                {
-                    // ------------------------------
-                    // (A) ZSTD path
-                    // ------------------------------
-                    // We'll put the marker at the beginning of compBuf,
-                    // and compress into compBuf + markerSize.
-                    constexpr size_t markerSize = sizeof(R1D_marker);
-                    // For safety, ensure we have enough space in compBuf
-                    // compBuf is VPK_ENTRY_MAX_LEN in size, so it's presumably safe.
-
-                    // Store marker in compBuf
-                    std::memcpy(compBuf.get(), &R1D_marker, markerSize);
-
-                    // Then do ZSTD compression after the marker
-                    size_t zstdBound = ZSTD_compressBound(frag.m_nUncompressedSize);
-                    // We must not exceed VPK_ENTRY_MAX_LEN - markerSize
-                    if (zstdBound + markerSize > VPK_ENTRY_MAX_LEN)
-                        zstdBound = VPK_ENTRY_MAX_LEN - markerSize;
-
-                    size_t zstdResult = ZSTD_compress(
-                        compBuf.get() + markerSize,   // dest
-                        zstdBound,                    // dest capacity
-                        chunkBuf.get(),               // src
-                        frag.m_nUncompressedSize,     // src size
-                        6 /* or some default ZSTD level */
-                    );
-
-                    if (!ZSTD_isError(zstdResult))
-                    {
-                        size_t totalZstdSize = zstdResult + markerSize;
-                        if (totalZstdSize < frag.m_nUncompressedSize)
-                        {
-                            compressedOk = true;
-                            compSize = totalZstdSize;
-                        }
-                    }
-                }
-                else
-                {
-                    // ------------------------------
-                    // (B) LZHAM path
-                    // ------------------------------
-                    lzham_compress_status_t st = lzham_compress_memory(
-                        &m_Encoder,
-                        compBuf.get(), &compSize,
-                        chunkBuf.get(), frag.m_nUncompressedSize,
-                        nullptr
-                    );
-                    if (st == LZHAM_COMP_STATUS_SUCCESS && compSize < frag.m_nUncompressedSize)
-                    {
-                        compressedOk = true;
-                    }
-                    else
-                    {
-                        compSize = frag.m_nUncompressedSize; // revert
-                    }
-                }
+                std::cerr << "[ReVPK] ERROR: Failed to write " << m_pBlock->m_EntryPath << "\n";
+                close(m_nFd);
+                m_nFd = -1;
+                return false;
             }
+            Progress().Advance(0, preload.size());
+        }
+        return true;
+    }
+};
+
+bool CPackedStoreBuilder::UnpackFragment(const VPKEntryBlock_t& block,
+                                         const VPKChunkDescriptor_t& frag,
+                                         const CPackFileView& packView,
+                                         const std::shared_ptr<UnpackOutputFile_t>& pOutput,
+                                         uint64_t nOutOffset,
+                                         CAsyncFileWriter* pWriter) const
+{
+    if (!pOutput->Open())
+        return false;
 
-            // 2) Decide final data to write
-            const uint8_t* finalDataPtr = compressedOk ? compBuf.get() : chunkBuf.get();
-            size_t finalDataSize        = compressedOk ? compSize : frag.m_nUncompressedSize;
+    const uint8_t* pSrc = packView.GetRange(frag.m_nPackFileOffset, frag.m_nCompressedSize);
+    if (!pSrc)
+    {
+        std::cerr << "[ReVPK] ERROR: Fragment of " << block.m_EntryPath
+                  << " lies outside of its pack file.\n";
+        return false;
+    }
 
-            // --- Deduplication Logic ---
-            std::string chunkHash = compute_sha1_hex(finalDataPtr, finalDataSize);
-            auto it = m_ChunkHashMap.find(chunkHash);
-            if (it != m_ChunkHashMap.end())
-            {
-                // Existing chunk:
-                frag = it->second;
-                sharedBytes += frag.m_nUncompressedSize;
-                sharedChunks++;
-            }
-            else
-            {
-                // New chunk:
-                // 3) Prepare descriptor with final values
-                uint64_t writePos = static_cast<uint64_t>(ofsPack.tellp());
-                frag.m_nPackFileOffset = writePos;
-                frag.m_nCompressedSize = finalDataSize;
+    // Pack data is paged in from the mapping as it's used, so reads are
+    // counted but their time lands in decompression and writing.
+    PackStats().AddTime(CPackStats::kTimerRead, 0, frag.m_nCompressedSize);
 
-                // 4) Write
-                ofsPack.write(reinterpret_cast<const char*>(finalDataPtr), finalDataSize);
+    // If the chunk is not compressed, write it straight from the mapping.
+    const uint8_t* pData = pSrc;
+    size_t dataLen = frag.m_nUncompressedSize;
 
-                // 5) Store in map
-                m_ChunkHashMap[chunkHash] = frag;
-            }
+    // The async writer has buffers of its own to decompress into.
+    thread_local std::vector<uint8_t> dstBuf(VPK_ENTRY_MAX_LEN);
+    int iBuffer = -1;
+    if (frag.m_nCompressedSize != frag.m_nUncompressedSize)
+    {
+        uint8_t* pDst = pWriter ? pWriter->GetBuffer(iBuffer) : dstBuf.data();
+        if (!DecompressChunk(pSrc, frag.m_nCompressedSize, pDst, dataLen))
+        {
+            if (pWriter)
+                pWriter->PutBuffer(iBuffer);
+            return false;
+        }
 
-            memoryOffset += frag.m_nUncompressedSize;
+        if (dataLen != frag.m_nUncompressedSize)
+        {
+            std::cerr << "[ReVPK] ERROR: Fragment of " << block.m_EntryPath
+                      << " decompressed to " << dataLen << " bytes, expected "
+                      << frag.m_nUncompressedSize << ".\n";
+            if (pWriter)
+                pWriter->PutBuffer(iBuffer);
+            return false;
         }
+        pData = pDst;
     }
 
-    ofsPack.flush();
-    ofsPack.close();
+    if (pWriter)
+    {
+        pWriter->Write(pOutput->m_nFd, pOutput, block.m_EntryPath, iBuffer, pData, dataLen, nOutOffset);
+        return true;
+    }
 
-    // Log statistics
-    auto finalSize = fs::file_size(packPath);
-    std::cout << "[ReVPK] Packed " << buildList.size()
-        << " files into " << packPath.filename().string()
-        << " (" << finalSize << " bytes total, "
-        << sharedBytes << " bytes deduplicated in "
-        << sharedChunks << " shared chunks)\n";
+    CPackStats::CScopedTimer timer(CPackStats::kTimerWrite, dataLen);
+    if (pwrite(pOutput->m_nFd, pData, dataLen, nOutOffset) != (ssize_t)dataLen)
+    {
+        std::cerr << "[ReVPK] ERROR: Failed to write " << block.m_EntryPath << "\n";
+        return false;
+    }
+    Progress().Advance(0, dataLen);
+    return true;
+}
 
-    // Build directory file
-    VPKDir_t dir;
-    dir.BuildDirectoryFile(dirPath.string(), entryBlocks);
+bool CPackedStoreBuilder::UnpackEntryBlock(const VPKEntryBlock_t& block,
+                                           const CPackFileView& packView,
+                                           const std::string& outFilePath,
+                                           ThreadPool& pool,
+                                           CAsyncFileWriter* pWriter) const
+{
+    // The file itself is created by whichever of its tasks runs first; this
+    // waits while too many entries are in progress.
+    auto pOutput = std::make_shared<UnpackOutputFile_t>(block, outFilePath);
+
+    // Queue each fragment in the block, so large entries are spread over all
+    // workers instead of being decompressed by one.
+    bool bQueued = false;
+    uint64_t outOffset = block.m_PreloadData.size();
+    for (const VPKChunkDescriptor_t& frag : block.m_Fragments)
+    {
+        if (frag.m_nPackFileOffset == 0 && frag.m_nCompressedSize == 0)
+            continue; // skip deduplicated chunk
+
+        pool.enqueue([this, &block, &frag, &packView, pOutput, outOffset, pWriter]() mutable {
+            UnpackFragment(block, frag, packView, pOutput, outOffset, pWriter);
+            pOutput.reset(); // close the file as soon as its last fragment is written
+        });
+        outOffset += frag.m_nUncompressedSize;
+        bQueued = true;
+    }
 
-    m_ChunkHashMap.clear();
+    // Entries without fragments still get their (preload-only or empty) file.
+    if (!bQueued)
+        pool.enqueue([pOutput]() mutable { pOutput->Open(); pOutput.reset(); });
+    return true;
 }
 
 // ------------------------------------------------------------------------
@@ -437,112 +2090,36 @@ void CPackedStoreBuilder::UnpackStore(const VPKDir_t& vpkDir, const char* worksp
     // -----------------------------
     // Multi-threaded extraction
     // -----------------------------
-    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency() - 1);
-    ThreadPool pool(numThreads);
+    // Map each pack file once; workers read fragments straight from the mapping.
+    PackFileViewMap_t packViews;
+    OpenPackFileViews(vpkDir, packViews);
+    LoadZstdDicts(vpkDir);
 
-    // For each file block, enqueue an extraction task.
+    uint64_t totalBytes = 0;
     for (const auto& block : vpkDir.m_EntryBlocks)
-    {
-        pool.enqueue([block, outPath, &vpkDir, this]() {
-            namespace fs = std::filesystem;
-            // Determine the pack file for this block.
-            std::string packFileName = vpkDir.GetPackFileNameForIndex(block.m_iPackFileIndex);
-            fs::path baseDir = fs::path(vpkDir.m_DirFilePath).parent_path();
-            fs::path chunkPath = baseDir / packFileName;
-
-            std::ifstream ifs(chunkPath, std::ios::binary);
-            if (!ifs.good())
-            {
-                std::cerr << "[ReVPK] ERROR: Could not open chunk file: " << chunkPath << "\n";
-                return;
-            }
-
-            // Create output directories and file.
-            fs::path outFile = outPath / block.m_EntryPath;
-            fs::create_directories(outFile.parent_path());
-            std::ofstream ofs(outFile, std::ios::binary);
-            if (!ofs.is_open())
-            {
-                std::cerr << "[ReVPK] ERROR: Could not open output file for writing: " << outFile << "\n";
-                return;
-            }
+        totalBytes += GetUnpackedSize(block);
+    Progress().AddTotal(vpkDir.m_EntryBlocks.size(), totalBytes);
 
-            // Write preload data first if present
-            if (!block.m_PreloadData.empty()) {
-                ofs.write(reinterpret_cast<const char*>(block.m_PreloadData.data()), block.m_PreloadData.size());
-            }
-
-            // Allocate per-task buffers.
-            std::unique_ptr<uint8_t[]> srcBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
-            std::unique_ptr<uint8_t[]> dstBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
-
-            // Process each fragment in the block.
-            for (auto& frag : block.m_Fragments)
-            {
-                if (frag.m_nPackFileOffset == 0 && frag.m_nCompressedSize == 0)
-                    continue; // skip deduplicated chunk
+    // Fragments are written in the background if io_uring is available.
+    CAsyncFileWriter writer;
+    CAsyncFileWriter* pWriter = writer.Start() ? &writer : nullptr;
 
-                ifs.seekg(frag.m_nPackFileOffset, std::ios::beg);
-                if (!ifs.good())
-                    break;
+    ThreadPool pool(GetWorkerCount());
 
-                ifs.read(reinterpret_cast<char*>(srcBuf.get()), frag.m_nCompressedSize);
+    // Create each file and enqueue one extraction task per fragment.
+    for (const auto& block : vpkDir.m_EntryBlocks)
+    {
+        auto itView = packViews.find(block.m_iPackFileIndex);
+        if (itView == packViews.end())
+        {
+            Progress().Advance(1, GetUnpackedSize(block));
+            continue; // pack file is missing, already reported
+        }
 
-                // If the chunk is not compressed…
-                if (frag.m_nCompressedSize == frag.m_nUncompressedSize)
-                {
-                    ofs.write(reinterpret_cast<const char*>(srcBuf.get()), frag.m_nUncompressedSize);
-                }
-                else
-                {
-                    // Check for ZSTD marker.
-                    if (frag.m_nCompressedSize >= sizeof(R1D_marker))
-                    {
-                        uint64_t possibleMarker = 0;
-                        std::memcpy(&possibleMarker, srcBuf.get(), sizeof(R1D_marker));
-                        if (possibleMarker == R1D_marker)
-                        {
-                            constexpr size_t markerSize = sizeof(R1D_marker);
-                            const uint8_t* zstdData = srcBuf.get() + markerSize;
-                            size_t zstdSize = frag.m_nCompressedSize - markerSize;
-                            size_t dstLen = VPK_ENTRY_MAX_LEN;
-                            size_t dResult = ZSTD_decompress(dstBuf.get(), dstLen, zstdData, zstdSize);
-                            if (!ZSTD_isError(dResult))
-                            {
-                                ofs.write(reinterpret_cast<const char*>(dstBuf.get()), dResult);
-                            }
-                            else
-                            {
-                                std::cerr << "[ReVPK] ERROR decompressing ZSTD chunk.\n";
-                            }
-                            continue;
-                        }
-                    }
-                    // For LZHAM, make a local copy of the decoder state for thread safety.
-                    lzham_decompress_params local_params;
-                    std::memset(&local_params, 0, sizeof(local_params));
-                    local_params.m_struct_size = sizeof(local_params);
-                    local_params.m_dict_size_log2 = VPK_DICT_SIZE;
-                    size_t dstLen = VPK_ENTRY_MAX_LEN;
-                    lzham_decompress_status_t st = lzham_decompress_memory(
-                        &local_params,
-                        dstBuf.get(), &dstLen,
-                        srcBuf.get(), static_cast<size_t>(frag.m_nCompressedSize),
-                        nullptr
-                    );
-                    if (st != LZHAM_DECOMP_STATUS_SUCCESS)
-                    {
-                        std::cerr << "[ReVPK] ERROR decompressing LZHAM chunk.\n";
-                    }
-                    else
-                    {
-                        ofs.write(reinterpret_cast<const char*>(dstBuf.get()), dstLen);
-                    }
-                }
-            } // end per-fragment loop
-        });
+        UnpackEntryBlock(block, *itView->second, (outPath / block.m_EntryPath).string(), pool, pWriter);
     }
     pool.wait(); // Wait until all extraction tasks are complete.
+    writer.Flush();
 }
 
 // ------------------------------------------------------------------------
@@ -557,123 +2134,49 @@ void CPackedStoreBuilder::UnpackStoreDifferences(
 {
     namespace fs = std::filesystem;
 
-    // Build a map from entry path to file CRC for the fallback language.
-    std::unordered_map<std::string, uint32_t> fallbackCrcMap;
-    for (auto& fbBlock : fallbackDir.m_EntryBlocks)
-    {
-        fallbackCrcMap[fbBlock.m_EntryPath] = fbBlock.m_nFileCRC;
-    }
-
-    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency() - 1);
-    ThreadPool pool(numThreads);
-
-    fs::path baseDir = fs::path(otherLangDir.m_DirFilePath).parent_path();
+    PackFileViewMap_t packViews;
+    OpenPackFileViews(otherLangDir, packViews);
+    LoadZstdDicts(otherLangDir);
 
-    // For each file block in the other language...
+    // Only the entries that differ from the fallback are extracted.
+    std::vector<const VPKEntryBlock_t*> changedBlocks;
+    uint64_t totalBytes = 0;
     for (auto& block : otherLangDir.m_EntryBlocks)
     {
-        auto itCrc = fallbackCrcMap.find(block.m_EntryPath);
-        bool sameAsFallback = (itCrc != fallbackCrcMap.end() && itCrc->second == block.m_nFileCRC);
+        const VPKEntryBlock_t* pFallback = fallbackDir.FindEntry(block.m_EntryPath);
+        bool sameAsFallback = (pFallback && pFallback->m_nFileCRC == block.m_nFileCRC);
 
         // Skip extraction if the fallback file is identical.
         if (sameAsFallback)
             continue;
 
-        // Enqueue a task to extract this file.
-        pool.enqueue([block, &otherLangDir, baseDir, langOutputPath, this]() {
-            namespace fs = std::filesystem;
-            std::string packFileName = otherLangDir.GetPackFileNameForIndex(block.m_iPackFileIndex);
-            fs::path fullPakPath = baseDir / packFileName;
-
-            std::ifstream ifsPak(fullPakPath, std::ios::binary);
-            if (!ifsPak.good())
-            {
-                std::cerr << "[ReVPK] ERROR: cannot open " << fullPakPath << " for reading\n";
-                return;
-            }
-
-            fs::path outFile = fs::path(langOutputPath) / block.m_EntryPath;
-            fs::create_directories(outFile.parent_path());
-            std::ofstream ofsOut(outFile, std::ios::binary);
-            if (!ofsOut.is_open())
-            {
-                std::cerr << "[ReVPK] ERROR: cannot create " << outFile << "\n";
-                return;
-            }
-
-            // Write preload data first if present
-            if (!block.m_PreloadData.empty()) {
-                ofsOut.write(reinterpret_cast<const char*>(block.m_PreloadData.data()), block.m_PreloadData.size());
-            }
-
-            std::unique_ptr<uint8_t[]> srcBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
-            std::unique_ptr<uint8_t[]> dstBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
+        changedBlocks.push_back(&block);
+        totalBytes += GetUnpackedSize(block);
+    }
+    Progress().AddTotal(changedBlocks.size(), totalBytes);
 
-            for (auto& frag : block.m_Fragments)
-            {
-                if (frag.m_nPackFileOffset == 0 && frag.m_nCompressedSize == 0)
-                    continue;
+    CAsyncFileWriter writer;
+    CAsyncFileWriter* pWriter = writer.Start() ? &writer : nullptr;
 
-                ifsPak.seekg(frag.m_nPackFileOffset, std::ios::beg);
-                if (!ifsPak.good())
-                {
-                    std::cerr << "[ReVPK] ERROR: Bad seek in " << fullPakPath << "\n";
-                    break;
-                }
+    ThreadPool pool(GetWorkerCount());
 
-                ifsPak.read(reinterpret_cast<char*>(srcBuf.get()), frag.m_nCompressedSize);
+    // For each changed file block in the other language...
+    for (const VPKEntryBlock_t* pBlock : changedBlocks)
+    {
+        const VPKEntryBlock_t& block = *pBlock;
+        auto itView = packViews.find(block.m_iPackFileIndex);
+        if (itView == packViews.end())
+        {
+            Progress().Advance(1, GetUnpackedSize(block));
+            continue; // pack file is missing, already reported
+        }
 
-                if (frag.m_nCompressedSize == frag.m_nUncompressedSize)
-                {
-                    ofsOut.write(reinterpret_cast<const char*>(srcBuf.get()), frag.m_nUncompressedSize);
-                }
-                else
-                {
-                    if (frag.m_nCompressedSize >= sizeof(R1D_marker))
-                    {
-                        uint64_t possibleMarker = 0;
-                        std::memcpy(&possibleMarker, srcBuf.get(), sizeof(R1D_marker));
-                        if (possibleMarker == R1D_marker)
-                        {
-                            size_t zstdSize = frag.m_nCompressedSize - sizeof(R1D_marker);
-                            const uint8_t* zstdData = srcBuf.get() + sizeof(R1D_marker);
-                            size_t dstLen = VPK_ENTRY_MAX_LEN;
-                            size_t dRes = ZSTD_decompress(dstBuf.get(), dstLen, zstdData, zstdSize);
-                            if (!ZSTD_isError(dRes))
-                            {
-                                ofsOut.write(reinterpret_cast<const char*>(dstBuf.get()), dRes);
-                            }
-                            else
-                            {
-                                std::cerr << "[ReVPK] ERROR: ZSTD decompress failed.\n";
-                            }
-                            continue;
-                        }
-                    }
-                    lzham_decompress_params local_params;
-                    std::memset(&local_params, 0, sizeof(local_params));
-                    local_params.m_struct_size = sizeof(local_params);
-                    local_params.m_dict_size_log2 = VPK_DICT_SIZE;
-                    size_t dstLen = VPK_ENTRY_MAX_LEN;
-                    lzham_decompress_status_t st = lzham_decompress_memory(
-                        &local_params,
-                        dstBuf.get(), &dstLen,
-                        srcBuf.get(), static_cast<size_t>(frag.m_nCompressedSize),
-                        nullptr
-                    );
-                    if (st == LZHAM_DECOMP_STATUS_SUCCESS)
-                    {
-                        ofsOut.write(reinterpret_cast<const char*>(dstBuf.get()), dstLen);
-                    }
-                    else
-                    {
-                        std::cerr << "[ReVPK] ERROR: LZHAM decompress failed.\n";
-                    }
-                }
-            } // end per-fragment loop
-        });
+        // Create the file and enqueue tasks to extract its fragments.
+        UnpackEntryBlock(block, *itView->second,
+                         (fs::path(langOutputPath) / block.m_EntryPath).string(), pool, pWriter);
     }
     pool.wait(); // Wait for all tasks to finish.
+    writer.Flush();
 }
 
 // ------------------------------------------------------------------------
@@ -721,20 +2224,30 @@ void VPKDir_t::Init(const std::string& dirFilePath)
 {
     m_DirFilePath = dirFilePath;
 
-    std::ifstream ifs(dirFilePath, std::ios::binary);
-    if (!ifs.is_open())
+    // Map the whole directory file once; the tree is walked in place below.
+    CPackFileView dirView;
+    if (!dirView.Open(dirFilePath))
     {
         std::cerr << "[ReVPK] ERROR: Unable to open VPK dir file: " << dirFilePath << "\n";
         m_bInitFailed = true;
         return;
     }
 
+    const uint8_t* pHeader = dirView.GetRange(0, sizeof(VPKDirHeader_t));
+    if (!pHeader)
+    {
+        std::cerr << "[ReVPK] ERROR: Truncated VPK header in " << dirFilePath << "\n";
+        m_bInitFailed = true;
+        return;
+    }
+
     // Read the VPKDirHeader_t:
-    ifs.read(reinterpret_cast<char*>(&m_Header.m_nHeaderMarker),   sizeof(m_Header.m_nHeaderMarker));
-    ifs.read(reinterpret_cast<char*>(&m_Header.m_nMajorVersion),   sizeof(m_Header.m_nMajorVersion));
-    ifs.read(reinterpret_cast<char*>(&m_Header.m_nMinorVersion),   sizeof(m_Header.m_nMinorVersion));
-    ifs.read(reinterpret_cast<char*>(&m_Header.m_nDirectorySize),  sizeof(m_Header.m_nDirectorySize));
-    ifs.read(reinterpret_cast<char*>(&m_Header.m_nSignatureSize),  sizeof(m_Header.m_nSignatureSize));
+    const uint8_t* p = pHeader;
+    std::memcpy(&m_Header.m_nHeaderMarker,  p, sizeof(m_Header.m_nHeaderMarker));  p += sizeof(m_Header.m_nHeaderMarker);
+    std::memcpy(&m_Header.m_nMajorVersion,  p, sizeof(m_Header.m_nMajorVersion));  p += sizeof(m_Header.m_nMajorVersion);
+    std::memcpy(&m_Header.m_nMinorVersion,  p, sizeof(m_Header.m_nMinorVersion));  p += sizeof(m_Header.m_nMinorVersion);
+    std::memcpy(&m_Header.m_nDirectorySize, p, sizeof(m_Header.m_nDirectorySize)); p += sizeof(m_Header.m_nDirectorySize);
+    std::memcpy(&m_Header.m_nSignatureSize, p, sizeof(m_Header.m_nSignatureSize)); p += sizeof(m_Header.m_nSignatureSize);
 
     // Validate header:
     if (m_Header.m_nHeaderMarker != VPK_HEADER_MARKER ||
@@ -746,131 +2259,167 @@ void VPKDir_t::Init(const std::string& dirFilePath)
         return;
     }
 
-    // Helper lambda to read a null-terminated string (1-byte delimiter).
-    auto readNullTerminatedString = [&](std::ifstream& in) -> std::string
+    // The tree spans m_nDirectorySize bytes after the header. Fall back to the
+    // rest of the file if the header disagrees with the file size.
+    uint64_t treeSize = dirView.Size() - sizeof(VPKDirHeader_t);
+    if (m_Header.m_nDirectorySize != 0 && m_Header.m_nDirectorySize < treeSize)
+        treeSize = m_Header.m_nDirectorySize;
+
+    const uint8_t* pEnd = dirView.GetRange(sizeof(VPKDirHeader_t), treeSize) + treeSize;
+    bool bTruncated = false;
+
+    // Read a null-terminated string as a view into the mapping.
+    auto readString = [&](std::string_view& out) -> bool
     {
-        std::string s;
-        while (true)
+        const void* pNul = std::memchr(p, '\0', static_cast<size_t>(pEnd - p));
+        if (!pNul)
         {
-            char c;
-            if (!in.get(c))
-                break; // EOF or error
-                if (c == '\0')
-                    break; // finished
-                    s.push_back(c);
+            bTruncated = true;
+            return false;
         }
-        return s;
+        out = std::string_view(reinterpret_cast<const char*>(p),
+                               static_cast<const uint8_t*>(pNul) - p);
+        p = static_cast<const uint8_t*>(pNul) + 1;
+        return true;
     };
 
-    // Outer loop: read extension until empty
-    while (true)
+    // Copy a little-endian field out of the mapping.
+    auto readField = [&](auto& out) -> bool
     {
-        std::string ext = readNullTerminatedString(ifs);
-        if (ext.empty())
+        if (static_cast<size_t>(pEnd - p) < sizeof(out))
         {
-            // If the extension is empty, that means we reached the end of all data.
-            break;
+            bTruncated = true;
+            return false;
         }
+        std::memcpy(&out, p, sizeof(out));
+        p += sizeof(out);
+        return true;
+    };
 
+    std::string_view ext, path, filename;
+
+    // Outer loop: read extension until empty
+    while (readString(ext) && !ext.empty())
+    {
         // Next loop: read path until empty
-        while (true)
+        while (readString(path) && !path.empty())
         {
-            std::string path = readNullTerminatedString(ifs);
-            if (path.empty())
-            {
-                // No more paths for this extension => break to read next extension
-                break;
-            }
+            // Valve uses " " (space) to indicate root path.
+            if (path == " ")
+                path = std::string_view();
 
             // Next loop: read filename until empty
-            while (true)
+            while (readString(filename) && !filename.empty())
             {
-                std::string filename = readNullTerminatedString(ifs);
-                if (filename.empty())
-                {
-                    // No more filenames for this path => break to read next path
-                    break;
-                }
-
-                VPKEntryBlock_t block;
-                block.m_EntryPath = path;
-                if (block.m_EntryPath == " ")
-                {
-                    // Valve uses " " (space) to indicate root path. If so, clear it.
-                    block.m_EntryPath.clear();
-                }
+                VPKEntryBlock_t& block = m_EntryBlocks.emplace_back();
 
-                if (!block.m_EntryPath.empty())
-                {
-                    // Add slash if needed
-                    if (block.m_EntryPath.back() != '/')
-                        block.m_EntryPath.push_back('/');
-                }
-                // full file path = path + filename + '.' + extension
-                block.m_EntryPath += filename;
-                if (!ext.empty())
-                {
-                    block.m_EntryPath.push_back('.');
-                    block.m_EntryPath += ext;
-                }
+                // full file path = path + '/' + filename + '.' + extension
+                block.m_EntryPath.reserve(path.size() + filename.size() + ext.size() + 2);
+                block.m_EntryPath.append(path);
+                if (!path.empty() && path.back() != '/')
+                    block.m_EntryPath.push_back('/');
+                block.m_EntryPath.append(filename);
+                block.m_EntryPath.push_back('.');
+                block.m_EntryPath.append(ext);
 
                 // Read the file CRC, preload size, pack file index
-                ifs.read(reinterpret_cast<char*>(&block.m_nFileCRC),       sizeof(block.m_nFileCRC));
-                ifs.read(reinterpret_cast<char*>(&block.m_iPreloadSize),   sizeof(block.m_iPreloadSize));
-                ifs.read(reinterpret_cast<char*>(&block.m_iPackFileIndex), sizeof(block.m_iPackFileIndex));
+                if (!readField(block.m_nFileCRC) ||
+                    !readField(block.m_iPreloadSize) ||
+                    !readField(block.m_iPackFileIndex))
+                    break;
 
                 // Read preload data if present
-                if (block.m_iPreloadSize > 0) {
-                    block.m_PreloadData.resize(block.m_iPreloadSize);
-                    ifs.read(reinterpret_cast<char*>(block.m_PreloadData.data()), block.m_iPreloadSize);
+                if (block.m_iPreloadSize > 0)
+                {
+                    if (static_cast<size_t>(pEnd - p) < block.m_iPreloadSize)
+                    {
+                        bTruncated = true;
+                        break;
+                    }
+                    block.m_PreloadData.assign(p, p + block.m_iPreloadSize);
+                    p += block.m_iPreloadSize;
                 }
 
-                // Now read chunk descriptors until we hit PACKFILEINDEX_END
-                while (true)
+                // Now read chunk descriptors until we hit PACKFILEINDEX_END.
+                // Each one is 30 bytes (4+2+8+8+8) followed by a 2-byte marker.
+                uint16_t marker = PACKFILEINDEX_SEP;
+                while (marker != PACKFILEINDEX_END)
                 {
-                    // Each chunk descriptor is 30 bytes total (4+2+8+8+8).
-                    VPKChunkDescriptor_t desc;
-                    ifs.read(reinterpret_cast<char*>(&desc.m_nLoadFlags),        sizeof(desc.m_nLoadFlags));
-                    ifs.read(reinterpret_cast<char*>(&desc.m_nTextureFlags),     sizeof(desc.m_nTextureFlags));
-                    ifs.read(reinterpret_cast<char*>(&desc.m_nPackFileOffset),   sizeof(desc.m_nPackFileOffset));
-                    ifs.read(reinterpret_cast<char*>(&desc.m_nCompressedSize),   sizeof(desc.m_nCompressedSize));
-                    ifs.read(reinterpret_cast<char*>(&desc.m_nUncompressedSize), sizeof(desc.m_nUncompressedSize));
-
-                    // Then read the 2-byte marker after each chunk
-                    uint16_t marker = 0;
-                    ifs.read(reinterpret_cast<char*>(&marker), sizeof(marker));
-
-                    // Add chunk descriptor
-                    block.m_Fragments.push_back(desc);
-
-                    // If marker == PACKFILEINDEX_END (0xFFFF), we're done with this file
-                    if (marker == PACKFILEINDEX_END)
+                    VPKChunkDescriptor_t& desc = block.m_Fragments.emplace_back();
+                    if (!readField(desc.m_nLoadFlags) ||
+                        !readField(desc.m_nTextureFlags) ||
+                        !readField(desc.m_nPackFileOffset) ||
+                        !readField(desc.m_nCompressedSize) ||
+                        !readField(desc.m_nUncompressedSize) ||
+                        !readField(marker))
                         break;
-                    // Otherwise (marker == PACKFILEINDEX_SEP or something else),
-                    // keep reading another chunk descriptor
                 }
+                if (bTruncated)
+                    break;
 
-                // Finished reading all chunks for this file => add block to entries
-                m_EntryBlocks.push_back(block);
                 m_PakFileIndices.insert(block.m_iPackFileIndex);
-
-                // After the chunk loop, Valve code writes a single 0‑byte as a
-                // separator for the next filename. But we do NOT forcibly read
-                // it here, because readNullTerminatedString(...) for the next
-                // filename will consume it automatically when that filename
-                // turns out to be "" => break. So our next iteration
-                // readNullTerminatedString() covers that.
             } // filename loop
+
+            if (bTruncated)
+                break;
         } // path loop
+
+        if (bTruncated)
+            break;
     } // extension loop
 
-    ifs.close();
+    if (bTruncated)
+    {
+        std::cerr << "[ReVPK] ERROR: Truncated directory tree in " << dirFilePath << "\n";
+        m_EntryBlocks.clear();
+        m_PakFileIndices.clear();
+        m_bInitFailed = true;
+        return;
+    }
+
+    BuildEntryIndex();
     m_bInitFailed = false;
 }
 
+void VPKDir_t::BuildEntryIndex()
+{
+    m_EntryIndex.clear();
+    m_EntryIndex.reserve(m_EntryBlocks.size());
+
+    for (size_t i = 0; i < m_EntryBlocks.size(); i++)
+    {
+        const std::string& entryPath = m_EntryBlocks[i].m_EntryPath;
+        m_EntryIndex.emplace_back(XXH64(entryPath.data(), entryPath.size(), 0),
+                                  static_cast<uint32_t>(i));
+    }
+    std::sort(m_EntryIndex.begin(), m_EntryIndex.end());
+}
+
+const VPKEntryBlock_t* VPKDir_t::FindEntry(const std::string& entryPath) const
+{
+    const uint64_t hash = XXH64(entryPath.data(), entryPath.size(), 0);
+
+    // Walk all entries sharing this hash; the path compare resolves collisions.
+    // They're ordered by index, so walk back from the end: if the directory
+    // lists a path more than once, the last one wins (as it did in the map).
+    auto first = std::lower_bound(m_EntryIndex.begin(), m_EntryIndex.end(),
+                                  std::make_pair(hash, uint32_t(0)));
+    auto it = std::upper_bound(first, m_EntryIndex.end(),
+                               std::make_pair(hash, UINT32_MAX));
+    while (it != first)
+    {
+        --it;
+        const VPKEntryBlock_t& block = m_EntryBlocks[it->second];
+        if (block.m_EntryPath == entryPath)
+            return &block;
+    }
+    return nullptr;
+}
+
 void VPKDir_t::BuildDirectoryFile(const std::string &directoryPath,
                                   const std::vector<VPKEntryBlock_t> &entryBlocks)
 {
+    CPackStats::CScopedTimer timer(CPackStats::kTimerWrite);
     std::ofstream ofs(directoryPath, std::ios::binary);
     if (!ofs.is_open())
     {
@@ -902,6 +2451,7 @@ void VPKDir_t::BuildDirectoryFile(const std::string &directoryPath,
     ofs.write(reinterpret_cast<const char*>(&term), sizeof(term));
     
     auto endPos = ofs.tellp();
+    timer.SetBytes(uint64_t(endPos));
     uint32_t dirSize = static_cast<uint32_t>(endPos - static_cast<std::streamoff>(sizeof(VPKDirHeader_t)));
     
     // Go back and update the directory header with the actual directory size.
@@ -949,6 +2499,12 @@ std::string VPKDir_t::GetPackFileNameForIndex(uint16_t iPackFileIndex) const
     return std::regex_replace(stripped, std::regex(from), to);
 }
 
+std::string VPKDir_t::GetDictFileName() const
+{
+    // e.g. "englishclient_mp_rr_box.bsp.pak000_dir.vpk" -> "client_mp_rr_box.bsp.pak000_dict.vpk"
+    return std::regex_replace(StripLocalePrefix(m_DirFilePath), std::regex("pak000_dir"), "pak000_dict");
+}
+
 std::string VPKDir_t::StripLocalePrefix(const std::string& directoryPath) const
 {
     // e.g. "englishserver_mp_rr_box.bsp.pak000_dir.vpk" -> "server_mp_rr_box.bsp.pak000_dir.vpk"
@@ -975,108 +2531,111 @@ void VPKDir_t::WriteHeader(std::ofstream& /*ofs*/)
 
 void VPKDir_t::CTreeBuilder::BuildTree(const std::vector<VPKEntryBlock_t>& entryBlocks)
 {
-    for (auto& blk : entryBlocks)
-    {
-        auto pos = blk.m_EntryPath.rfind('.');
-        std::string ext;
-        std::string path;
-        std::string fileNoExt;
-
-        if (pos != std::string::npos)
-            ext = blk.m_EntryPath.substr(pos+1);
-
-        auto slashPos = blk.m_EntryPath.rfind('/');
-        if (slashPos != std::string::npos)
-        {
-            path = blk.m_EntryPath.substr(0, slashPos);
-            fileNoExt = (pos != std::string::npos)
-            ? blk.m_EntryPath.substr(slashPos+1, pos - (slashPos+1))
-            : blk.m_EntryPath.substr(slashPos+1);
-        }
-        else
-        {
-            path = "";
-            fileNoExt = (pos != std::string::npos)
-            ? blk.m_EntryPath.substr(0, pos)
-            : blk.m_EntryPath;
-        }
-        if (path.empty()) path = " ";
+    m_pEntryBlocks = &entryBlocks;
+    m_Entries.clear();
+    m_Entries.reserve(entryBlocks.size());
 
-        m_FileTree[ext][path].push_back(blk);
+    for (size_t i = 0; i < entryBlocks.size(); i++)
+    {
+        const std::string_view entryPath = entryBlocks[i].m_EntryPath;
+        TreeEntry_t entry;
+        entry.m_iBlock = uint32_t(i);
+
+        // The extension follows the last dot, even one in a directory name.
+        const size_t posDot = entryPath.rfind('.');
+        if (posDot != std::string_view::npos)
+            entry.m_Ext = entryPath.substr(posDot + 1);
+
+        const size_t posSlash = entryPath.rfind('/');
+        entry.m_Path = (posSlash != std::string_view::npos && posSlash > 0)
+            ? entryPath.substr(0, posSlash) : std::string_view(" ");
+
+        // The name starts after the last separator of either kind.
+        const size_t posSep = entryPath.find_last_of("/\\");
+        const size_t start = (posSep == std::string_view::npos) ? 0 : posSep + 1;
+        entry.m_Name = (posDot == std::string_view::npos || posDot < start)
+            ? entryPath.substr(start) : entryPath.substr(start, posDot - start);
+
+        m_Entries.push_back(entry);
     }
+
+    // One sort instead of a map per extension and path; the index tie-break
+    // keeps files within a path in input order.
+    std::sort(m_Entries.begin(), m_Entries.end(), [](const TreeEntry_t& a, const TreeEntry_t& b) {
+        if (const int cmp = a.m_Ext.compare(b.m_Ext))
+            return cmp < 0;
+        if (const int cmp = a.m_Path.compare(b.m_Path))
+            return cmp < 0;
+        return a.m_iBlock < b.m_iBlock;
+    });
 }
 
 int VPKDir_t::CTreeBuilder::WriteTree(std::ofstream &ofs) const
 {
+    // Build the whole tree in memory and write it in one go.
+    std::vector<char> out;
+    out.reserve(m_Entries.size() * 64);
+
+    auto writeString = [&out](std::string_view str) {
+        out.insert(out.end(), str.begin(), str.end());
+        out.push_back('\0');
+    };
+    auto writeValue = [&out](const auto& value) {
+        const char* p = reinterpret_cast<const char*>(&value);
+        out.insert(out.end(), p, p + sizeof(value));
+    };
+
     int descriptorCount = 0;
-    // For each extension:
-    for (const auto &extPair : m_FileTree)
+    for (size_t i = 0; i < m_Entries.size(); )
     {
         // Write the extension string (including its terminating zero)
-        ofs.write(extPair.first.c_str(), extPair.first.size() + 1);
+        const std::string_view ext = m_Entries[i].m_Ext;
+        writeString(ext);
         // For each directory (path) within that extension:
-        for (const auto &pathPair : extPair.second)
+        while (i < m_Entries.size() && m_Entries[i].m_Ext == ext)
         {
             // Write the directory string with terminating zero
-            ofs.write(pathPair.first.c_str(), pathPair.first.size() + 1);
+            const std::string_view path = m_Entries[i].m_Path;
+            writeString(path);
             // For each file in that directory:
-            for (const auto &block : pathPair.second)
+            for (; i < m_Entries.size() && m_Entries[i].m_Ext == ext && m_Entries[i].m_Path == path; i++)
             {
-                // Compute the “filename” (the unqualified filename without extension)
-                std::string filename;
-                {
-                    size_t posSlash = block.m_EntryPath.find_last_of("/\\");
-                    size_t posDot   = block.m_EntryPath.rfind('.');
-                    if (posSlash == std::string::npos) {
-                        filename = (posDot == std::string::npos)
-                            ? block.m_EntryPath : block.m_EntryPath.substr(0, posDot);
-                    }
-                    else {
-                        size_t start = posSlash + 1;
-                        if (posDot == std::string::npos || posDot < start)
-                            filename = block.m_EntryPath.substr(start);
-                        else
-                            filename = block.m_EntryPath.substr(start, posDot - start);
-                    }
-                }
-                // Write the filename (with a terminating null)
-                ofs.write(filename.c_str(), filename.size() + 1);
+                const VPKEntryBlock_t& block = (*m_pEntryBlocks)[m_Entries[i].m_iBlock];
+                writeString(m_Entries[i].m_Name);
 
                 // Write the file header information: file CRC (uint32_t), preload size (uint16_t) and pack file index (uint16_t)
-                ofs.write(reinterpret_cast<const char*>(&block.m_nFileCRC), sizeof(block.m_nFileCRC));
-                ofs.write(reinterpret_cast<const char*>(&block.m_iPreloadSize), sizeof(block.m_iPreloadSize));
-                ofs.write(reinterpret_cast<const char*>(&block.m_iPackFileIndex), sizeof(block.m_iPackFileIndex));
+                writeValue(block.m_nFileCRC);
+                writeValue(block.m_iPreloadSize);
+                writeValue(block.m_iPackFileIndex);
 
                 // For each chunk descriptor, write its fields followed by a 16‐bit marker.
-                for (size_t i = 0; i < block.m_Fragments.size(); i++)
+                for (size_t f = 0; f < block.m_Fragments.size(); f++)
                 {
-                    const VPKChunkDescriptor_t &d = block.m_Fragments[i];
-                    ofs.write(reinterpret_cast<const char*>(&d.m_nLoadFlags), sizeof(d.m_nLoadFlags));
-                    ofs.write(reinterpret_cast<const char*>(&d.m_nTextureFlags), sizeof(d.m_nTextureFlags));
-                    ofs.write(reinterpret_cast<const char*>(&d.m_nPackFileOffset), sizeof(d.m_nPackFileOffset));
-                    ofs.write(reinterpret_cast<const char*>(&d.m_nCompressedSize), sizeof(d.m_nCompressedSize));
-                    ofs.write(reinterpret_cast<const char*>(&d.m_nUncompressedSize), sizeof(d.m_nUncompressedSize));
-                    
+                    const VPKChunkDescriptor_t &d = block.m_Fragments[f];
+                    writeValue(d.m_nLoadFlags);
+                    writeValue(d.m_nTextureFlags);
+                    writeValue(d.m_nPackFileOffset);
+                    writeValue(d.m_nCompressedSize);
+                    writeValue(d.m_nUncompressedSize);
+
                     // Write a 16‐bit marker: use PACKFILEINDEX_SEP (0x0000) if more chunks follow,
                     // or PACKFILEINDEX_END (0xFFFF) for the last chunk.
-                    uint16_t marker = (i < block.m_Fragments.size() - 1)
+                    const uint16_t marker = (f < block.m_Fragments.size() - 1)
                         ? PACKFILEINDEX_SEP : PACKFILEINDEX_END;
-                    ofs.write(reinterpret_cast<const char*>(&marker), sizeof(marker));
+                    writeValue(marker);
                     descriptorCount++;
                 }
             }
             // After finishing all files in this path, write a one‐byte terminator.
-            uint8_t term = 0;
-            ofs.write(reinterpret_cast<const char*>(&term), sizeof(term));
+            out.push_back('\0');
         }
         // After finishing all paths for this extension, write a one‐byte terminator.
-        uint8_t term = 0;
-        ofs.write(reinterpret_cast<const char*>(&term), sizeof(term));
+        out.push_back('\0');
     }
     // Finally, write one extra zero byte after all extensions.
-    uint8_t term = 0;
-    ofs.write(reinterpret_cast<const char*>(&term), sizeof(term));
-    
+    out.push_back('\0');
+
+    ofs.write(out.data(), std::streamsize(out.size()));
     return descriptorCount;
 }
 
@@ -1106,6 +2665,19 @@ VPKPair_t::VPKPair_t(const char* pLocale,
 // ------------------------------------------------------------------------
 //  Utility: get base name from a directory file path
 // ------------------------------------------------------------------------
+std::string PackedStore_GetExtension(const std::string& entryPath)
+{
+    // A dot in a directory name (either separator) doesn't start an extension.
+    const size_t dot = entryPath.rfind('.');
+    if (dot == std::string::npos || entryPath.find_first_of("/\\", dot) != std::string::npos)
+        return std::string();
+
+    std::string ext = entryPath.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return char(std::tolower(c)); });
+    return ext;
+}
+
 std::string PackedStore_GetDirBaseName(const std::string& dirFileName)
 {
     // e.g. "englishserver_mp_rr_box"
@@ -1145,6 +2717,9 @@ bool CPackedStoreBuilder::BuildMultiLangManifest(
             allFilePaths.insert(blk.m_EntryPath);
     }
 
+    auto itEnglish = languageDirs.find("english");
+    const VPKDir_t* pEnglishDir = (itEnglish != languageDirs.end()) ? &itEnglish->second : nullptr;
+
     // 3) For each language, build a sub-object, then fill sub-children
     for (const auto& langPair : languageDirs)
     {
@@ -1162,40 +2737,13 @@ bool CPackedStoreBuilder::BuildMultiLangManifest(
         }
         tyti::vdf::object* langObj = itLang->second.get();
 
-        // Build a quick lookup for this language
-        std::unordered_map<std::string, const VPKEntryBlock_t*> thisLangMap;
-        for (const auto& blk : vpkDir.m_EntryBlocks)
-        {
-            thisLangMap[blk.m_EntryPath] = &blk;
-        }
-
         // For each possible file path, create a child with appropriate attributes
         for (const auto& filePath : allFilePaths)
         {
-            const VPKEntryBlock_t* blockPtr = nullptr;
-
-            // Language-specific or fallback to English
-            auto itBlock = thisLangMap.find(filePath);
-            if (itBlock != thisLangMap.end())
-            {
-                blockPtr = itBlock->second;
-            }
-            else
-            {
-                // fallback to english (if present)
-                auto itEnglish = languageDirs.find("english");
-                if (itEnglish != languageDirs.end())
-                {
-                    for (auto &engBlk : itEnglish->second.m_EntryBlocks)
-                    {
-                        if (engBlk.m_EntryPath == filePath)
-                        {
-                            blockPtr = &engBlk;
-                            break;
-                        }
-                    }
-                }
-            }
+            // Language-specific or fallback to English (if present)
+            const VPKEntryBlock_t* blockPtr = vpkDir.FindEntry(filePath);
+            if (!blockPtr && pEnglishDir)
+                blockPtr = pEnglishDir->FindEntry(filePath);
 
             if (!blockPtr) continue; // not found in current or english => skip
 
@@ -14,18 +14,36 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <set>
 #include <map>
 #include <list>
 #include <regex>
 #include <unordered_map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <condition_variable>
 #include "lzham.h"
 
 // --- ZSTD support ---
 #include <zstd.h>
+#include "zstddict.h"
+#include "packstats.h"
 // --------------------
 
+class CChunkCache;
+class CCompressionPolicy;
+class ThreadPool;
+class CReadAhead;
+class CAsyncFileWriter;
+struct UnpackOutputFile_t;
+
 /** Maximum # of helper threads, if not provided by LZHAM */
 #ifndef LZHAM_MAX_HELPER_THREADS
 #define LZHAM_MAX_HELPER_THREADS 128
@@ -122,6 +140,12 @@ struct VPKEntryBlock_t
                     uint16_t iPreloadSize, uint16_t iPackFileIndex,
                     uint32_t nLoadFlags, uint16_t nTextureFlags,
                     const char* pEntryPath);
+    // Layout-only constructor (used when streaming): splits nLen bytes into
+    // preload data and fragments; the caller sets m_nFileCRC.
+    VPKEntryBlock_t(uint64_t nLen, const uint8_t* pPreloadData,
+                    uint16_t iPreloadSize, uint16_t iPackFileIndex,
+                    uint32_t nLoadFlags, uint16_t nTextureFlags,
+                    const char* pEntryPath);
 
     // Copy constructor
     VPKEntryBlock_t(const VPKEntryBlock_t& other) = default;
@@ -160,12 +184,20 @@ struct VPKDir_t
     std::set<uint16_t>            m_PakFileIndices;
     bool                          m_bInitFailed;
 
+    // (XXH64 of entry path, index into m_EntryBlocks), sorted for binary search
+    std::vector<std::pair<uint64_t, uint32_t>> m_EntryIndex;
+
     VPKDir_t();
     VPKDir_t(const std::string& dirFilePath, bool bSanitize=false);
 
     bool Failed() const { return m_bInitFailed; }
     void Init(const std::string& dirFilePath);
 
+    // Rebuild m_EntryIndex from m_EntryBlocks (done by Init)
+    void BuildEntryIndex();
+    // Look up an entry by its full path, or nullptr if the directory doesn't contain it
+    const VPKEntryBlock_t* FindEntry(const std::string& entryPath) const;
+
     // Build the final directory file given a set of EntryBlocks
     void BuildDirectoryFile(const std::string& directoryPath,
                             const std::vector<VPKEntryBlock_t>& entryBlocks);
@@ -173,24 +205,247 @@ struct VPKDir_t
     // We partially replicate Valve’s naming: if we have "xxx_dir.vpk",
     // we replace "pak000_dir" with "pak000_00x" to get chunk file names, etc.
     std::string GetPackFileNameForIndex(uint16_t iPackFileIndex) const;
+    // ZSTD dictionaries stored next to the pack files ("pak000_dict").
+    std::string GetDictFileName() const;
     std::string StripLocalePrefix(const std::string& directoryPath) const;
 
     void WriteHeader(std::ofstream& ofs); // Not strictly needed in this example.
 
-    // Helper sub-structure to store the "directory tree"
+    // Helper sub-structure to store the "directory tree": the entry blocks
+    // grouped by extension, then by path. It only refers to the blocks, which
+    // must outlive it.
     struct CTreeBuilder
     {
-        // For each extension => for each path => list of blocks
-        using PathContainer_t = std::map<std::string, std::list<VPKEntryBlock_t>>;
-        using TypeContainer_t = std::map<std::string, PathContainer_t>;
-
-        TypeContainer_t m_FileTree;
+        struct TreeEntry_t
+        {
+            std::string_view m_Ext;    // all views are into the block's m_EntryPath
+            std::string_view m_Path;   // " " for files in the root
+            std::string_view m_Name;   // file name without extension
+            uint32_t         m_iBlock; // index into m_pEntryBlocks
+        };
+
+        const std::vector<VPKEntryBlock_t>* m_pEntryBlocks = nullptr;
+        // Sorted by extension, then path; same-path entries keep their order.
+        std::vector<TreeEntry_t> m_Entries;
 
         void BuildTree(const std::vector<VPKEntryBlock_t>& entryBlocks);
         int  WriteTree(std::ofstream& ofs) const;
     };
 };
 
+/**
+ *  Read-only memory mapping of a pack (.vpk) file. Opened once per pack index
+ *  and shared by all extraction workers, which read fragments straight from it.
+ */
+class CPackFileView
+{
+public:
+    CPackFileView()
+    : m_pData(nullptr), m_nSize(0), m_bOpen(false)
+    {}
+    ~CPackFileView() { Close(); }
+
+    CPackFileView(const CPackFileView&) = delete;
+    CPackFileView& operator=(const CPackFileView&) = delete;
+
+    bool Open(const std::string& filePath);
+    void Close();
+
+    bool     IsOpen() const { return m_bOpen; }
+    uint64_t Size()   const { return m_nSize; }
+
+    // Returns a pointer to [nOffset, nOffset + nLen), or nullptr if out of bounds.
+    const uint8_t* GetRange(uint64_t nOffset, uint64_t nLen) const
+    {
+        if (nOffset > m_nSize || nLen > m_nSize - nOffset)
+            return nullptr;
+        return m_pData + nOffset;
+    }
+
+private:
+    const uint8_t* m_pData;
+    uint64_t       m_nSize;
+    bool           m_bOpen;
+};
+
+/**
+ *  Sequential reader for input files being packed. Hands out the file a piece
+ *  of at most VPK_ENTRY_MAX_LEN at a time (the preload data, then each
+ *  fragment) and accumulates the file's CRC32 on the way, so a worker never
+ *  holds more than one fragment of a file in memory however large it is.
+ *  With io_uring (see asyncio.h) the next piece is read while the caller works
+ *  on this one.
+ */
+class CFragmentReader
+{
+public:
+    CFragmentReader() = default;
+    ~CFragmentReader() { Close(); }
+
+    CFragmentReader(const CFragmentReader&) = delete;
+    CFragmentReader& operator=(const CFragmentReader&) = delete;
+
+    bool Open(const std::string& filePath);
+    void Close();
+
+    uint64_t GetSize() const { return m_nSize; }
+    uint64_t Tell()    const { return m_nPos; }
+
+    // Continue at nOffset. Seeking back re-reads unless the range is still
+    // buffered, which it is for an entry's only fragment.
+    void Seek(uint64_t nOffset) { m_nPos = nOffset; }
+
+    // The next nLen (<= VPK_ENTRY_MAX_LEN) bytes, valid until the next Read().
+    // A file that got shorter reads as zeros, with a warning.
+    const uint8_t* Read(size_t nLen);
+
+    // CRC32 of the bytes read so far; re-read bytes only count once. Reading
+    // from the start without gaps gives the CRC of the whole file.
+    uint32_t GetCRC() const { return m_nCRC; }
+
+private:
+    std::string          m_FilePath;
+    int                  m_nFd = -1;
+    uint64_t             m_nSize = 0;
+    uint64_t             m_nPos = 0;
+    uint64_t             m_nCRCEnd = 0;       // m_nCRC covers [0, m_nCRCEnd)
+    uint32_t             m_nCRC = 0;
+    uint64_t             m_nBufferOffset = 0; // file range held in m_pBuffer
+    size_t               m_nBufferLen = 0;
+    const uint8_t*       m_pBuffer = nullptr;  // m_Buffer, or m_pReadAhead's
+    std::vector<uint8_t> m_Buffer;
+    CReadAhead*          m_pReadAhead = nullptr;
+};
+
+/**
+ *  Concurrent dedup table: chunk content hash => descriptor of the copy that
+ *  was written. Spread over independently locked shards so workers only
+ *  contend when two of them land on the same shard at the same time.
+ */
+class CChunkDedupTable
+{
+public:
+    // Look up a chunk; copies its descriptor into outDesc if present.
+    bool Find(uint64_t nHash, VPKChunkDescriptor_t& outDesc) const;
+
+    // Insert-if-absent. If nHash is already known, desc receives the stored
+    // descriptor and true is returned. Otherwise fnAssign(desc) runs under the
+    // shard lock (to reserve the chunk's pack offset), desc is recorded and
+    // false is returned; the caller then owns writing the chunk data.
+    template <typename Fn>
+    bool FindOrInsert(uint64_t nHash, VPKChunkDescriptor_t& desc, Fn&& fnAssign)
+    {
+        Shard_t& shard = GetShard(nHash);
+        std::unique_lock<std::mutex> lock = PackStats().Lock(shard.m_Mutex, CPackStats::kLockDedup);
+
+        auto it = shard.m_Map.find(nHash);
+        if (it != shard.m_Map.end())
+        {
+            desc = it->second;
+            return true;
+        }
+
+        fnAssign(desc);
+        shard.m_Map.emplace(nHash, desc);
+        return false;
+    }
+
+    void Clear();
+
+private:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    struct Shard_t
+    {
+        mutable std::mutex                                 m_Mutex;
+        std::unordered_map<uint64_t, VPKChunkDescriptor_t> m_Map;
+    };
+
+    // The low bits feed the per-shard bucket index, so pick shards by the high ones.
+    Shard_t&       GetShard(uint64_t nHash)       { return m_Shards[nHash >> 58]; }
+    const Shard_t& GetShard(uint64_t nHash) const { return m_Shards[nHash >> 58]; }
+
+    std::array<Shard_t, NUM_SHARDS> m_Shards;
+};
+
+/**
+ *  Set of pack (.vpk) archives written in parallel. Archives are numbered from
+ *  a first pack file index; once the current one would grow past the size cap
+ *  a new one is started. Each archive has its own pwrite() offset counter,
+ *  writer thread and chunk dedup table (chunks are only shared within an
+ *  archive, since an entry's fragments must all live in the same one).
+ */
+class CPackArchiveSet
+{
+public:
+    using PathFn_t = std::function<std::string(uint16_t)>;
+
+    // nMaxArchiveSize == 0 disables splitting.
+    CPackArchiveSet(PathFn_t fnArchivePath, uint16_t iFirstIndex, uint64_t nMaxArchiveSize);
+    ~CPackArchiveSet();
+
+    CPackArchiveSet(const CPackArchiveSet&) = delete;
+    CPackArchiveSet& operator=(const CPackArchiveSet&) = delete;
+
+    // Create the first archive now, rather than on the first BeginEntry().
+    bool Open();
+    // Open an archive of an earlier build read-only, so entries can share
+    // its chunks (seed them through GetChunkTable). True if already open.
+    bool AddExisting(uint16_t iIndex);
+    // Flush all writers and close every archive; false if any write failed.
+    bool Close();
+
+    // Pick the archive for an entry of at most nMaxBytes, creating the first
+    // archive or rolling over to a new one if the current one would exceed
+    // the cap. Returns its index.
+    uint16_t BeginEntry(uint64_t nMaxBytes);
+
+    // Reserve nBytes at the end of an archive; returns the offset.
+    uint64_t Allocate(uint16_t iIndex, uint64_t nBytes);
+    // Queue data for the archive's writer thread; waits while the queued
+    // data would overrun InFlightBudget().
+    void Write(uint16_t iIndex, uint64_t nOffset, std::vector<uint8_t> data);
+    // Read back bytes already queued for an archive (waits for its writer).
+    bool Read(uint16_t iIndex, uint64_t nOffset, uint8_t* pDst, size_t nLen);
+
+    CChunkDedupTable& GetChunkTable(uint16_t iIndex);
+    // Find an archive that already stores every one of these chunks.
+    bool FindArchiveHolding(const std::vector<uint64_t>& chunkHashes, uint16_t& outIndex) const;
+
+    size_t   GetArchiveCount() const;
+    uint64_t GetTotalSize() const;
+
+private:
+    struct Archive_t
+    {
+        std::string           m_Path;
+        int                   m_nFd     = -1;
+        std::atomic<uint64_t> m_nOffset { 0 };
+        CChunkDedupTable      m_ChunkTable;
+
+        std::thread             m_Writer;
+        std::mutex              m_QueueMutex;
+        std::condition_variable m_QueueCV;
+        std::condition_variable m_DrainedCV;
+        std::deque<std::pair<uint64_t, std::vector<uint8_t>>> m_Queue;
+        bool                    m_bBusy = false;
+        bool                    m_bStop = false;
+    };
+
+    bool       OpenArchive(uint16_t iIndex);
+    Archive_t* GetArchive(uint16_t iIndex) const;
+    void       WriterThread(Archive_t* pArchive);
+
+    PathFn_t m_fnArchivePath;
+    uint16_t m_iFirstIndex;
+    uint64_t m_nMaxArchiveSize;
+
+    mutable std::mutex                      m_Mutex;
+    std::deque<std::unique_ptr<Archive_t>>  m_Archives;
+    std::map<uint16_t, std::unique_ptr<Archive_t>> m_Existing; // read-only, see AddExisting()
+    std::atomic<bool>                       m_bWriteFailed;
+};
+
 /** A small struct storing the directory name + pack name for building a single-level VPK. */
 struct VPKPair_t
 {
@@ -210,6 +465,39 @@ enum ECompressionMethod
     kCompressionLZHAM,
     kCompressionZSTD
 };
+
+/** ZSTD settings; zero leaves a parameter at the level's default. */
+struct VPKZstdParams_t
+{
+    int m_nLevel     = 6;
+    int m_nWindowLog = 0;
+    int m_nStrategy  = 0; // ZSTD_strategy (1 = fast ... 9 = btultra2)
+    int m_nWorkers   = 0; // zstd's own helper threads per fragment
+
+    bool operator==(const VPKZstdParams_t& other) const
+    {
+        return m_nLevel == other.m_nLevel && m_nWindowLog == other.m_nWindowLog &&
+               m_nStrategy == other.m_nStrategy && m_nWorkers == other.m_nWorkers;
+    }
+    bool operator!=(const VPKZstdParams_t& other) const { return !(*this == other); }
+};
+
+/** Fragments the compressibility probe had stored raw, for one extension. */
+struct VPKProbeSkips_t
+{
+    uint64_t m_nFragments = 0;
+    uint64_t m_nBytes     = 0;
+};
+
+/** How the fragments of one entry are compressed. */
+struct VPKCodec_t
+{
+    ECompressionMethod m_eMethod     = kCompressionLZHAM; // kCompressionNone: store as-is
+    int                m_nZstdLevel  = 6;
+    int                m_nLzhamLevel = LZHAM_COMP_LEVEL_DEFAULT;
+    uint32_t           m_nDictId     = 0;     // ZSTD dictionary from m_ZstdDicts, 0: none
+    bool               m_bAuto       = false; // compress with both, keep the better tradeoff
+};
 // --------------------
 
 /** The main class that packs/unpacks from a VPK. */
@@ -218,14 +506,91 @@ class CPackedStoreBuilder
 public:
     // --- ZSTD support ---
     CPackedStoreBuilder()
-    : m_eCompressionMethod(kCompressionLZHAM) // default to LZHAM
-    {}
+    : m_nWorkerThreads(-1)
+    , m_pChunkCache(nullptr)
+    , m_nMaxArchiveSize(0)
+    , m_pPolicy(nullptr)
+    , m_bProbeCompressibility(true)
+    , m_eCompressionMethod(kCompressionLZHAM) // default to LZHAM
+    {
+        InitLzDecoder();
+    }
     // --------------------
 
-    void InitLzEncoder(int maxHelperThreads, const char* compressionLevel);
-    void InitLzDecoder();
-
-    // Deduplicate a chunk: if we’ve seen identical data (SHA1) before,
+    // Every pool worker keeps its own LZHAM states built from m_Encoder, so
+    // callers that compress on a pool pass 0 helper threads; anything else
+    // multiplies the worker count by the helper count. False (reported) if
+    // the ZSTD level in compressionLevel isn't a valid one.
+    bool InitLzEncoder(int maxHelperThreads, const char* compressionLevel);
+
+    // Validate and apply ZSTD settings; reports the first bad one.
+    bool SetZstdParams(const VPKZstdParams_t& params);
+
+    // Compress a single fragment with the configured method, or with codec.
+    // Returns false if the fragment should be stored uncompressed.
+    bool CompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                       uint8_t* pDst, size_t& nDstLen) const;
+    bool CompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                       uint8_t* pDst, size_t& nDstLen, const VPKCodec_t& codec) const;
+
+    // CompressChunk() through m_pChunkCache (if attached), keyed by the
+    // fragment's raw hash and GetCodecKey(). On a cache miss, fragments of
+    // entryPath that IsWorthCompressing() turns down aren't compressed.
+    bool CompressChunkCached(const std::string& entryPath, uint64_t nRawHash, const uint8_t* pSrc, size_t nSrcLen,
+                             uint8_t* pDst, size_t& nDstLen) const;
+    bool CompressChunkCached(const std::string& entryPath, uint64_t nRawHash, const uint8_t* pSrc, size_t nSrcLen,
+                             uint8_t* pDst, size_t& nDstLen, const VPKCodec_t& codec) const;
+
+    // Identifies a compressor and its settings.
+    uint64_t GetCodecKey() const;
+    uint64_t GetCodecKey(const VPKCodec_t& codec) const;
+
+    // Cheap check run before compressing a fragment of entryPath (after the
+    // dedup and chunk cache lookups, so only for fragments that would really
+    // be compressed): byte entropy
+    // of a few 4 KiB samples, then a ZSTD level 1 pass over them if that's
+    // high. False means store it raw; those are tallied per extension.
+    bool IsWorthCompressing(const std::string& entryPath, const uint8_t* pSrc, size_t nSrcLen) const;
+    std::map<std::string, VPKProbeSkips_t> GetProbeSkips() const;
+
+    // The codec from the command line, and the one for an entry after
+    // m_pPolicy and m_ZstdDicts have had their say.
+    VPKCodec_t GetDefaultCodec() const;
+    VPKCodec_t GetCodecForEntry(const std::string& entryPath, uint64_t nSize) const;
+
+    // m_nWorkerThreads, or all cores but one if it isn't set.
+    unsigned int GetWorkerCount() const;
+
+    // Store m_ZstdDicts next to the pack files of dirPath (if there are any).
+    bool SaveZstdDicts(const std::string& dirPath) const;
+    // Load the dictionaries stored next to a directory's pack files, if any.
+    void LoadZstdDicts(const VPKDir_t& vpkDir);
+
+    // Decompress a single fragment (ZSTD if it carries R1D_marker, LZHAM otherwise).
+    // pDst must hold VPK_ENTRY_MAX_LEN bytes.
+    bool DecompressChunk(const uint8_t* pSrc, size_t nSrcLen,
+                         uint8_t* pDst, size_t& nDstLen) const;
+
+    // Queue one task per fragment of an entry on pool; the first one to run
+    // creates the output file at its final size and writes the preload data.
+    // Blocks while too many entries are in progress. With pWriter, the
+    // fragments are written by it instead of by the tasks.
+    bool UnpackEntryBlock(const VPKEntryBlock_t& block,
+                          const CPackFileView& packView,
+                          const std::string& outFilePath,
+                          ThreadPool& pool,
+                          CAsyncFileWriter* pWriter) const;
+
+    // Write one fragment from a mapped pack file at nOutOffset of pOutput
+    // (creating it if needed), or hand it to pWriter if there is one.
+    bool UnpackFragment(const VPKEntryBlock_t& block,
+                        const VPKChunkDescriptor_t& frag,
+                        const CPackFileView& packView,
+                        const std::shared_ptr<UnpackOutputFile_t>& pOutput,
+                        uint64_t nOutOffset,
+                        CAsyncFileWriter* pWriter) const;
+
+    // Deduplicate a chunk: if we’ve seen identical data before,
     // point descriptor to existing chunk
     bool Deduplicate(const uint8_t* pEntryBuffer,
                      VPKChunkDescriptor_t& descriptor,
@@ -236,6 +601,23 @@ public:
                    const char* workspaceName,
                    const char* buildPath);
 
+    // Update an existing pack: unchanged entries keep pointing at their old
+    // pack files, new or changed ones go into a new pak000_XXX, and only the
+    // directory file is rewritten. Falls back to PackStore without a directory.
+    void PatchStore(const VPKPair_t& vpkPair,
+                    const char* workspaceName,
+                    const char* buildPath);
+
+    // Read, compress, dedup and write buildList into pack files for the given
+    // directory, starting at firstPackFileIndex and splitting at
+    // m_nMaxArchiveSize. The resulting entries are appended to entryBlocks.
+    // keptChunkHashes holds the raw fragment hashes of the entries already in
+    // entryBlocks (kept from an earlier build); their chunks are shared too.
+    bool WritePackFile(const std::vector<VPKKeyValues_t>& buildList,
+                       uint16_t firstPackFileIndex, const std::string& dirPath,
+                       std::vector<VPKEntryBlock_t>& entryBlocks,
+                       const std::vector<std::vector<uint64_t>>& keptChunkHashes = {});
+
     // Unpack from an existing directory file
     void UnpackStore(const VPKDir_t& vpkDir, const char* workspaceName = "");
 
@@ -253,22 +635,53 @@ public:
         const std::string& outFilePath
     );
 
+private:
+    // Set up m_DecoderParams, once from the constructor; decoder states are
+    // created per thread from them.
+    void InitLzDecoder();
+
 public:
     lzham_compress_params   m_Encoder;
-    lzham_decompress_state_ptr m_Decoder;
+    lzham_decompress_params m_DecoderParams;
+
+    // Number of compression workers (<= 0: all cores but one); auto mode
+    // runs as many ZSTD candidates beside them
+    int m_nWorkerThreads;
+
+    // Persistent compressed-fragment cache, or nullptr (not owned)
+    CChunkCache* m_pChunkCache;
+
+    // Size cap per pack archive in bytes (0: everything in one archive)
+    uint64_t m_nMaxArchiveSize;
+
+    // Per-file codec rules, or nullptr to use one codec for everything (not owned)
+    const CCompressionPolicy* m_pPolicy;
+
+    // Store fragments raw when IsWorthCompressing() says so (off: always compress)
+    bool m_bProbeCompressibility;
+    mutable std::mutex m_ProbeMutex;
+    mutable std::map<std::string, VPKProbeSkips_t> m_ProbeSkips; // by extension
 
-    // Dedup map: from SHA1 hash => descriptor
+    // Dedup table: from chunk hash => descriptor
     // so multiple identical chunks get a single copy
-    std::unordered_map<std::string, VPKChunkDescriptor_t> m_ChunkHashMap;
+    CChunkDedupTable m_ChunkTable;
 
     // --- ZSTD support ---
     ECompressionMethod m_eCompressionMethod;
+    VPKZstdParams_t    m_ZstdParams;
+    CZstdDictSet       m_ZstdDicts;
     inline bool IsUsingZSTD() const { return m_eCompressionMethod == kCompressionZSTD; }
     // --------------------
 };
 
 // Utility
+// Lowercase extension of an entry path, without the dot ("" if none).
+std::string PackedStore_GetExtension(const std::string& entryPath);
 std::string PackedStore_GetDirBaseName(const std::string& dirFileName);
+// Lays out the entry block of the input file open in reader, reading only
+// its preload data; the caller reads the fragments and then sets the CRC.
+VPKEntryBlock_t PackedStore_BeginEntryBlock(CFragmentReader& reader, const VPKKeyValues_t& kv,
+                                            uint16_t iPackFileIndex);
 
 // New helper struct for multi-language manifest
 struct LangKVPair_t
@@ -288,6 +701,7 @@ static constexpr uint64_t R1D_marker    = 0x5244315F5F4D4150ULL;
 
 // 32-bit marker if needed:
 static constexpr uint32_t R1D_marker_32 = 0x52443144; // 'R1D'
-std::string compute_sha1_hex(const uint8_t* data, size_t len);
+uint32_t compute_crc32(const uint8_t* data, size_t len);
+uint64_t compute_chunk_hash(const uint8_t* data, size_t len);
 
 #endif // PACKEDSTORE_H
@@ -0,0 +1,187 @@
+/**
+ * packstats.cpp
+ *
+ * Implementation of the pack/unpack stage statistics (see packstats.h).
+ */
+
+#include "packstats.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+static const char* const s_TimerNames[CPackStats::kNumTimers] = {
+    "read", "compress_lzham", "compress_zstd", "compress_auto",
+    "decompress_lzham", "decompress_zstd", "write"
+};
+
+static const char* const s_LockNames[CPackStats::kNumLocks] = {
+    "dedup", "archives", "jobs", "results", "budget"
+};
+
+static double ToSeconds(uint64_t nNanoseconds)
+{
+    return double(nNanoseconds) / 1e9;
+}
+
+static double ToMiB(uint64_t nBytes)
+{
+    return double(nBytes) / (1024.0 * 1024.0);
+}
+
+CPackStats& PackStats()
+{
+    static CPackStats stats;
+    return stats;
+}
+
+// ------------------------------------------------------------------------
+//  CPackStats
+// ------------------------------------------------------------------------
+CPackStats::CScopedTimer::~CScopedTimer()
+{
+    PackStats().AddTime(m_eTimer, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock_t::now() - m_Start).count()), m_nBytes);
+}
+
+CPackStats::CPackStats()
+: m_Start(Clock_t::now())
+{
+}
+
+void CPackStats::AddTime(ETimer eTimer, uint64_t nNanoseconds, uint64_t nBytes)
+{
+    Timer_t& timer = m_Timers[eTimer];
+    timer.m_nNanoseconds.fetch_add(nNanoseconds, std::memory_order_relaxed);
+    timer.m_nBytes.fetch_add(nBytes, std::memory_order_relaxed);
+    timer.m_nCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CPackStats::AddFragment(bool bCompressed)
+{
+    (bCompressed ? m_nFragmentsCompressed : m_nFragmentsStored).fetch_add(1, std::memory_order_relaxed);
+}
+
+void CPackStats::AddDedup(bool bHit)
+{
+    (bHit ? m_nDedupHits : m_nDedupMisses).fetch_add(1, std::memory_order_relaxed);
+}
+
+void CPackStats::AddLockWait(ELock eLock, uint64_t nNanoseconds)
+{
+    m_LockWaits[eLock].m_nNanoseconds.fetch_add(nNanoseconds, std::memory_order_relaxed);
+    m_LockWaits[eLock].m_nCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CPackStats::AcquireBuffer(uint64_t nBytes)
+{
+    const uint64_t nNow = m_nBuffered.fetch_add(nBytes, std::memory_order_relaxed) + nBytes;
+    uint64_t nPeak = m_nPeakBuffered.load(std::memory_order_relaxed);
+    while (nNow > nPeak && !m_nPeakBuffered.compare_exchange_weak(nPeak, nNow, std::memory_order_relaxed))
+    {
+    }
+}
+
+void CPackStats::ReleaseBuffer(uint64_t nBytes)
+{
+    m_nBuffered.fetch_sub(nBytes, std::memory_order_relaxed);
+}
+
+void CPackStats::Print() const
+{
+    const double wallSeconds = std::chrono::duration<double>(Clock_t::now() - m_Start).count();
+
+    std::cout << "[ReVPK] Stage statistics (" << std::fixed << std::setprecision(2)
+              << wallSeconds << " s wall, stage times summed over threads):\n";
+
+    for (int i = 0; i < kNumTimers; i++)
+    {
+        const Timer_t& timer = m_Timers[i];
+        const uint64_t nCount = timer.m_nCount.load();
+        if (!nCount)
+            continue;
+
+        const double seconds = ToSeconds(timer.m_nNanoseconds.load());
+        const double mib = ToMiB(timer.m_nBytes.load());
+        std::cout << "  " << std::left << std::setw(18) << s_TimerNames[i] << std::right
+                  << std::setw(10) << mib << " MiB" << std::setw(10) << seconds << " s"
+                  << std::setw(10) << nCount << " ops";
+        if (seconds > 0.0)
+            std::cout << std::setw(10) << (mib / seconds) << " MiB/s";
+        std::cout << "\n";
+    }
+
+    const uint64_t nCompressed = m_nFragmentsCompressed.load();
+    const uint64_t nStored = m_nFragmentsStored.load();
+    if (nCompressed || nStored)
+        std::cout << "  fragments         " << nCompressed << " compressed, " << nStored << " stored as-is\n";
+
+    const uint64_t nHits = m_nDedupHits.load();
+    const uint64_t nMisses = m_nDedupMisses.load();
+    if (nHits || nMisses)
+        std::cout << "  dedup             " << nHits << " hits, " << nMisses << " misses\n";
+
+    for (int i = 0; i < kNumLocks; i++)
+    {
+        const uint64_t nCount = m_LockWaits[i].m_nCount.load();
+        if (nCount)
+        {
+            std::cout << "  lock " << std::left << std::setw(13) << s_LockNames[i] << std::right
+                      << ToSeconds(m_LockWaits[i].m_nNanoseconds.load()) << " s waited in "
+                      << nCount << " contended locks\n";
+        }
+    }
+
+    if (m_nPeakBuffered.load())
+        std::cout << "  peak buffered     " << ToMiB(m_nPeakBuffered.load()) << " MiB\n";
+
+    std::cout << std::defaultfloat;
+}
+
+bool CPackStats::WriteJson(const std::string& filePath) const
+{
+    std::ofstream ofs(filePath);
+    if (!ofs.is_open())
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot write statistics to " << filePath << "\n";
+        return false;
+    }
+
+    ofs << "{\n  \"wall_seconds\": "
+        << std::chrono::duration<double>(Clock_t::now() - m_Start).count() << ",\n";
+
+    ofs << "  \"stages\": {\n";
+    for (int i = 0; i < kNumTimers; i++)
+    {
+        const Timer_t& timer = m_Timers[i];
+        ofs << "    \"" << s_TimerNames[i] << "\": { \"bytes\": " << timer.m_nBytes.load()
+            << ", \"seconds\": " << ToSeconds(timer.m_nNanoseconds.load())
+            << ", \"count\": " << timer.m_nCount.load() << " }"
+            << (i + 1 < kNumTimers ? ",\n" : "\n");
+    }
+    ofs << "  },\n";
+
+    ofs << "  \"locks\": {\n";
+    for (int i = 0; i < kNumLocks; i++)
+    {
+        ofs << "    \"" << s_LockNames[i] << "\": { \"wait_seconds\": "
+            << ToSeconds(m_LockWaits[i].m_nNanoseconds.load())
+            << ", \"contended\": " << m_LockWaits[i].m_nCount.load() << " }"
+            << (i + 1 < kNumLocks ? ",\n" : "\n");
+    }
+    ofs << "  },\n";
+
+    ofs << "  \"fragments_compressed\": " << m_nFragmentsCompressed.load() << ",\n"
+        << "  \"fragments_stored\": " << m_nFragmentsStored.load() << ",\n"
+        << "  \"dedup_hits\": " << m_nDedupHits.load() << ",\n"
+        << "  \"dedup_misses\": " << m_nDedupMisses.load() << ",\n"
+        << "  \"peak_buffered_bytes\": " << m_nPeakBuffered.load() << "\n"
+        << "}\n";
+
+    if (!ofs)
+    {
+        std::cerr << "[ReVPK] ERROR: Failed to write statistics to " << filePath << "\n";
+        return false;
+    }
+    return true;
+}
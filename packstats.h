@@ -0,0 +1,127 @@
+/**
+ * packstats.h
+ *
+ * Per-stage counters and timers for the pack and unpack paths: bytes read
+ * and written, time spent in each codec, dedup hits, time spent waiting on
+ * locks and the peak amount of file data held in memory. Every command
+ * prints a summary at the end; --stats-json=<file> also writes it as JSON.
+ *
+ * Everything is recorded into one process-wide PackStats() with relaxed
+ * atomics, so instrumented code doesn't need to carry a pointer around.
+ */
+
+#ifndef PACKSTATS_H
+#define PACKSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+class CPackStats
+{
+public:
+    enum ETimer
+    {
+        kTimerRead = 0,        // reading input files (and pack files when unpacking)
+        kTimerCompressLZHAM,
+        kTimerCompressZSTD,
+        kTimerCompressAuto,    // both, for the compression policy's auto codec
+        kTimerDecompressLZHAM,
+        kTimerDecompressZSTD,
+        kTimerWrite,           // pack, extracted and directory file writes
+
+        kNumTimers
+    };
+
+    enum ELock
+    {
+        kLockDedup = 0,        // CChunkDedupTable shards
+        kLockArchives,         // CPackArchiveSet and its write queues
+        kLockJobs,             // pack jobs between workers and the writer
+        kLockResults,          // packmulti/packdeltacommon result maps
+        kLockBudget,           // waiting for room in the in-flight byte budget
+
+        kNumLocks
+    };
+
+    using Clock_t = std::chrono::steady_clock;
+
+    /** Adds its lifetime and nBytes to a timer. */
+    class CScopedTimer
+    {
+    public:
+        CScopedTimer(ETimer eTimer, uint64_t nBytes = 0)
+        : m_eTimer(eTimer), m_nBytes(nBytes), m_Start(Clock_t::now())
+        {}
+        ~CScopedTimer();
+
+        void SetBytes(uint64_t nBytes) { m_nBytes = nBytes; }
+
+    private:
+        ETimer            m_eTimer;
+        uint64_t          m_nBytes;
+        Clock_t::time_point m_Start;
+    };
+
+    CPackStats();
+
+    void AddTime(ETimer eTimer, uint64_t nNanoseconds, uint64_t nBytes);
+    // Final outcome of a new fragment: compressed, or stored as-is.
+    void AddFragment(bool bCompressed);
+    void AddDedup(bool bHit);
+    void AddLockWait(ELock eLock, uint64_t nNanoseconds);
+
+    // File data held in memory between reading and writing it.
+    void AcquireBuffer(uint64_t nBytes);
+    void ReleaseBuffer(uint64_t nBytes);
+
+    // Lock mutex; if it was contended, the wait goes to eLock.
+    template <typename Mutex>
+    std::unique_lock<Mutex> Lock(Mutex& mutex, ELock eLock)
+    {
+        std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            const Clock_t::time_point start = Clock_t::now();
+            lock.lock();
+            AddLockWait(eLock, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock_t::now() - start).count()));
+        }
+        return lock;
+    }
+
+    // Human-readable summary on stdout; stages that never ran are left out.
+    void Print() const;
+    bool WriteJson(const std::string& filePath) const;
+
+private:
+    struct Timer_t
+    {
+        std::atomic<uint64_t> m_nNanoseconds{0};
+        std::atomic<uint64_t> m_nBytes{0};
+        std::atomic<uint64_t> m_nCount{0};
+    };
+
+    struct LockWait_t
+    {
+        std::atomic<uint64_t> m_nNanoseconds{0};
+        std::atomic<uint64_t> m_nCount{0};
+    };
+
+    Clock_t::time_point   m_Start;
+    Timer_t               m_Timers[kNumTimers];
+    LockWait_t            m_LockWaits[kNumLocks];
+    std::atomic<uint64_t> m_nFragmentsCompressed{0};
+    std::atomic<uint64_t> m_nFragmentsStored{0};
+    std::atomic<uint64_t> m_nDedupHits{0};
+    std::atomic<uint64_t> m_nDedupMisses{0};
+    std::atomic<uint64_t> m_nBuffered{0};
+    std::atomic<uint64_t> m_nPeakBuffered{0};
+};
+
+// The stats of this run.
+CPackStats& PackStats();
+
+#endif // PACKSTATS_H
@@ -0,0 +1,175 @@
+/**
+ * policy.cpp
+ *
+ * Implementation of the per-file compression policy (see policy.h).
+ */
+
+#include "policy.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+
+static std::string ToLower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return char(std::tolower(c)); });
+    return s;
+}
+
+// Parse a size field; false if it isn't entirely a number.
+static bool ParseSize(const std::string& field, uint64_t& nSize)
+{
+    char* pEnd = nullptr;
+    nSize = std::strtoull(field.c_str(), &pEnd, 10);
+    return pEnd != field.c_str() && *pEnd == '\0' && field[0] != '-';
+}
+
+static std::string Trim(const std::string& s)
+{
+    const size_t first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return std::string();
+    const size_t last = s.find_last_not_of(" \t\r");
+    return s.substr(first, last - first + 1);
+}
+
+// ------------------------------------------------------------------------
+//  CCompressionPolicy
+// ------------------------------------------------------------------------
+bool CCompressionPolicy::ParseCodec(const std::string& codecName, VPKCodec_t& codec)
+{
+    const std::string name = ToLower(codecName);
+    const size_t colon = name.find(':');
+    const std::string method = name.substr(0, colon);
+    const std::string level  = (colon == std::string::npos) ? std::string() : name.substr(colon + 1);
+
+    if (method == "none" && level.empty())
+    {
+        codec.m_eMethod = kCompressionNone;
+        codec.m_bAuto = false;
+        return true;
+    }
+    if (method == "auto" && level.empty())
+    {
+        codec.m_eMethod = kCompressionZSTD;
+        codec.m_bAuto = true;
+        return true;
+    }
+    if (method == "zstd")
+    {
+        if (!level.empty())
+        {
+            char* pEnd = nullptr;
+            const long nLevel = std::strtol(level.c_str(), &pEnd, 10);
+            if (*pEnd != '\0' || nLevel < ZSTD_minCLevel() || nLevel > ZSTD_maxCLevel())
+                return false;
+            codec.m_nZstdLevel = int(nLevel);
+        }
+        codec.m_eMethod = kCompressionZSTD;
+        codec.m_bAuto = false;
+        return true;
+    }
+    if (method == "lzham")
+    {
+        static const char* const levelNames[LZHAM_TOTAL_COMP_LEVELS] = {
+            "fastest", "faster", "default", "better", "uber"
+        };
+        if (!level.empty())
+        {
+            const char* const* pName = std::find(std::begin(levelNames), std::end(levelNames), level);
+            if (pName == std::end(levelNames))
+                return false;
+            codec.m_nLzhamLevel = int(pName - std::begin(levelNames));
+        }
+        codec.m_eMethod = kCompressionLZHAM;
+        codec.m_bAuto = false;
+        return true;
+    }
+    return false;
+}
+
+bool CCompressionPolicy::Load(const std::string& filePath)
+{
+    std::ifstream ifs(filePath);
+    if (!ifs.is_open())
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot open compression policy: " << filePath << "\n";
+        return false;
+    }
+
+    m_Rules.clear();
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(ifs, line))
+    {
+        lineNumber++;
+        line = Trim(line);
+        if (line.empty() || line[0] == '#' || ToLower(line).rfind("extension,", 0) == 0)
+            continue; // blank, comment or header
+
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ','))
+            fields.push_back(Trim(field));
+
+        Rule_t rule;
+        if (fields.size() != 5 || !ParseCodec(fields[4], rule.m_Codec) ||
+            (!fields[2].empty() && !ParseSize(fields[2], rule.m_nMinSize)) ||
+            (!fields[3].empty() && !ParseSize(fields[3], rule.m_nMaxSize)))
+        {
+            std::cerr << "[ReVPK] ERROR: " << filePath << ":" << lineNumber
+                      << ": expected extension,pathPrefix,minSize,maxSize,codec\n";
+            return false;
+        }
+
+        rule.m_Extension = ToLower(fields[0]);
+        if (!rule.m_Extension.empty() && rule.m_Extension[0] == '.')
+            rule.m_Extension.erase(0, 1);
+        rule.m_PathPrefix = fields[1];
+        rule.m_bHasLevel = fields[4].find(':') != std::string::npos;
+        m_Rules.push_back(std::move(rule));
+    }
+    return true;
+}
+
+bool CCompressionPolicy::Apply(const std::string& entryPath, uint64_t nSize, VPKCodec_t& codec) const
+{
+    if (m_Rules.empty())
+        return false;
+
+    const std::string ext = PackedStore_GetExtension(entryPath);
+
+    for (const Rule_t& rule : m_Rules)
+    {
+        if (!rule.m_Extension.empty() && rule.m_Extension != ext)
+            continue;
+        if (!rule.m_PathPrefix.empty() && entryPath.compare(0, rule.m_PathPrefix.size(), rule.m_PathPrefix) != 0)
+            continue;
+        if (nSize < rule.m_nMinSize || nSize > rule.m_nMaxSize)
+            continue;
+
+        // Same as ParseCodec() with the rule's codec name, without parsing it again.
+        codec.m_eMethod = rule.m_Codec.m_eMethod;
+        codec.m_bAuto = rule.m_Codec.m_bAuto;
+        if (rule.m_bHasLevel && rule.m_Codec.m_eMethod == kCompressionZSTD)
+            codec.m_nZstdLevel = rule.m_Codec.m_nZstdLevel;
+        else if (rule.m_bHasLevel && rule.m_Codec.m_eMethod == kCompressionLZHAM)
+            codec.m_nLzhamLevel = rule.m_Codec.m_nLzhamLevel;
+        return true;
+    }
+    return false;
+}
+
+bool CCompressionPolicy::UsesZstd() const
+{
+    for (const Rule_t& rule : m_Rules)
+    {
+        if (rule.m_Codec.m_eMethod == kCompressionZSTD)
+            return true;
+    }
+    return false;
+}
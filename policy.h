@@ -0,0 +1,60 @@
+/**
+ * policy.h
+ *
+ * Per-file compression policy: rules on extension, path prefix and file size
+ * that pick the codec and level for an entry, instead of one setting for the
+ * whole run. Rules are read from a CSV file given with --policy:
+ *
+ *   # extension,pathPrefix,minSize,maxSize,codec
+ *   nut,,,,zstd:3
+ *   ,materials/,,65536,zstd:19
+ *   bsp_lump,,,,lzham:uber
+ *   vtf,,,,none
+ *   ,,1048576,,auto
+ *
+ * Empty fields match anything and sizes are in bytes (maxSize inclusive).
+ * The first matching rule wins; entries no rule matches keep the codec given
+ * on the command line. Codecs are none, zstd[:level], lzham[:level] (fastest,
+ * faster, default, better, uber) and auto, which compresses with both ZSTD
+ * and LZHAM and keeps LZHAM only if it is clearly smaller.
+ */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packedstore.h"
+
+class CCompressionPolicy
+{
+public:
+    bool Load(const std::string& filePath);
+
+    // Apply the first rule matching an entry to codec; false if none matched.
+    bool Apply(const std::string& entryPath, uint64_t nSize, VPKCodec_t& codec) const;
+
+    size_t GetRuleCount() const { return m_Rules.size(); }
+    // True if any rule can pick ZSTD (so dictionaries may be needed).
+    bool UsesZstd() const;
+
+    // Parse a codec name onto codec; fields the name leaves out are kept.
+    static bool ParseCodec(const std::string& codecName, VPKCodec_t& codec);
+
+private:
+    struct Rule_t
+    {
+        std::string m_Extension;  // lowercase, without the dot
+        std::string m_PathPrefix;
+        uint64_t    m_nMinSize = 0;
+        uint64_t    m_nMaxSize = UINT64_MAX;
+        VPKCodec_t  m_Codec;             // parsed once by Load()
+        bool        m_bHasLevel = false; // else the entry keeps its level
+    };
+
+    std::vector<Rule_t> m_Rules;
+};
+
+#endif // POLICY_H
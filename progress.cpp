@@ -0,0 +1,234 @@
+/**
+ * progress.cpp
+ *
+ * Implementation of the progress reporter (see progress.h).
+ */
+
+#include "progress.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+CProgressReporter& Progress()
+{
+    static CProgressReporter reporter;
+    return reporter;
+}
+
+static double ToMB(double nBytes)
+{
+    return nBytes / (1024.0 * 1024.0);
+}
+
+static double UnixTime()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// ------------------------------------------------------------------------
+//  CProgressReporter
+// ------------------------------------------------------------------------
+bool CProgressReporter::ParseFormat(const std::string& name, EFormat& eFormat)
+{
+    if (name == "none")      eFormat = kFormatNone;
+    else if (name == "text") eFormat = kFormatText;
+    else if (name == "json") eFormat = kFormatJson;
+    else if (name == "prom") eFormat = kFormatPrometheus;
+    else
+        return false;
+    return true;
+}
+
+bool CProgressReporter::Configure(EFormat eFormat, const std::string& outPath, double intervalSec)
+{
+    if (eFormat == kFormatPrometheus && outPath.empty())
+    {
+        std::cerr << "[ReVPK] ERROR: Prometheus progress needs --progress-file=<file.prom>\n";
+        return false;
+    }
+    if (intervalSec <= 0.0)
+    {
+        std::cerr << "[ReVPK] ERROR: Progress interval must be positive.\n";
+        return false;
+    }
+
+    m_eFormat = eFormat;
+    m_OutPath = outPath;
+    m_IntervalSec = intervalSec;
+    return true;
+}
+
+void CProgressReporter::Start(const std::string& mode, uint64_t nTotalFiles, uint64_t nTotalBytes)
+{
+    Stop();
+
+    m_Mode = mode;
+    m_nFiles = 0;
+    m_nBytes = 0;
+    m_nTotalFiles = nTotalFiles;
+    m_nTotalBytes = nTotalBytes;
+    m_Start = m_LastReport = Clock_t::now();
+    m_nLastBytes = 0;
+
+    if (m_eFormat == kFormatNone)
+        return;
+
+    m_bStop = false;
+    m_Thread = std::thread([this]() { ReporterThread(); });
+}
+
+void CProgressReporter::AddTotal(uint64_t nFiles, uint64_t nBytes)
+{
+    m_nTotalFiles.fetch_add(nFiles, std::memory_order_relaxed);
+    m_nTotalBytes.fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void CProgressReporter::Advance(uint64_t nFiles, uint64_t nBytes)
+{
+    m_nFiles.fetch_add(nFiles, std::memory_order_relaxed);
+    m_nBytes.fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void CProgressReporter::Stop()
+{
+    if (!m_Thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bStop = true;
+    }
+    m_StopCV.notify_all();
+    m_Thread.join();
+
+    Write(TakeSnapshot(true));
+}
+
+void CProgressReporter::ReporterThread()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_StopCV.wait_for(lock, std::chrono::duration<double>(m_IntervalSec), [this]() { return m_bStop; }))
+    {
+        lock.unlock();
+        Write(TakeSnapshot(false));
+        lock.lock();
+    }
+}
+
+CProgressReporter::Snapshot_t CProgressReporter::TakeSnapshot(bool bDone)
+{
+    const Clock_t::time_point now = Clock_t::now();
+
+    Snapshot_t snap;
+    snap.m_nFiles      = m_nFiles.load(std::memory_order_relaxed);
+    snap.m_nTotalFiles = m_nTotalFiles.load(std::memory_order_relaxed);
+    snap.m_nBytes      = m_nBytes.load(std::memory_order_relaxed);
+    snap.m_nTotalBytes = m_nTotalBytes.load(std::memory_order_relaxed);
+    snap.m_ElapsedSec  = std::chrono::duration<double>(now - m_Start).count();
+    snap.m_bDone       = bDone;
+
+    const double intervalSec = std::chrono::duration<double>(now - m_LastReport).count();
+    snap.m_BytesPerSec = (intervalSec > 0.0) ? double(snap.m_nBytes - m_nLastBytes) / intervalSec : 0.0;
+    m_LastReport = now;
+    m_nLastBytes = snap.m_nBytes;
+
+    // The ETA extrapolates the average rate so far, which is steadier than
+    // the current one.
+    double fraction = -1.0;
+    if (snap.m_nTotalBytes > 0)
+        fraction = double(snap.m_nBytes) / double(snap.m_nTotalBytes);
+    else if (snap.m_nTotalFiles > 0)
+        fraction = double(snap.m_nFiles) / double(snap.m_nTotalFiles);
+
+    snap.m_EtaSec = -1.0;
+    if (bDone)
+        snap.m_EtaSec = 0.0;
+    else if (fraction > 0.0)
+        snap.m_EtaSec = std::max(0.0, snap.m_ElapsedSec / std::min(fraction, 1.0) - snap.m_ElapsedSec);
+    return snap;
+}
+
+void CProgressReporter::Write(const Snapshot_t& snap)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+
+    switch (m_eFormat)
+    {
+    case kFormatText:
+    {
+        out << "\r[ReVPK] " << m_Mode << ": " << snap.m_nFiles;
+        if (snap.m_nTotalFiles)
+            out << "/" << snap.m_nTotalFiles;
+        out << " files, " << std::setprecision(1) << ToMB(double(snap.m_nBytes)) << " MB, "
+            << ToMB(snap.m_BytesPerSec) << " MB/s";
+        if (snap.m_EtaSec >= 0.0)
+            out << ", ETA " << int(snap.m_EtaSec) << " s";
+        out << "   " << (snap.m_bDone ? "\n" : "");
+        std::cerr << out.str() << std::flush;
+        break;
+    }
+    case kFormatJson:
+    {
+        out << "{\"time\":" << UnixTime() << ",\"mode\":\"" << m_Mode << "\""
+            << ",\"files\":" << snap.m_nFiles << ",\"files_total\":" << snap.m_nTotalFiles
+            << ",\"bytes\":" << snap.m_nBytes << ",\"bytes_total\":" << snap.m_nTotalBytes
+            << ",\"elapsed_seconds\":" << snap.m_ElapsedSec
+            << ",\"mb_per_second\":" << ToMB(snap.m_BytesPerSec)
+            << ",\"eta_seconds\":";
+        if (snap.m_EtaSec >= 0.0)
+            out << snap.m_EtaSec;
+        else
+            out << "null";
+        out << ",\"done\":" << (snap.m_bDone ? "true" : "false") << "}\n";
+
+        if (m_OutPath.empty())
+        {
+            std::cerr << out.str() << std::flush;
+        }
+        else
+        {
+            std::ofstream ofs(m_OutPath, std::ios::app);
+            ofs << out.str();
+        }
+        break;
+    }
+    case kFormatPrometheus:
+    {
+        const std::string label = "{mode=\"" + m_Mode + "\"}";
+        auto metric = [&](const char* name, const char* type, const char* help, double value)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " " << type << "\n"
+                << name << label << " " << value << "\n";
+        };
+
+        out << std::defaultfloat << std::setprecision(15);
+        metric("revpk_processed_files_total", "counter", "Files processed so far.", double(snap.m_nFiles));
+        metric("revpk_planned_files", "gauge", "Files this run will process (0: unknown).", double(snap.m_nTotalFiles));
+        metric("revpk_processed_bytes_total", "counter", "Uncompressed bytes processed so far.", double(snap.m_nBytes));
+        metric("revpk_planned_bytes", "gauge", "Uncompressed bytes this run will process (0: unknown).", double(snap.m_nTotalBytes));
+        metric("revpk_throughput_bytes_per_second", "gauge", "Throughput over the last interval.", snap.m_BytesPerSec);
+        metric("revpk_eta_seconds", "gauge", "Estimated seconds left (-1: unknown).", snap.m_EtaSec);
+        metric("revpk_elapsed_seconds", "gauge", "Seconds since the run started.", snap.m_ElapsedSec);
+        metric("revpk_last_update_timestamp_seconds", "gauge", "Unix time of this update.", UnixTime());
+        metric("revpk_done", "gauge", "1 once the run has finished.", snap.m_bDone ? 1.0 : 0.0);
+
+        // Write next to the target and rename, so a scraper never sees half a file.
+        const std::string tmpPath = m_OutPath + ".tmp";
+        {
+            std::ofstream ofs(tmpPath, std::ios::trunc);
+            ofs << out.str();
+        }
+        if (std::rename(tmpPath.c_str(), m_OutPath.c_str()) != 0)
+            std::cerr << "[ReVPK] WARNING: Could not update " << m_OutPath << "\n";
+        break;
+    }
+    case kFormatNone:
+        break;
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * progress.h
+ *
+ * Progress and throughput reporting shared by the long-running modes (pack,
+ * patch, packmulti, packdeltacommon, unpack, unpackmulti). Workers count
+ * files and bytes as they finish them; a reporter thread periodically turns
+ * that into current MB/s and an ETA and writes it out as:
+ *
+ *   text        a single updating line on stderr (default on a terminal), so
+ *               it stays out of logs captured from stdout
+ *   json        one JSON object per line, to stderr or --progress-file
+ *   prom        Prometheus text format, rewritten atomically in --progress-file
+ *
+ * Build orchestrators can watch the JSON lines or scrape the .prom file (node
+ * exporter textfile collector) to spot stalled or throttled builders.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class CProgressReporter
+{
+public:
+    enum EFormat
+    {
+        kFormatNone = 0,
+        kFormatText,
+        kFormatJson,
+        kFormatPrometheus
+    };
+
+    CProgressReporter() = default;
+    ~CProgressReporter() { Stop(); }
+
+    CProgressReporter(const CProgressReporter&) = delete;
+    CProgressReporter& operator=(const CProgressReporter&) = delete;
+
+    // Parse "text", "json", "prom" or "none".
+    static bool ParseFormat(const std::string& name, EFormat& eFormat);
+
+    // How, where (json: stderr if empty, prom: required) and how often to report.
+    bool Configure(EFormat eFormat, const std::string& outPath, double intervalSec);
+
+    // Begin reporting a run of mode. Totals may be 0 and grow with AddTotal()
+    // as work is discovered; without a byte total the ETA uses file counts.
+    void Start(const std::string& mode, uint64_t nTotalFiles = 0, uint64_t nTotalBytes = 0);
+    void AddTotal(uint64_t nFiles, uint64_t nBytes);
+    void Advance(uint64_t nFiles, uint64_t nBytes);
+    // Write a final report and stop the reporter thread.
+    void Stop();
+
+private:
+    using Clock_t = std::chrono::steady_clock;
+
+    struct Snapshot_t
+    {
+        uint64_t m_nFiles;
+        uint64_t m_nTotalFiles;
+        uint64_t m_nBytes;
+        uint64_t m_nTotalBytes;
+        double   m_ElapsedSec;
+        double   m_BytesPerSec; // over the last interval
+        double   m_EtaSec;      // < 0: unknown
+        bool     m_bDone;
+    };
+
+    void ReporterThread();
+    Snapshot_t TakeSnapshot(bool bDone);
+    void Write(const Snapshot_t& snap);
+
+    EFormat     m_eFormat = kFormatNone;
+    std::string m_OutPath;
+    double      m_IntervalSec = 1.0;
+    std::string m_Mode;
+
+    std::atomic<uint64_t> m_nFiles{0};
+    std::atomic<uint64_t> m_nTotalFiles{0};
+    std::atomic<uint64_t> m_nBytes{0};
+    std::atomic<uint64_t> m_nTotalBytes{0};
+
+    Clock_t::time_point m_Start;
+    Clock_t::time_point m_LastReport;
+    uint64_t            m_nLastBytes = 0;
+
+    std::thread             m_Thread;
+    std::mutex              m_Mutex;
+    std::condition_variable m_StopCV;
+    bool                    m_bStop = false;
+};
+
+// The progress of this run.
+CProgressReporter& Progress();
+
+#endif // PROGRESS_H
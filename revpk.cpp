@@ -9,7 +9,10 @@
 #include <vector>
 #include <filesystem>
 #include <cstdlib>
+#include <climits>
 #include <chrono>
+#include <algorithm>
+#include <cctype>
 // Added for multithreading:
 #include <thread>
 #include <future>
@@ -18,22 +21,69 @@
 #include <atomic>
 #include <fcntl.h>      // open()
 
-#include <unistd.h>     // pwrite(), close()
+#include <unistd.h>     // pwrite(), close(), isatty()
 
 #include "packedstore.h"
 #include "keyvalues.h"  // Our Tyti-based VDF KeyValues interface
+#include "chunkcache.h"
+#include "zstddict.h"
+#include "policy.h"
+#include "bench.h"
+#include "threadpool.h"
+#include "asyncio.h"
+#include "packstats.h"
+#include "progress.h"
 
 // For convenience
 static const std::string PACK_COMMAND       = "pack";
 static const std::string UNPACK_COMMAND     = "unpack";
+static const std::string PATCH_COMMAND      = "patch";
+static const std::string TRAIN_DICT_COMMAND = "train-dict";
+static const std::string BENCH_COMMAND      = "bench";
+
+// Options given as --name or --name=value anywhere on the command line
+static std::map<std::string, std::string> s_Options;
+
+static bool HasOption(const std::string& name)
+{
+    return s_Options.find(name) != s_Options.end();
+}
+
+static std::string GetOption(const std::string& name, const std::string& defaultValue = "")
+{
+    auto it = s_Options.find(name);
+    return (it != s_Options.end() && !it->second.empty()) ? it->second : defaultValue;
+}
 
 static void PrintUsage()
 {
     std::cout << "Usage:\n\n"
         << "  revpk pack <locale> <context> <levelName> [workspacePath] [buildPath] [numThreads] [compressLevel]\n"
+        << "  revpk patch <locale> <context> <levelName> [workspacePath] [buildPath] [numThreads] [compressLevel]\n"
         << "  revpk unpack <vpkFile> [outPath] [sanitize]\n"
         << "  revpk packmulti <context> <levelName> [workspacePath] [buildPath] [numThreads] [compressLevel]\n"
-        << "  revpk unpackmulti <someDirFile> [outPath] [sanitize]\n\n"
+        << "  revpk unpackmulti <someDirFile> [outPath] [sanitize]\n"
+        << "  revpk packdeltacommon <context> [workspacePath] [buildPath] [numThreads] [compressLevel]\n"
+        << "  revpk train-dict <locale> <context> <levelName> [workspacePath] [dictFile] [dictKiB]\n"
+        << "  revpk bench <locale> <context> <levelName> [workspacePath] [maxThreads]\n"
+        << "  revpk bench <vpkFile> [maxThreads]\n\n"
+        << "Options:\n"
+        << "  --cache[=dir]   reuse compressed fragments across runs (default dir: <buildPath>/.revpk_cache)\n"
+        << "  --split=<MiB>   pack, patch, packmulti: start a new pak000_XXX archive at this size\n"
+        << "  --zstd-window-log=<n>, --zstd-strategy=<n>, --zstd-workers=<n>\n"
+        << "                  tune ZSTD compression (compressLevel zstd or zstd:<level>, default level 6)\n"
+        << "  --dict=<file>   pack, patch, packmulti: compress ZSTD fragments with dictionaries from train-dict\n"
+        << "  --policy=<file> pack, patch, packmulti: pick the codec per file from CSV rules (see policy.h)\n"
+        << "  --no-probe      compress every fragment, even ones that sample as incompressible\n"
+        << "  --bench-mb=<n>  bench: load at most this much input (default 32)\n"
+        << "  --stats-json=<file>  pack/unpack modes: also write the stage statistics as JSON\n"
+        << "  --progress=<text|json|prom|none>  pack/unpack modes: report files, MB/s and ETA\n"
+        << "                  (default: text on a terminal, none otherwise)\n"
+        << "  --progress-file=<file>  json: append lines here instead of stderr; prom: file to rewrite\n"
+        << "  --progress-interval=<sec>  seconds between progress reports (default 1)\n"
+        << "  --max-inflight-mb=<n>  pack modes: cap file data held in memory (default: 1/4 of RAM)\n"
+        << "  --io=<uring|sync>  read input files and write extracted files through io_uring\n"
+        << "                  when the kernel allows it (default), or with plain pread/pwrite\n\n"
         << "Examples:\n"
         << "  revpk pack english client mp_rr_box\n"
         << "  revpk packmulti client mp_rr_box\n"
@@ -41,6 +91,165 @@ static void PrintUsage()
         << "  revpk unpackmulti englishclient_mp_rr_box.bsp.pak000_dir.vpk ship/ 1\n\n";
 }
 
+// Attach the persistent chunk cache to the builder if --cache was given.
+static void OpenChunkCache(CChunkCache& cache, CPackedStoreBuilder& builder, const std::string& buildPath)
+{
+    if (!HasOption("cache"))
+        return;
+
+    std::string cacheDir = GetOption("cache", buildPath + ".revpk_cache");
+    if (!cache.Open(cacheDir))
+    {
+        std::cerr << "[ReVPK] WARNING: Continuing without chunk cache.\n";
+        return;
+    }
+
+    std::cout << "[ReVPK] Chunk cache: " << cacheDir << " (" << cache.GetEntries() << " entries)\n";
+    builder.m_pChunkCache = &cache;
+}
+
+// Archive size cap from --split=<MiB> (0: no splitting).
+static uint64_t GetSplitSize()
+{
+    return std::strtoull(GetOption("split", "0").c_str(), nullptr, 10) * 1024 * 1024;
+}
+
+// Integer value of --name (defaultValue if not given); false (reported) if
+// it isn't a number.
+static bool GetIntOption(const std::string& name, int defaultValue, int& outValue)
+{
+    outValue = defaultValue;
+    if (!HasOption(name))
+        return true;
+
+    const std::string value = GetOption(name);
+    char* pEnd = nullptr;
+    const long nValue = std::strtol(value.c_str(), &pEnd, 10);
+    if (value.empty() || *pEnd != '\0' || nValue < INT_MIN || nValue > INT_MAX)
+    {
+        std::cerr << "[ReVPK] ERROR: --" << name << " expects a number, got '" << value << "'\n";
+        return false;
+    }
+    outValue = int(nValue);
+    return true;
+}
+
+// Apply --zstd-* options on top of the level from compressLevel.
+static bool ApplyZstdOptions(CPackedStoreBuilder& builder)
+{
+    VPKZstdParams_t params = builder.m_ZstdParams;
+    if (!GetIntOption("zstd-window-log", 0, params.m_nWindowLog) ||
+        !GetIntOption("zstd-strategy", 0, params.m_nStrategy) ||
+        !GetIntOption("zstd-workers", 0, params.m_nWorkers))
+        return false;
+    return builder.SetZstdParams(params);
+}
+
+// Load the per-file compression rules given with --policy=<file>.
+static bool OpenCompressionPolicy(CCompressionPolicy& policy, CPackedStoreBuilder& builder)
+{
+    if (!HasOption("policy"))
+        return true;
+
+    const std::string policyFile = GetOption("policy");
+    if (!policy.Load(policyFile))
+        return false;
+
+    std::cout << "[ReVPK] Compression policy: " << policyFile << " (" << policy.GetRuleCount() << " rules)\n";
+    builder.m_pPolicy = &policy;
+    return true;
+}
+
+// Load the per-extension ZSTD dictionaries given with --dict=<file>.
+static bool OpenZstdDicts(CPackedStoreBuilder& builder)
+{
+    if (!HasOption("dict"))
+        return true;
+
+    if (!builder.IsUsingZSTD() && !(builder.m_pPolicy && builder.m_pPolicy->UsesZstd()))
+    {
+        std::cerr << "[ReVPK] WARNING: --dict only applies to ZSTD compression, ignoring it.\n";
+        return true;
+    }
+
+    const std::string dictFile = GetOption("dict");
+    if (!builder.m_ZstdDicts.Load(dictFile))
+        return false;
+
+    std::cout << "[ReVPK] Using " << builder.m_ZstdDicts.GetCount()
+              << " ZSTD dictionaries from " << dictFile << "\n";
+    return true;
+}
+
+static void ReportChunkCache(const CChunkCache& cache)
+{
+    if (!cache.IsOpen())
+        return;
+
+    std::cout << "[ReVPK] Chunk cache: " << cache.GetHits() << " hits, "
+              << cache.GetMisses() << " misses.\n";
+}
+
+// List what the compressibility probe stored raw, so manifests can turn
+// compression off for those files.
+static void ReportProbeSkips(const CPackedStoreBuilder& builder)
+{
+    for (const auto& it : builder.GetProbeSkips())
+    {
+        std::cout << "[ReVPK] Stored " << it.second.m_nFragments << " incompressible fragments ("
+                  << (it.second.m_nBytes / 1024) << " KiB) of "
+                  << (it.first.empty() ? "extensionless" : "." + it.first) << " files raw.\n";
+    }
+}
+
+// Cap the file data held in memory at --max-inflight-mb, by default a
+// quarter of physical memory.
+static void ApplyInFlightBudget()
+{
+    uint64_t nLimit = std::strtoull(GetOption("max-inflight-mb", "0").c_str(), nullptr, 10) * 1024 * 1024;
+    if (nLimit == 0)
+    {
+        const long nPages = sysconf(_SC_PHYS_PAGES);
+        const long nPageSize = sysconf(_SC_PAGE_SIZE);
+        if (nPages > 0 && nPageSize > 0)
+            nLimit = uint64_t(nPages) * uint64_t(nPageSize) / 4;
+    }
+    InFlightBudget().SetLimit(nLimit);
+}
+
+// Check --progress, --progress-file and --progress-interval and set up the
+// reporter with them. Called before a mode touches the filesystem, so a bad
+// combination leaves nothing behind.
+static bool ConfigureProgress()
+{
+    CProgressReporter::EFormat eFormat = isatty(STDERR_FILENO)
+        ? CProgressReporter::kFormatText : CProgressReporter::kFormatNone;
+    if (HasOption("progress") && !CProgressReporter::ParseFormat(GetOption("progress", "text"), eFormat))
+    {
+        std::cerr << "[ReVPK] ERROR: Unknown progress format '" << GetOption("progress") << "'\n";
+        return false;
+    }
+
+    const double intervalSec = std::strtod(GetOption("progress-interval", "1").c_str(), nullptr);
+    return Progress().Configure(eFormat, GetOption("progress-file"), intervalSec);
+}
+
+// Start reporting a run of mode. Totals the run discovers later are added to these.
+static void StartProgress(const std::string& mode, uint64_t nTotalFiles = 0, uint64_t nTotalBytes = 0)
+{
+    Progress().Start(mode, nTotalFiles, nTotalBytes);
+}
+
+// Finish the progress report, print the per-stage statistics of this run,
+// and dump them with --stats-json.
+static void ReportStats()
+{
+    Progress().Stop();
+    PackStats().Print();
+    if (HasOption("stats-json"))
+        PackStats().WriteJson(GetOption("stats-json"));
+}
+
 static void DoPack(const std::vector<std::string>& args)
 {
     if (args.size() < 5)
@@ -75,7 +284,21 @@ static void DoPack(const std::vector<std::string>& args)
 
     // create a builder
     CPackedStoreBuilder builder;
-    builder.InitLzEncoder(numThreads, compressLevel.c_str());
+    if (!builder.InitLzEncoder(0, compressLevel.c_str()))
+        return;
+    builder.m_bProbeCompressibility = !HasOption("no-probe");
+    CCompressionPolicy policy;
+    if (!ApplyZstdOptions(builder) || !OpenCompressionPolicy(policy, builder) || !OpenZstdDicts(builder))
+        return;
+    builder.m_nWorkerThreads = numThreads;
+    builder.m_nMaxArchiveSize = GetSplitSize();
+    if (!ConfigureProgress())
+        return;
+
+    CChunkCache chunkCache;
+    OpenChunkCache(chunkCache, builder, buildPath);
+    ApplyInFlightBudget();
+    StartProgress(PACK_COMMAND);
 
     // Construct VPKPair
     VPKPair_t pair(locale.c_str(), context.c_str(), level.c_str(), 0);
@@ -84,10 +307,71 @@ static void DoPack(const std::vector<std::string>& args)
 
     // Actually run pack
     builder.PackStore(pair, workspace.c_str(), buildPath.c_str());
+    ReportChunkCache(chunkCache);
+    ReportProbeSkips(builder);
 
     auto end = std::chrono::steady_clock::now();
     double elapsedSec = std::chrono::duration<double>(end - start).count();
     std::cout << "[ReVPK] Packing took " << elapsedSec << " seconds.\n";
+    ReportStats();
+}
+
+static void DoPatch(const std::vector<std::string>& args)
+{
+    if (args.size() < 5)
+    {
+        PrintUsage();
+        return;
+    }
+
+    // same arguments as pack
+    std::string locale = args[2];
+    std::string context = args[3];
+    std::string level   = args[4];
+
+    std::string workspace = (args.size() > 5) ? args[5] : "ship";
+    std::string buildPath = (args.size() > 6) ? args[6] : "vpk";
+
+    if (!workspace.empty() && workspace.back() != '/' && workspace.back() != '\\')
+        workspace.push_back('/');
+    if (!buildPath.empty() && buildPath.back() != '/' && buildPath.back() != '\\')
+        buildPath.push_back('/');
+
+    int numThreads = -1;
+    if (args.size() > 7)
+        numThreads = std::atoi(args[7].c_str());
+    std::string compressLevel = (args.size() > 8) ? args[8] : "uber";
+
+    auto start = std::chrono::steady_clock::now();
+
+    CPackedStoreBuilder builder;
+    if (!builder.InitLzEncoder(0, compressLevel.c_str()))
+        return;
+    builder.m_bProbeCompressibility = !HasOption("no-probe");
+    CCompressionPolicy policy;
+    if (!ApplyZstdOptions(builder) || !OpenCompressionPolicy(policy, builder) || !OpenZstdDicts(builder))
+        return;
+    builder.m_nWorkerThreads = numThreads;
+    builder.m_nMaxArchiveSize = GetSplitSize();
+    if (!ConfigureProgress())
+        return;
+
+    CChunkCache chunkCache;
+    OpenChunkCache(chunkCache, builder, buildPath);
+    ApplyInFlightBudget();
+    StartProgress(PATCH_COMMAND);
+
+    VPKPair_t pair(locale.c_str(), context.c_str(), level.c_str(), 0);
+
+    std::cout << "[ReVPK] PATCH: " << pair.m_DirName << "\n";
+    builder.PatchStore(pair, workspace.c_str(), buildPath.c_str());
+    ReportChunkCache(chunkCache);
+    ReportProbeSkips(builder);
+
+    auto end = std::chrono::steady_clock::now();
+    double elapsedSec = std::chrono::duration<double>(end - start).count();
+    std::cout << "[ReVPK] Patching took " << elapsedSec << " seconds.\n";
+    ReportStats();
 }
 
 static void DoUnpack(const std::vector<std::string>& args)
@@ -119,7 +403,9 @@ static void DoUnpack(const std::vector<std::string>& args)
 
     // create a builder
     CPackedStoreBuilder builder;
-    builder.InitLzDecoder();
+    if (!ConfigureProgress())
+        return;
+    StartProgress(UNPACK_COMMAND);
 
     std::cout << "[ReVPK] UNPACK: " << fileName << "\n";
     builder.UnpackStore(vpkDir, outPath.c_str());
@@ -127,6 +413,7 @@ static void DoUnpack(const std::vector<std::string>& args)
     auto end = std::chrono::steady_clock::now();
     double elapsedSec = std::chrono::duration<double>(end - start).count();
     std::cout << "[ReVPK] Unpacking took " << elapsedSec << " seconds.\n";
+    ReportStats();
 }
 
 // Helper to guess language from the front of the filename.
@@ -189,9 +476,6 @@ static bool LoadMultiLangManifest(const std::string& manifestFile,
  *
  * Instead of processing each language sequentially, we launch an asynchronous task for every file.
  */
-// For demonstration, a global or static mutex.
-static std::mutex fileIOMutex;
-
 static void DoPackMulti(const std::vector<std::string>& args)
 {
     // usage:
@@ -218,11 +502,6 @@ static void DoPackMulti(const std::vector<std::string>& args)
         numThreads = std::atoi(args[6].c_str());
     std::string compressLevel = (args.size() > 7) ? args[7] : "uber";
 
-    unsigned int defaultThreads = std::thread::hardware_concurrency();
-    if (defaultThreads == 0) defaultThreads = 1;
-    if (defaultThreads > 1)  defaultThreads--; // leave 1 core free
-    if (numThreads <= 0)     numThreads = defaultThreads;
-
     std::cout << "[ReVPK] packmulti: context=" << context
               << " level=" << level
               << " workspace=" << workspace
@@ -241,7 +520,21 @@ static void DoPackMulti(const std::vector<std::string>& args)
         return;
     }
 
-    // 2) Create a single “master” data file
+    // 2) Prepare the CPackedStoreBuilder (which has dedup map). Every option
+    //    is checked before any output exists, so a bad one leaves nothing behind.
+    CPackedStoreBuilder builder;
+    if (!builder.InitLzEncoder(0, compressLevel.c_str()))
+        return;
+    builder.m_nWorkerThreads = numThreads;
+    builder.m_bProbeCompressibility = !HasOption("no-probe");
+    CCompressionPolicy policy;
+    if (!ApplyZstdOptions(builder) || !OpenCompressionPolicy(policy, builder) || !OpenZstdDicts(builder) ||
+        !ConfigureProgress())
+        return;
+
+    builder.m_nMaxArchiveSize = GetSplitSize();
+
+    // 3) Create the “master” data files
     VPKPair_t masterPair("", context.c_str(), level.c_str(), 0);
     fs::path masterDataFile = fs::path(buildPath) / masterPair.m_PackName;
 
@@ -255,26 +548,37 @@ static void DoPackMulti(const std::vector<std::string>& args)
         return;
     }
 
-    std::ofstream ofsData(masterDataFile, std::ios::binary);
-    if (!ofsData.is_open())
-    {
-        std::cerr << "[ReVPK] ERROR: cannot open " << masterDataFile << " for writing\n";
-        return;
-    }
+    CChunkCache chunkCache;
+    OpenChunkCache(chunkCache, builder, buildPath);
 
-    // 3) Prepare the CPackedStoreBuilder (which has dedup map)
-    CPackedStoreBuilder builder;
-    builder.InitLzEncoder(numThreads, compressLevel.c_str());
+    size_t totalFiles = 0;
+    for (const auto& langPair : langFileMap)
+        totalFiles += langPair.second.size();
+    ApplyInFlightBudget();
+    StartProgress("packmulti", totalFiles);
+
+    // Shared pack archives (pak000_000, pak000_001, ... when split). Each new
+    // chunk reserves its range in its entry's archive and is written there.
+    CPackArchiveSet archives([&](uint16_t iIndex)
+        {
+            VPKPair_t pair("", context.c_str(), level.c_str(), iIndex);
+            return (fs::path(buildPath) / pair.m_PackName).string();
+        },
+        0, builder.m_nMaxArchiveSize);
+
+    if (!archives.Open())
+        return;
 
     std::atomic<size_t> sharedBytes{0};
     std::atomic<size_t> sharedChunks{0};
 
-    std::mutex dedupMutex;
     std::mutex resultsMutex;
     std::map<std::string, std::vector<VPKEntryBlock_t>> languageEntries;
 
-    // 4) Thread pool for compression tasks
-    ThreadPool pool(numThreads);
+    // 4) Thread pool for compression tasks; the queue is bounded so tasks
+    //    are created about as fast as they run, not all up front.
+    const unsigned int numWorkers = builder.GetWorkerCount();
+    ThreadPool pool(numWorkers, size_t(numWorkers) * 4);
 
     // For each language => for each file => compress+dedup
     for (auto& langPair : langFileMap)
@@ -286,148 +590,138 @@ static void DoPackMulti(const std::vector<std::string>& args)
         {
             pool.enqueue([&, language, fileKV]()
             {
-                // Per-task buffers for compression
-                std::unique_ptr<uint8_t[]> chunkBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
-                std::unique_ptr<uint8_t[]> compBuf(new uint8_t[VPK_ENTRY_MAX_LEN]);
+                // Per-worker buffer for compression
+                thread_local std::vector<uint8_t> compBuf(VPK_ENTRY_MAX_LEN);
 
-                // Attempt to read file from workspace/<language>
+                // Attempt to open file from workspace/<language>
                 std::string path = workspace + "content/" + language + "/" + fileKV.m_EntryPath;
-                std::ifstream ifFile(path, std::ios::binary);
-                if (!ifFile.good())
+                CFragmentReader reader;
+                if (!reader.Open(path))
                 {
                     // fallback to english
                     path = workspace + "content/english/" + fileKV.m_EntryPath;
-                    ifFile.open(path, std::ios::binary);
-                    if (!ifFile.good())
+                    if (!reader.Open(path))
                     {
                         std::cerr << "[ReVPK] WARNING: Could not open " << path << "\n";
+                        Progress().Advance(1, 0);
                         return;
                     }
                 }
-                ifFile.seekg(0, std::ios::end);
-                std::streamoff len = ifFile.tellg();
-                ifFile.seekg(0, std::ios::beg);
 
-                if (len <= 0)
+                if (reader.GetSize() == 0)
                 {
                     std::cerr << "[ReVPK] WARNING: empty file " << fileKV.m_EntryPath << "\n";
+                    Progress().Advance(1, 0);
                     return;
                 }
-                std::vector<uint8_t> fileData(static_cast<size_t>(len));
-                ifFile.read(reinterpret_cast<char*>(fileData.data()), len);
-                ifFile.close();
-
-                // Build an entry block
-                VPKEntryBlock_t block(fileData.data(), fileData.size(), 
-                                      0,  // offset assigned later
-                                      fileKV.m_iPreloadSize, 0,
-                                      fileKV.m_nLoadFlags,
-                                      fileKV.m_nTextureFlags,
-                                      fileKV.m_EntryPath.c_str());
-
-                // Compress/deduplicate each fragment
-                size_t filePos = 0; 
-                for (auto& frag : block.m_Fragments)
+
+                // Build an entry block (offsets assigned later)
+                VPKEntryBlock_t block = PackedStore_BeginEntryBlock(reader, fileKV, 0);
+
+                // All fragments of an entry go to the same archive, and chunks
+                // are only shared within that archive. When split, fully
+                // duplicated entries go to an archive that already holds all
+                // of their chunks, which takes a pass hashing the file first.
+                // Otherwise each fragment is read once, hashed and compressed.
+                // The file is streamed a fragment at a time either way.
+                const bool bPrehash = builder.m_nMaxArchiveSize > 0;
+                const uint64_t fragmentOffset = reader.Tell();
+                std::vector<uint64_t> chunkHashes;
+                if (bPrehash)
+                {
+                    for (const auto& frag : block.m_Fragments)
+                    {
+                        CByteBudget::CScopedBytes hold(InFlightBudget(), frag.m_nUncompressedSize);
+                        chunkHashes.push_back(compute_chunk_hash(reader.Read(frag.m_nUncompressedSize), frag.m_nUncompressedSize));
+                    }
+                    block.m_nFileCRC = reader.GetCRC();
+                }
+
+                if (!bPrehash || !archives.FindArchiveHolding(chunkHashes, block.m_iPackFileIndex))
+                    block.m_iPackFileIndex = archives.BeginEntry(reader.GetSize());
+                CChunkDedupTable& chunkTable = archives.GetChunkTable(block.m_iPackFileIndex);
+
+                // Deduplicate/compress each fragment.
+                const VPKCodec_t codec = builder.GetCodecForEntry(fileKV.m_EntryPath, reader.GetSize());
+                uint64_t filePos = fragmentOffset;
+                for (size_t f = 0; f < block.m_Fragments.size(); f++)
                 {
-                    // Copy uncompressed data to chunkBuf
+                    VPKChunkDescriptor_t& frag = block.m_Fragments[f];
                     const size_t chunkSize = frag.m_nUncompressedSize;
-                    std::memcpy(chunkBuf.get(), &fileData[filePos], chunkSize);
+                    const uint64_t chunkPos = filePos;
                     filePos += chunkSize;
 
-                    // Attempt compression if desired
-                    bool compressedOk = false;
-                    size_t compSize   = chunkSize;
-                    const uint8_t* finalPtr = chunkBuf.get();
-
-                    if (fileKV.m_bUseCompression && builder.IsUsingZSTD())
+                    // Read, hash and compress within the in-flight budget; the
+                    // copy queued for the archive writer is budgeted by Write().
+                    std::vector<uint8_t> finalData;
+                    bool bCompressed = false;
+                    bool bDuplicate = false;
+                    uint64_t chunkHash;
                     {
-                        constexpr size_t markerSize = sizeof(R1D_marker);
-                        std::memcpy(compBuf.get(), &R1D_marker, markerSize);
-
-                        size_t zstdBound = ZSTD_compressBound(chunkSize);
-                        if (zstdBound + markerSize > VPK_ENTRY_MAX_LEN)
-                            zstdBound = VPK_ENTRY_MAX_LEN - markerSize;
-
-                        size_t zstdResult = ZSTD_compress(
-                            compBuf.get() + markerSize,
-                            zstdBound,
-                            chunkBuf.get(),
-                            chunkSize,
-                            6 // example ZSTD level
-                        );
-                        if (!ZSTD_isError(zstdResult))
+                        CByteBudget::CScopedBytes hold(InFlightBudget(), chunkSize);
+                        const uint8_t* pChunk = bPrehash ? nullptr : reader.Read(chunkSize);
+                        chunkHash = bPrehash ? chunkHashes[f] : compute_chunk_hash(pChunk, chunkSize);
+                        bDuplicate = chunkTable.Find(chunkHash, frag);
+                        if (!bDuplicate)
                         {
-                            size_t total = zstdResult + markerSize;
-                            if (total < chunkSize)
+                            if (!pChunk)
                             {
-                                compressedOk = true;
-                                compSize     = total;
-                                finalPtr     = compBuf.get();
+                                reader.Seek(chunkPos);
+                                pChunk = reader.Read(chunkSize);
                             }
-                        }
-                    }
-                    else if (fileKV.m_bUseCompression)
-                    {
-                        // LZHAM path
-                        size_t tmpCompSize = compSize;
-                        lzham_compress_status_t st = lzham_compress_memory(
-                            &builder.m_Encoder,
-                            compBuf.get(),
-                            &tmpCompSize,
-                            chunkBuf.get(),
-                            chunkSize,
-                            nullptr
-                        );
-                        if (st == LZHAM_COMP_STATUS_SUCCESS && tmpCompSize < chunkSize)
-                        {
-                            compressedOk = true;
-                            compSize     = tmpCompSize;
-                            finalPtr     = compBuf.get();
+
+                            // Attempt compression if desired
+                            size_t compSize = 0;
+                            bCompressed = fileKV.m_bUseCompression &&
+                                builder.CompressChunkCached(fileKV.m_EntryPath, chunkHash, pChunk, chunkSize,
+                                                            compBuf.data(), compSize, codec);
+                            if (bCompressed)
+                                finalData.assign(compBuf.data(), compBuf.data() + compSize);
+                            else
+                                finalData.assign(pChunk, pChunk + chunkSize);
                         }
                     }
 
-                    // Now deduplicate. Note that we deduplicate by hashing
-                    // the *uncompressed* data (to catch identical blocks
-                    // even if compressed differently).
-                    // If you prefer hashing compressed data, just keep finalPtr/compSize.
-                    std::string chunkHash = compute_sha1_hex(chunkBuf.get(), chunkSize);
-
+                    if (bDuplicate)
                     {
-                        // Acquire dedupMutex for map access
-                        std::lock_guard<std::mutex> dedupLock(dedupMutex);
-                        auto it = builder.m_ChunkHashMap.find(chunkHash);
-                        if (it != builder.m_ChunkHashMap.end())
+                        // Duplicate found
+                        PackStats().AddDedup(true);
+                        sharedBytes += frag.m_nUncompressedSize;
+                        sharedChunks++;
+                        continue; // done for this chunk
+                    }
+                    const size_t compSize = finalData.size();
+
+                    // Insert-if-absent: another worker may have stored the
+                    // same chunk while we were compressing it.
+                    frag.m_nCompressedSize = compSize;
+                    const uint16_t archiveIndex = block.m_iPackFileIndex;
+                    const bool bExisting = chunkTable.FindOrInsert(chunkHash, frag,
+                        [&archives, archiveIndex, compSize](VPKChunkDescriptor_t& newFrag)
                         {
-                            // Duplicate found
-                            frag = it->second;
-                            sharedBytes += frag.m_nUncompressedSize;
-                            sharedChunks++;
-                            continue; // done for this chunk
-                        }
+                            newFrag.m_nPackFileOffset = archives.Allocate(archiveIndex, compSize);
+                        });
 
-                        // Not in map => must write new chunk
-                        {
-                            // Acquire fileIOMutex to do offset + write
-                            std::lock_guard<std::mutex> fileLock(fileIOMutex);
-
-                            // 1) get offset
-                            uint64_t offset = static_cast<uint64_t>(ofsData.tellp());
-                            // 2) write data
-                            ofsData.write(reinterpret_cast<const char*>(finalPtr), compSize);
-
-                            // 3) finalize descriptor
-                            frag.m_nPackFileOffset = offset;
-                            frag.m_nCompressedSize = compSize;
-                            // Insert into chunk map
-                            builder.m_ChunkHashMap[chunkHash] = frag;
-                        }
+                    PackStats().AddDedup(bExisting);
+                    if (bExisting)
+                    {
+                        sharedBytes += frag.m_nUncompressedSize;
+                        sharedChunks++;
+                        continue;
                     }
+
+                    PackStats().AddFragment(bCompressed);
+                    archives.Write(block.m_iPackFileIndex, frag.m_nPackFileOffset, std::move(finalData));
                 } // end for each fragment
 
+                if (!bPrehash)
+                    block.m_nFileCRC = reader.GetCRC();
+                Progress().Advance(1, reader.GetSize());
+
                 // Store the block in a language-specific vector
                 if (!block.m_EntryPath.empty())
                 {
-                    std::lock_guard<std::mutex> lock2(resultsMutex);
+                    std::unique_lock<std::mutex> lock2 = PackStats().Lock(resultsMutex, CPackStats::kLockResults);
                     languageEntries[language].push_back(block);
                 }
             }); // end enqueue
@@ -436,12 +730,16 @@ static void DoPackMulti(const std::vector<std::string>& args)
 
     // 5) Wait for all tasks
     pool.wait();
-    ofsData.flush();
-    ofsData.close();
+    if (!archives.Close())
+        std::cerr << "[ReVPK] ERROR: Writing the master data files failed.\n";
 
-    std::cout << "[ReVPK] Master data file complete: " << masterDataFile << "\n"
+    std::cout << "[ReVPK] Master data files complete: " << archives.GetArchiveCount()
+              << " file(s), " << archives.GetTotalSize() << " bytes\n"
               << "       Shared " << sharedBytes.load() 
               << " bytes in " << sharedChunks.load() << " deduplicated chunks.\n";
+    ReportChunkCache(chunkCache);
+    ReportProbeSkips(builder);
+    builder.SaveZstdDicts((fs::path(buildPath) / masterPair.m_DirName).string());
 
     // 6) Build each language’s .vpk directory
     for (auto& kv : languageEntries)
@@ -454,6 +752,7 @@ static void DoPackMulti(const std::vector<std::string>& args)
         VPKDir_t dir;
         dir.BuildDirectoryFile(dirPath.string(), blocks);
     }
+    ReportStats();
 }
 
 /**
@@ -541,13 +840,19 @@ static void DoUnpackMulti(const std::vector<std::string>& args)
 
     // Step 4: Unpack the fallback (English) fully
     CPackedStoreBuilder builder;
-    builder.InitLzDecoder();
+    if (!ConfigureProgress())
+        return;
+    StartProgress("unpackmulti");
 
     std::string engOut = outPath + "content/english/";
     fs::create_directories(engOut);
     builder.UnpackStore(*pEnglishDir, engOut.c_str());
 
-    // Step 5: For each other language, unpack differences in parallel
+    // Step 5: For each other language, unpack differences in parallel. The
+    // languages run at the same time, so they split the workers between them.
+    const unsigned int numOtherLangs = unsigned(languageDirs.size() - languageDirs.count("english"));
+    const unsigned int numLangWorkers = std::max(1u, builder.GetWorkerCount() / std::max(1u, numOtherLangs));
+
     std::vector<std::future<void>> unpackFutures;
     for (auto& kvLang : languageDirs)
     {
@@ -561,7 +866,7 @@ static void DoUnpackMulti(const std::vector<std::string>& args)
             std::async(std::launch::async, [&, lang, langDir]()
             {
                 CPackedStoreBuilder localBuilder;
-                localBuilder.InitLzDecoder();
+                localBuilder.m_nWorkerThreads = numLangWorkers;
                 std::string langOutPath = outPath + "content/" + lang + "/";
                 fs::create_directories(langOutPath);
                 localBuilder.UnpackStoreDifferences(*pEnglishDir, langDir, engOut, langOutPath);
@@ -585,6 +890,7 @@ static void DoUnpackMulti(const std::vector<std::string>& args)
     }
 
     std::cout << "[ReVPK] UnpackMulti completed.\n";
+    ReportStats();
 }
 
 static void DoPackDeltaCommon(const std::vector<std::string>& args)
@@ -684,33 +990,22 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
         return;
     }
 
-    // Track progress in a separate thread.
-    std::atomic<size_t> filesProcessed{0};
-    size_t totalFilesCount = englishTasks.size() + nonEnglishTasks.size();
-    std::atomic<bool> progressDone{false};
-    auto progressFuture = std::async(std::launch::async, [&]()
-    {
-        auto startTime = std::chrono::steady_clock::now();
-        while (!progressDone.load())
-        {
-            size_t processed = filesProcessed.load();
-            double progressFraction = (totalFilesCount > 0) ? double(processed) / totalFilesCount : 1.0;
-            double percent = progressFraction * 100.0;
-            auto now = std::chrono::steady_clock::now();
-            double elapsedSec = std::chrono::duration<double>(now - startTime).count();
-            double estimatedTotalSec = (progressFraction > 0.0) ? elapsedSec / progressFraction : 0.0;
-            double remainingSec = estimatedTotalSec - elapsedSec;
-            if (remainingSec < 0.0)
-                remainingSec = 0.0;
-            std::cout << "\rProcessed " << processed << "/" << totalFilesCount
-                      << " files (" << int(percent) << "%), ETA: " << int(remainingSec) << " sec." << std::flush;
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        }
-        std::cout << "\rProcessed " << totalFilesCount << "/" << totalFilesCount
-                  << " files (100%), ETA: 0 sec." << std::endl;
-    });
+    // Prepare the encoder and shared maps.
+    CPackedStoreBuilder builder;
+    if (!builder.InitLzEncoder(0, compressLevel.c_str()))
+        return;
+    builder.m_nWorkerThreads = numThreads;
+    builder.m_bProbeCompressibility = !HasOption("no-probe");
+    if (!ApplyZstdOptions(builder) || !ConfigureProgress())
+        return;
 
-    // Open master VPK files for random–access writing.
+    CChunkCache chunkCache;
+    OpenChunkCache(chunkCache, builder, buildPath);
+    ApplyInFlightBudget();
+    StartProgress("packdeltacommon", englishTasks.size() + nonEnglishTasks.size());
+
+    // Open master VPK files for random–access writing, once every option
+    // has been checked.
     std::string omegaClientPath = buildPath + "client_mp_delta_common.bsp.pak000_000.vpk";
     std::string omegaServerPath = buildPath + "server_mp_delta_common.bsp.pak000_000.vpk";
     int fdClient = open(omegaClientPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
@@ -718,8 +1013,6 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
     if (fdClient < 0 || fdServer < 0)
     {
         std::cerr << "[ReVPK] ERROR: Could not open omega output file(s) for writing.\n";
-        progressDone = true;
-        progressFuture.wait();
         if (fdClient >= 0)
             close(fdClient);
         if (fdServer >= 0)
@@ -730,12 +1023,8 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
     // Atomic offsets for lock-free writes.
     std::atomic<uint64_t> clientOffset{0}, serverOffset{0};
 
-    // Prepare the encoder and shared maps.
-    CPackedStoreBuilder builder;
-    builder.InitLzEncoder(numThreads, compressLevel.c_str());
-
-    std::unordered_map<std::string, VPKChunkDescriptor_t> serverChunkMap;
-    std::mutex clientMapMutex, serverMapMutex, resultsMutex;
+    CChunkDedupTable serverChunkTable;
+    std::mutex resultsMutex;
     std::condition_variable englishProcessedCV;
     std::atomic<bool> englishProcessingComplete{false};
 
@@ -750,23 +1039,14 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
     // The file processing lambda.
     auto processFile = [&](const ManifestEntry &entry) -> std::pair<VPKEntryBlock_t, VPKEntryBlock_t>
     {
-        // Use thread–local buffers to avoid repeated allocation.
-        thread_local std::vector<uint8_t> chunkBuf(VPK_ENTRY_MAX_LEN);
+        // Use a thread–local buffer to avoid repeated allocation.
         thread_local std::vector<uint8_t> compBuf(VPK_ENTRY_MAX_LEN);
 
-        std::ifstream ifs(entry.filePath, std::ios::binary);
-        if (!ifs.good())
+        CFragmentReader reader;
+        if (!reader.Open(entry.filePath))
             return {};
 
-        ifs.seekg(0, std::ios::end);
-        std::streamoff len = ifs.tellg();
-        ifs.seekg(0, std::ios::beg);
-        if (len < 0)
-        {
-            std::cerr << "[ReVPK] ERROR: " << entry.kv.m_EntryPath << " has negative length.\n";
-            return {};
-        }
-
+        const uint64_t len = reader.GetSize();
         if (len == 0)
         {
             std::cerr << "[ReVPK] INFO: " << entry.kv.m_EntryPath 
@@ -789,14 +1069,8 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
             return std::make_pair(clientEntry, serverEntry);
         }
 
-        // Read file data.
-        std::vector<uint8_t> fileData(static_cast<size_t>(len));
-        ifs.read(reinterpret_cast<char*>(fileData.data()), len);
-
-        VPKEntryBlock_t clientEntry(fileData.data(), fileData.size(), 0,
-                                    entry.kv.m_iPreloadSize, 0,
-                                    entry.kv.m_nLoadFlags, entry.kv.m_nTextureFlags,
-                                    entry.kv.m_EntryPath.c_str());
+        // Lay out the entry; the file is read a fragment at a time below.
+        VPKEntryBlock_t clientEntry = PackedStore_BeginEntryBlock(reader, entry.kv, 0);
         clientEntry.m_iPackFileIndex = 0x1337;
 
         VPKEntryBlock_t serverEntry;
@@ -828,116 +1102,88 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
                 serverEntry = clientEntry;
         }
 
-        size_t memoryOffset = 0;
         for (size_t i = 0; i < clientEntry.m_Fragments.size(); i++)
         {
             VPKChunkDescriptor_t &clientFrag = clientEntry.m_Fragments[i];
             VPKChunkDescriptor_t *pServerFrag = (includeServer ? &serverEntry.m_Fragments[i] : nullptr);
 
-            std::memcpy(chunkBuf.data(), fileData.data() + memoryOffset, clientFrag.m_nUncompressedSize);
-            memoryOffset += clientFrag.m_nUncompressedSize;
+            const size_t chunkSize = clientFrag.m_nUncompressedSize;
+            CByteBudget::CScopedBytes hold(InFlightBudget(), chunkSize);
+            const uint8_t* pChunk  = reader.Read(chunkSize);
 
-            size_t compSize = clientFrag.m_nUncompressedSize;
-            const uint8_t* finalDataPtr = chunkBuf.data();
+            const uint64_t chunkHash = compute_chunk_hash(pChunk, chunkSize);
 
-            if (entry.kv.m_bUseCompression)
+            // Compressed lazily, only once a side misses its dedup table.
+            size_t compSize = 0;
+            const uint8_t* finalDataPtr = nullptr;
+            auto compressOnce = [&]()
             {
-                if (builder.IsUsingZSTD())
+                if (finalDataPtr)
+                    return;
+                if (entry.kv.m_bUseCompression &&
+                    builder.CompressChunkCached(entry.kv.m_EntryPath, chunkHash, pChunk, chunkSize,
+                                                compBuf.data(), compSize))
                 {
-                    constexpr size_t markerSize = sizeof(R1D_marker);
-                    std::memcpy(compBuf.data(), &R1D_marker, markerSize);
-                    size_t zstdBound = ZSTD_compressBound(clientFrag.m_nUncompressedSize);
-                    if (zstdBound + markerSize > VPK_ENTRY_MAX_LEN)
-                        zstdBound = VPK_ENTRY_MAX_LEN - markerSize;
-                    size_t zstdResult = ZSTD_compress(compBuf.data() + markerSize,
-                                                      zstdBound,
-                                                      chunkBuf.data(),
-                                                      clientFrag.m_nUncompressedSize,
-                                                      6);
-                    if (!ZSTD_isError(zstdResult))
-                    {
-                        size_t totalSize = zstdResult + markerSize;
-                        if (totalSize < clientFrag.m_nUncompressedSize)
-                        {
-                            compSize = totalSize;
-                            finalDataPtr = compBuf.data();
-                        }
-                    }
+                    finalDataPtr = compBuf.data();
                 }
                 else
                 {
-                    size_t tmpCompSize = compSize;
-                    lzham_compress_status_t st = lzham_compress_memory(
-                        &builder.m_Encoder,
-                        compBuf.data(), &tmpCompSize,
-                        chunkBuf.data(), clientFrag.m_nUncompressedSize,
-                        nullptr);
-                    if (st == LZHAM_COMP_STATUS_SUCCESS && tmpCompSize < clientFrag.m_nUncompressedSize)
-                    {
-                        compSize = tmpCompSize;
-                        finalDataPtr = compBuf.data();
-                    }
+                    compSize = chunkSize;
+                    finalDataPtr = pChunk;
                 }
-            }
-
-            std::string chunkHash = compute_sha1_hex(chunkBuf.data(), clientFrag.m_nUncompressedSize);
-
-            // Write to client file.
-{
-    std::lock_guard<std::mutex> lock(clientMapMutex);
-    auto it = builder.m_ChunkHashMap.find(chunkHash);
-    if (it != builder.m_ChunkHashMap.end())
-    {
-         // Do not override the load/texture flags.
-         clientFrag.m_nPackFileOffset = it->second.m_nPackFileOffset;
-         clientFrag.m_nCompressedSize = it->second.m_nCompressedSize;
-         // (m_nUncompressedSize should already be correct)
-    }
-    else
-    {
-         uint64_t writePos = clientOffset.fetch_add(compSize);
-         ssize_t written = pwrite(fdClient, finalDataPtr, compSize, writePos);
-         if (written != (ssize_t)compSize)
-         {
-             std::cerr << "[ReVPK] ERROR: Failed to write client chunk for " << entry.kv.m_EntryPath << "\n";
-         }
-         clientFrag.m_nPackFileOffset = writePos;
-         clientFrag.m_nCompressedSize = compSize;
-         builder.m_ChunkHashMap[chunkHash] = clientFrag;
-    }
-}
-
+                PackStats().AddFragment(finalDataPtr != pChunk);
+            };
 
-            // Write to server file if needed.
-            if (pServerFrag)
+            // Store a chunk in one omega file unless its table already has it.
+            auto storeChunk = [&](CChunkDedupTable& table, std::atomic<uint64_t>& offset,
+                                  int fd, VPKChunkDescriptor_t& frag, const char* pSide)
             {
-                std::lock_guard<std::mutex> lock(serverMapMutex);
-                auto it = serverChunkMap.find(chunkHash);
-                if (it != serverChunkMap.end())
+                // Only the offset and compressed size are taken from a shared
+                // chunk; the load/texture flags stay ours.
+                VPKChunkDescriptor_t shared = frag;
+                const bool bShared = table.Find(chunkHash, shared);
+                PackStats().AddDedup(bShared);
+                if (!bShared)
                 {
-    pServerFrag->m_nPackFileOffset = it->second.m_nPackFileOffset;
-    pServerFrag->m_nCompressedSize = it->second.m_nCompressedSize;
+                    compressOnce();
+                    shared.m_nCompressedSize = compSize;
+                    const bool bExisting = table.FindOrInsert(chunkHash, shared,
+                        [&offset, &compSize](VPKChunkDescriptor_t& newFrag)
+                        {
+                            newFrag.m_nPackFileOffset = offset.fetch_add(compSize);
+                        });
 
-                }
-                else
-                {
-                    uint64_t writePos = serverOffset.fetch_add(compSize);
-                    ssize_t written = pwrite(fdServer, finalDataPtr, compSize, writePos);
-                    if (written != (ssize_t)compSize)
+                    if (!bExisting)
                     {
-                        std::cerr << "[ReVPK] ERROR: Failed to write server chunk for " << entry.kv.m_EntryPath << "\n";
+                        CPackStats::CScopedTimer timer(CPackStats::kTimerWrite, compSize);
+                        ssize_t written = pwrite(fd, finalDataPtr, compSize, shared.m_nPackFileOffset);
+                        if (written != (ssize_t)compSize)
+                        {
+                            std::cerr << "[ReVPK] ERROR: Failed to write " << pSide << " chunk for " << entry.kv.m_EntryPath << "\n";
+                        }
                     }
-                    pServerFrag->m_nPackFileOffset = writePos;
-                    pServerFrag->m_nCompressedSize = compSize;
-                    serverChunkMap[chunkHash] = *pServerFrag;
                 }
-            }
+                frag.m_nPackFileOffset = shared.m_nPackFileOffset;
+                frag.m_nCompressedSize = shared.m_nCompressedSize;
+            };
+
+            // Write to client file.
+            storeChunk(builder.m_ChunkTable, clientOffset, fdClient, clientFrag, "client");
+
+            // Write to server file if needed.
+            if (pServerFrag)
+                storeChunk(serverChunkTable, serverOffset, fdServer, *pServerFrag, "server");
         }
+        clientEntry.m_nFileCRC = reader.GetCRC();
+        if (includeServer)
+            serverEntry.m_nFileCRC = clientEntry.m_nFileCRC;
+        Progress().Advance(0, len);
         return std::make_pair(clientEntry, serverEntry);
     };
 
-    // Create a thread pool (implementation assumed elsewhere).
-    ThreadPool pool(numThreads);
+    // Create a thread pool with a bounded queue, so tasks are created
+    // about as fast as they run, not all up front.
+    ThreadPool pool(numThreads, size_t(numThreads) * 4);
 
     // Process English files first.
     for (const auto &entry : englishTasks)
@@ -956,7 +1202,7 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
                 LangMapKey key("english", finalMapName);
                 std::string englishKey = entry.mapName + "|" + entry.kv.m_EntryPath;
                 {
-                    std::lock_guard<std::mutex> lock(resultsMutex);
+                    std::unique_lock<std::mutex> lock = PackStats().Lock(resultsMutex, CPackStats::kLockResults);
                     englishClientEntries[englishKey] = entries.first;
                     if (!entries.second.m_EntryPath.empty())
                         englishServerEntries[englishKey] = entries.second;
@@ -966,7 +1212,7 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
                         serverDirEntries[key].push_back(entries.second);
                 }
             }
-            filesProcessed++;
+            Progress().Advance(1, 0);
         });
     }
 
@@ -983,7 +1229,7 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
             // If the non-English file doesn't exist, fall back to the English entry.
             if (!fs::exists(entry.filePath))
             {
-                std::unique_lock<std::mutex> lock(resultsMutex);
+                std::unique_lock<std::mutex> lock = PackStats().Lock(resultsMutex, CPackStats::kLockResults);
                 englishProcessedCV.wait(lock, [&]{ return englishProcessingComplete.load(); });
                 std::string englishKey = entry.mapName + "|" + entry.kv.m_EntryPath;
                 auto it = englishClientEntries.find(englishKey);
@@ -1004,7 +1250,7 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
                     if (itServer != englishServerEntries.end())
                         serverDirEntries[key].push_back(itServer->second);
                 }
-                filesProcessed++;
+                Progress().Advance(1, 0);
                 return;
             }
 
@@ -1020,24 +1266,24 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
                 }
                 LangMapKey key(entry.lang, finalMapName);
                 {
-                    std::lock_guard<std::mutex> lock(resultsMutex);
+                    std::unique_lock<std::mutex> lock = PackStats().Lock(resultsMutex, CPackStats::kLockResults);
                     clientDirEntries[key].push_back(entries.first);
                     if (!entries.second.m_EntryPath.empty())
                         serverDirEntries[key].push_back(entries.second);
                 }
             }
-            filesProcessed++;
+            Progress().Advance(1, 0);
         });
     }
 
     // Wait for all tasks to finish.
     pool.wait();
-    progressDone = true;
-    progressFuture.wait();
 
     // Close master file descriptors.
     close(fdClient);
     close(fdServer);
+    ReportChunkCache(chunkCache);
+    ReportProbeSkips(builder);
 
     // Build directory VPKs.
     for (const auto &entry : clientDirEntries)
@@ -1067,8 +1313,139 @@ static void DoPackDeltaCommon(const std::vector<std::string>& args)
     std::cout << "[ReVPK] Omega data VPKs built:\n"
               << "         Client: " << omegaClientPath << "\n"
               << "         Server: " << omegaServerPath << "\n";
+    ReportStats();
 }
 
+/**
+ * DoTrainDict() – train one ZSTD dictionary per file extension
+ *
+ * Samples the start of every compressed file in a pack manifest, grouped by
+ * extension, and keeps the dictionaries that make those samples smaller.
+ */
+static void DoTrainDict(const std::vector<std::string>& args)
+{
+    // usage:
+    //  revpk train-dict <locale> <context> <levelName> [workspace] [dictFile] [dictKiB]
+    if (args.size() < 5)
+    {
+        PrintUsage();
+        return;
+    }
+
+    namespace fs = std::filesystem;
+    std::string workspace = (args.size() > 5) ? args[5] : "ship";
+    if (!workspace.empty() && workspace.back() != '/' && workspace.back() != '\\')
+        workspace.push_back('/');
+
+    VPKPair_t pair(args[2].c_str(), args[3].c_str(), args[4].c_str(), 0);
+    const std::string baseName = PackedStore_GetDirBaseName(pair.m_DirName);
+    const fs::path manifestFile = fs::path(workspace) / "manifest" / (baseName + ".vdf");
+    const std::string dictFile = (args.size() > 6) ? args[6]
+        : (fs::path(workspace) / "manifest" / (baseName + ".zdict")).string();
+    const size_t dictCapacity = size_t((args.size() > 7) ? std::max(1, std::atoi(args[7].c_str())) : 64) * 1024;
+
+    std::vector<VPKKeyValues_t> buildList;
+    if (!LoadKeyValuesManifest(manifestFile.string(), buildList))
+    {
+        std::cerr << "[ReVPK] ERROR: Could not load manifest: " << manifestFile << "\n";
+        return;
+    }
+
+    // Files that get compressed, by lowercase extension.
+    std::map<std::string, std::vector<const VPKKeyValues_t*>> filesByExt;
+    for (const VPKKeyValues_t& kv : buildList)
+    {
+        std::string ext = PackedStore_GetExtension(kv.m_EntryPath);
+        if (kv.m_bUseCompression && !ext.empty())
+            filesByExt[ext].push_back(&kv);
+    }
+
+    // ZDICT wants roughly 100x the dictionary size in samples. Only the start
+    // of each file is sampled, since dictionaries matter for small fragments.
+    const size_t maxSampleBytes = 100 * dictCapacity;
+    constexpr size_t maxSampleSize = 128 * 1024;
+    constexpr size_t minSamples = 8;
+    const int evalLevel = VPKZstdParams_t().m_nLevel;
+
+    CZstdDictSet dicts;
+    ZSTD_CCtx* pCCtx = ZSTD_createCCtx();
+    std::vector<uint8_t> compBuf(ZSTD_compressBound(maxSampleSize));
+
+    for (const auto& extFiles : filesByExt)
+    {
+        const std::string& ext = extFiles.first;
+        std::vector<uint8_t> samples;
+        std::vector<size_t> sampleSizes;
+
+        for (const VPKKeyValues_t* pKV : extFiles.second)
+        {
+            if (samples.size() >= maxSampleBytes)
+                break;
+
+            // Manifest paths are opened as-is, like the packers do.
+            std::ifstream ifs(pKV->m_EntryPath, std::ios::binary);
+            if (!ifs.good())
+                continue;
+
+            std::vector<uint8_t> sample(maxSampleSize);
+            ifs.seekg(pKV->m_iPreloadSize);
+            ifs.read(reinterpret_cast<char*>(sample.data()), sample.size());
+            const size_t sampleSize = size_t(ifs.gcount());
+            if (sampleSize == 0)
+                continue;
+
+            samples.insert(samples.end(), sample.data(), sample.data() + sampleSize);
+            sampleSizes.push_back(sampleSize);
+        }
+
+        if (sampleSizes.size() < minSamples)
+            continue;
+
+        std::vector<uint8_t> dict;
+        const uint32_t dictId = CZstdDictSet::Train(samples, sampleSizes, dictCapacity, dict);
+        if (!dictId)
+        {
+            std::cout << "[ReVPK] ." << ext << ": not enough data to train on, skipped.\n";
+            continue;
+        }
+
+        // Compare the samples compressed with and without the dictionary.
+        size_t plainSize = 0, dictSize = 0, offset = 0;
+        for (size_t sampleSize : sampleSizes)
+        {
+            const uint8_t* pSample = samples.data() + offset;
+            offset += sampleSize;
+
+            size_t result = ZSTD_compressCCtx(pCCtx, compBuf.data(), compBuf.size(), pSample, sampleSize, evalLevel);
+            plainSize += ZSTD_isError(result) ? sampleSize : std::min(result, sampleSize);
+
+            result = ZSTD_compress_usingDict(pCCtx, compBuf.data(), compBuf.size(), pSample, sampleSize,
+                                             dict.data(), dict.size(), evalLevel);
+            dictSize += ZSTD_isError(result) ? sampleSize : std::min(result, sampleSize);
+        }
+
+        std::cout << "[ReVPK] ." << ext << ": " << sampleSizes.size() << " samples, "
+                  << plainSize << " -> " << dictSize << " bytes with a "
+                  << dict.size() << " byte dictionary";
+        if (dictSize * 100 >= plainSize * 99)
+        {
+            std::cout << ", less than 1% gain, skipped.\n";
+            continue;
+        }
+        std::cout << ".\n";
+        dicts.Add(ext, std::move(dict));
+    }
+    ZSTD_freeCCtx(pCCtx);
+
+    if (dicts.Empty())
+    {
+        std::cout << "[ReVPK] No dictionaries worth keeping.\n";
+        return;
+    }
+
+    if (dicts.Save(dictFile))
+        std::cout << "[ReVPK] Wrote " << dicts.GetCount() << " dictionaries to " << dictFile << "\n";
+}
 
 static void DoList(const std::vector<std::string>& args)
 {
@@ -1100,14 +1477,8 @@ static void DoList(const std::vector<std::string>& args)
     for (const auto& path : sortedPaths)
     {
         // Find the matching entry block
-        const auto& entryBlock = std::find_if(
-            vpkDir.m_EntryBlocks.begin(),
-            vpkDir.m_EntryBlocks.end(),
-            [&path](const VPKEntryBlock_t& entry) {
-                return entry.m_EntryPath == path;
-            });
-
-        if (entryBlock != vpkDir.m_EntryBlocks.end())
+        const VPKEntryBlock_t* entryBlock = vpkDir.FindEntry(path);
+        if (entryBlock)
         {
             size_t totalSize = 0;
             for (const auto& frag : entryBlock->m_Fragments)
@@ -1133,26 +1504,86 @@ static void DoList(const std::vector<std::string>& args)
               << (totalBytes / 1024 / 1024) << " MB)\n";
 }
 
-int main(int argc, char* argv[])
+/**
+ * DoBench() – measure codec, hashing and I/O throughput on real data
+ */
+static void DoBench(const std::vector<std::string>& args)
 {
-    if (argc < 2)
+    // usage:
+    //  revpk bench <locale> <context> <levelName> [workspace] [maxThreads]
+    //  revpk bench <vpkFile> [maxThreads]
+    if (args.size() < 3)
     {
         PrintUsage();
-        return 0;
+        return;
     }
+
+    VPKBenchConfig_t config;
+    size_t threadsArg;
+    if (args.size() < 5 || args[2].find(".vpk") != std::string::npos)
+    {
+        config.m_DirFile = args[2];
+        threadsArg = 3;
+    }
+    else
+    {
+        std::string workspace = (args.size() > 5) ? args[5] : "ship";
+        if (!workspace.empty() && workspace.back() != '/' && workspace.back() != '\\')
+            workspace.push_back('/');
+
+        VPKPair_t pair(args[2].c_str(), args[3].c_str(), args[4].c_str(), 0);
+        config.m_ManifestFile = workspace + "manifest/" + PackedStore_GetDirBaseName(pair.m_DirName) + ".vdf";
+        threadsArg = 6;
+    }
+
+    if (args.size() > threadsArg)
+        config.m_nMaxThreads = std::atoi(args[threadsArg].c_str());
+    if (HasOption("bench-mb"))
+        config.m_nMaxBytes = std::strtoull(GetOption("bench-mb").c_str(), nullptr, 10) * 1024 * 1024;
+
+    RunBench(config);
+}
+
+int main(int argc, char* argv[])
+{
     std::vector<std::string> args;
     args.reserve(argc);
     for (int i = 0; i < argc; ++i)
-        args.push_back(argv[i]);
+    {
+        std::string arg = argv[i];
+        if (i > 0 && arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            size_t eq = arg.find('=');
+            s_Options[arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2)] =
+                (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+            continue;
+        }
+        args.push_back(arg);
+    }
+
+    if (args.size() < 2)
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    if (HasOption("io") && !SetAsyncIo(GetOption("io")))
+    {
+        std::cerr << "[ReVPK] ERROR: Unknown I/O backend '" << GetOption("io") << "'\n";
+        return 1;
+    }
 
     const std::string& cmd = args[1];
 
     if      (cmd == PACK_COMMAND)      DoPack(args);
+    else if (cmd == PATCH_COMMAND)     DoPatch(args);
     else if (cmd == UNPACK_COMMAND)    DoUnpack(args);
     else if (cmd == "packmulti")       DoPackMulti(args);
     else if (cmd == "unpackmulti")     DoUnpackMulti(args);
     else if (cmd == "packdeltacommon")      DoPackDeltaCommon(args);
     else if (cmd == "ls")      DoList(args);
+    else if (cmd == TRAIN_DICT_COMMAND) DoTrainDict(args);
+    else if (cmd == BENCH_COMMAND)     DoBench(args);
     else                               PrintUsage();
 
     return 0;
@@ -0,0 +1,411 @@
+/**
+ * tests.cpp
+ *
+ * revpk_tests: round-trip checks of the on-disk formats, run by ctest. Each
+ * test builds a synthetic workspace in a scratch directory, so no game data
+ * is needed:
+ *  - pack then unpack, with LZHAM and with ZSTD
+ *  - patch then unpack, and which pack file each entry ends up in
+ *  - ZSTD dictionaries: saved next to the packs, named by the fragments
+ *  - chunk cache: records survive a reopen, torn ones are dropped
+ *
+ *   revpk_tests
+ */
+
+#include "packedstore.h"
+#include "chunkcache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static int s_nFailures = 0;
+
+static void Check(bool bOk, const std::string& what)
+{
+    if (!bOk)
+    {
+        std::cerr << "[ReVPK] FAIL: " << what << "\n";
+        s_nFailures++;
+    }
+}
+
+// ------------------------------------------------------------------------
+//  Synthetic input
+// ------------------------------------------------------------------------
+// Script-like text; compresses well, and better with a dictionary.
+static std::vector<uint8_t> MakeText(size_t nLen, uint32_t nSeed)
+{
+    std::string text;
+    for (uint32_t i = 0; text.size() < nLen; i++)
+    {
+        const uint32_t n = (i * 2654435761u) ^ nSeed;
+        text += "function Weapon_" + std::to_string(n % 97) + "_Think( entity player )\n{\n"
+                "\tif ( !IsValid( player ) )\n\t\treturn " + std::to_string(n % 13) + "\n}\n";
+    }
+    text.resize(nLen);
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// xorshift bytes; won't compress.
+static std::vector<uint8_t> MakeNoise(size_t nLen, uint32_t nSeed)
+{
+    std::vector<uint8_t> data(nLen);
+    uint32_t x = nSeed | 1;
+    for (uint8_t& b : data)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        b = uint8_t(x);
+    }
+    return data;
+}
+
+static bool WriteFile(const fs::path& path, const std::vector<uint8_t>& data)
+{
+    fs::create_directories(path.parent_path());
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+    return bool(ofs);
+}
+
+static std::vector<uint8_t> ReadFile(const fs::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+/** A workspace: files by entry path, and the manifest listing them. */
+struct TestWorkspace_t
+{
+    fs::path m_Root;
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> m_Files;
+
+    void Add(const std::string& entryPath, std::vector<uint8_t> data)
+    {
+        for (auto& file : m_Files)
+        {
+            if (file.first == entryPath)
+            {
+                file.second = std::move(data);
+                return;
+            }
+        }
+        m_Files.emplace_back(entryPath, std::move(data));
+    }
+
+    // Write every file and the manifest for pair.
+    bool Write(const VPKPair_t& pair) const
+    {
+        // The manifest is a CSV table, one row per entry.
+        std::string manifest = "filePath,preloadSize,useCompression,deDuplicate\n";
+        for (const auto& file : m_Files)
+        {
+            if (!WriteFile(m_Root / file.first, file.second))
+                return false;
+            manifest += file.first + ",0,1,1\n";
+        }
+
+        const fs::path manifestPath =
+            m_Root / "manifest" / (PackedStore_GetDirBaseName(pair.m_DirName) + ".vdf");
+        return WriteFile(manifestPath, std::vector<uint8_t>(manifest.begin(), manifest.end()));
+    }
+};
+
+// Manifest entries are paths relative to the working directory, as when
+// revpk is run from the workspace.
+static void PackOrPatch(CPackedStoreBuilder& builder, const TestWorkspace_t& workspace,
+                        const VPKPair_t& pair, const fs::path& buildPath, bool bPatch)
+{
+    const fs::path cwd = fs::current_path();
+    fs::current_path(workspace.m_Root);
+    if (bPatch)
+        builder.PatchStore(pair, workspace.m_Root.string().c_str(), buildPath.string().c_str());
+    else
+        builder.PackStore(pair, workspace.m_Root.string().c_str(), buildPath.string().c_str());
+    fs::current_path(cwd);
+}
+
+// Unpack dirPath with a fresh builder and compare every file with workspace.
+static void CheckUnpacked(const std::string& test, const fs::path& dirPath,
+                          const TestWorkspace_t& workspace, const fs::path& outPath)
+{
+    const VPKDir_t vpkDir(dirPath.string());
+    Check(!vpkDir.Failed(), test + ": directory parses");
+    Check(vpkDir.m_EntryBlocks.size() == workspace.m_Files.size(),
+          test + ": " + std::to_string(vpkDir.m_EntryBlocks.size()) + " entries, expected " +
+          std::to_string(workspace.m_Files.size()));
+
+    CPackedStoreBuilder builder;
+    builder.UnpackStore(vpkDir, outPath.string().c_str());
+
+    for (const auto& file : workspace.m_Files)
+        Check(ReadFile(outPath / file.first) == file.second, test + ": " + file.first + " round-trips");
+}
+
+// ------------------------------------------------------------------------
+//  Tests
+// ------------------------------------------------------------------------
+static TestWorkspace_t MakeWorkspace(const fs::path& root)
+{
+    TestWorkspace_t workspace;
+    workspace.m_Root = root;
+    workspace.Add("scripts/vscripts/weapons.nut", MakeText(20000, 1));
+    workspace.Add("scripts/vscripts/weapons_copy.nut", MakeText(20000, 1)); // deduplicated
+    workspace.Add("materials/models/noise.vtf", MakeNoise(300000, 2));
+    workspace.Add("resource/ui/tiny.txt", MakeText(100, 3));
+
+    // Three fragments: two of text, one of noise.
+    std::vector<uint8_t> big = MakeText(VPK_ENTRY_MAX_LEN + VPK_ENTRY_MAX_LEN / 2, 4);
+    const std::vector<uint8_t> noise = MakeNoise(VPK_ENTRY_MAX_LEN, 5);
+    big.insert(big.end(), noise.begin(), noise.end());
+    workspace.Add("models/weapons/big.mdl", std::move(big));
+    return workspace;
+}
+
+static void TestPackUnpack(const fs::path& scratch, const char* compressLevel)
+{
+    const std::string test = std::string("pack/unpack (") + compressLevel + ")";
+    const fs::path root = scratch / (std::string("pack_") + compressLevel);
+
+    const TestWorkspace_t workspace = MakeWorkspace(root / "ship");
+    const VPKPair_t pair("english", "server", "mp_test", 0);
+    Check(workspace.Write(pair), test + ": workspace written");
+
+    CPackedStoreBuilder builder;
+    Check(builder.InitLzEncoder(0, compressLevel), test + ": compression level accepted");
+    PackOrPatch(builder, workspace, pair, root / "vpk", false);
+
+    const fs::path dirPath = root / "vpk" / pair.m_DirName;
+    CheckUnpacked(test, dirPath, workspace, root / "out");
+
+    // Identical files share their fragments.
+    const VPKDir_t vpkDir(dirPath.string());
+    const VPKEntryBlock_t* pA = vpkDir.FindEntry("scripts/vscripts/weapons.nut");
+    const VPKEntryBlock_t* pB = vpkDir.FindEntry("scripts/vscripts/weapons_copy.nut");
+    Check(pA && pB && pA->m_Fragments.front().m_nPackFileOffset == pB->m_Fragments.front().m_nPackFileOffset,
+          test + ": duplicate entries share a fragment");
+}
+
+static void TestPatchUnpack(const fs::path& scratch)
+{
+    const std::string test = "patch/unpack";
+    const fs::path root = scratch / "patch";
+
+    TestWorkspace_t workspace = MakeWorkspace(root / "ship");
+    const VPKPair_t pair("english", "server", "mp_test", 0);
+    Check(workspace.Write(pair), test + ": workspace written");
+
+    {
+        CPackedStoreBuilder builder;
+        builder.InitLzEncoder(0, "zstd");
+        PackOrPatch(builder, workspace, pair, root / "vpk", false);
+    }
+
+    // Change one file, add one, drop one; the rest must be reused in place.
+    workspace.Add("materials/models/noise.vtf", MakeNoise(300000, 6));
+    workspace.Add("scripts/vscripts/new.nut", MakeText(5000, 7));
+    workspace.m_Files.erase(std::remove_if(workspace.m_Files.begin(), workspace.m_Files.end(),
+        [](const auto& file) { return file.first == "resource/ui/tiny.txt"; }), workspace.m_Files.end());
+    fs::remove(workspace.m_Root / "resource/ui/tiny.txt");
+    Check(workspace.Write(pair), test + ": workspace updated");
+
+    {
+        CPackedStoreBuilder builder;
+        builder.InitLzEncoder(0, "zstd");
+        PackOrPatch(builder, workspace, pair, root / "vpk", true);
+    }
+
+    const fs::path dirPath = root / "vpk" / pair.m_DirName;
+    const VPKDir_t vpkDir(dirPath.string());
+    Check(!vpkDir.FindEntry("resource/ui/tiny.txt"), test + ": removed entry is gone");
+    for (const char* path : { "scripts/vscripts/weapons.nut", "models/weapons/big.mdl" })
+    {
+        const VPKEntryBlock_t* pBlock = vpkDir.FindEntry(path);
+        Check(pBlock && pBlock->m_iPackFileIndex == 0, test + ": " + path + " stays in pak000_000");
+    }
+    for (const char* path : { "materials/models/noise.vtf", "scripts/vscripts/new.nut" })
+    {
+        const VPKEntryBlock_t* pBlock = vpkDir.FindEntry(path);
+        Check(pBlock && pBlock->m_iPackFileIndex == 1, test + ": " + path + " goes to pak000_001");
+    }
+
+    CheckUnpacked(test, dirPath, workspace, root / "out");
+}
+
+static void TestZstdDicts(const fs::path& scratch)
+{
+    const std::string test = "zstd dictionaries";
+    const fs::path root = scratch / "dict";
+
+    std::vector<uint8_t> samples;
+    std::vector<size_t> sampleSizes;
+    for (uint32_t i = 0; i < 400; i++)
+    {
+        const std::vector<uint8_t> sample = MakeText(1000 + (i * 37) % 1000, 100 + i);
+        samples.insert(samples.end(), sample.begin(), sample.end());
+        sampleSizes.push_back(sample.size());
+    }
+    std::vector<uint8_t> dict;
+    const uint32_t nDictId = CZstdDictSet::Train(samples, sampleSizes, 16 * 1024, dict);
+    Check(nDictId != 0, test + ": dictionary trained");
+    if (!nDictId)
+        return;
+
+    TestWorkspace_t workspace;
+    workspace.m_Root = root / "ship";
+    for (uint32_t i = 0; i < 8; i++)
+        workspace.Add("scripts/vscripts/script" + std::to_string(i) + ".nut", MakeText(3000, 200 + i));
+    workspace.Add("materials/models/noise.vtf", MakeNoise(50000, 9));
+    const VPKPair_t pair("english", "client", "mp_test", 0);
+    Check(workspace.Write(pair), test + ": workspace written");
+
+    CPackedStoreBuilder builder;
+    builder.InitLzEncoder(0, "zstd");
+    Check(builder.m_ZstdDicts.Add("nut", dict), test + ": dictionary added");
+    PackOrPatch(builder, workspace, pair, root / "vpk", false);
+
+    // Saved next to the packs, and loads back with its extension.
+    const fs::path dirPath = root / "vpk" / pair.m_DirName;
+    const VPKDir_t vpkDir(dirPath.string());
+    CZstdDictSet loaded;
+    Check(loaded.Load((root / "vpk" / vpkDir.GetDictFileName()).string()), test + ": dictionary file loads");
+    Check(loaded.GetCount() == 1 && loaded.GetDictIdForPath("a/b.nut") == nDictId &&
+          loaded.GetDictIdForPath("a/b.txt") == 0, test + ": dictionary file round-trips");
+
+    // Compressed .nut fragments carry the dictionary ID after R1D_marker.
+    for (const VPKEntryBlock_t& block : vpkDir.m_EntryBlocks)
+    {
+        if (PackedStore_GetExtension(block.m_EntryPath) != "nut")
+            continue;
+        const VPKChunkDescriptor_t& frag = block.m_Fragments.front();
+        Check(frag.m_nCompressedSize < frag.m_nUncompressedSize, test + ": " + block.m_EntryPath + " compresses");
+
+        uint8_t header[sizeof(R1D_marker) + sizeof(uint32_t)] = {};
+        std::ifstream ifs(root / "vpk" / vpkDir.GetPackFileNameForIndex(block.m_iPackFileIndex), std::ios::binary);
+        ifs.seekg(std::streamoff(frag.m_nPackFileOffset));
+        ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+
+        uint64_t nMarker = 0;
+        uint32_t nFragDictId = 0;
+        std::memcpy(&nMarker, header, sizeof(nMarker));
+        std::memcpy(&nFragDictId, header + sizeof(nMarker), sizeof(nFragDictId));
+        Check(ifs && nMarker == R1D_marker && nFragDictId == nDictId,
+              test + ": " + block.m_EntryPath + " names its dictionary");
+    }
+
+    CheckUnpacked(test, dirPath, workspace, root / "out");
+}
+
+static void TestChunkCacheReopen(const fs::path& scratch)
+{
+    const std::string test = "chunk cache";
+    const fs::path cacheDir = scratch / "cache";
+
+    const std::vector<uint8_t> blobA = MakeNoise(1000, 11);
+    const std::vector<uint8_t> blobB = MakeNoise(2000, 12);
+    std::vector<uint8_t> dst(4096);
+    size_t nDstLen = 0;
+    bool bCompressed = false;
+
+    {
+        CChunkCache cache;
+        Check(cache.Open(cacheDir.string()), test + ": opens");
+        cache.Store(1, 5000, 7, blobA.data(), blobA.size());
+        cache.Store(2, 6000, 7, nullptr, 0); // didn't compress
+        cache.Store(3, 7000, 7, blobB.data(), blobB.size());
+
+        // Only one process at a time.
+        CChunkCache other;
+        Check(!other.Open(cacheDir.string()), test + ": second open is refused");
+    }
+
+    {
+        CChunkCache cache;
+        Check(cache.Open(cacheDir.string()) && cache.GetEntries() == 3, test + ": all records reload");
+        Check(cache.Lookup(1, 5000, 7, dst.data(), dst.size(), nDstLen, bCompressed) && bCompressed &&
+              std::vector<uint8_t>(dst.begin(), dst.begin() + nDstLen) == blobA, test + ": blob round-trips");
+        Check(cache.Lookup(2, 6000, 7, dst.data(), dst.size(), nDstLen, bCompressed) && !bCompressed,
+              test + ": uncompressed record round-trips");
+        Check(!cache.Lookup(1, 5000, 8, dst.data(), dst.size(), nDstLen, bCompressed),
+              test + ": other codec key misses");
+    }
+
+    // An interrupted run: half a record at the end of the index, and the
+    // last blob cut short.
+    const fs::path indexPath = cacheDir / "chunks.idx";
+    const fs::path blobPath  = cacheDir / "chunks.bin";
+    const uintmax_t nIndexSize = fs::file_size(indexPath);
+    {
+        std::ofstream ofs(indexPath, std::ios::binary | std::ios::app);
+        const std::vector<uint8_t> torn = MakeNoise(17, 13);
+        ofs.write(reinterpret_cast<const char*>(torn.data()), std::streamsize(torn.size()));
+    }
+    fs::resize_file(blobPath, blobA.size() + blobB.size() / 2);
+
+    {
+        CChunkCache cache;
+        Check(cache.Open(cacheDir.string()) && cache.GetEntries() == 2, test + ": torn records are dropped");
+        Check(fs::file_size(indexPath) == nIndexSize, test + ": index is realigned");
+        Check(!cache.Lookup(3, 7000, 7, dst.data(), dst.size(), nDstLen, bCompressed),
+              test + ": record past the blob store misses");
+        Check(cache.Lookup(1, 5000, 7, dst.data(), dst.size(), nDstLen, bCompressed),
+              test + ": intact record still hits");
+
+        // Appends after the repair stay readable.
+        cache.Store(3, 7000, 7, blobB.data(), blobB.size());
+    }
+
+    {
+        CChunkCache cache;
+        Check(cache.Open(cacheDir.string()) &&
+              cache.Lookup(3, 7000, 7, dst.data(), dst.size(), nDstLen, bCompressed) &&
+              std::vector<uint8_t>(dst.begin(), dst.begin() + nDstLen) == blobB,
+              test + ": record stored after a repair reloads");
+    }
+
+    // A corrupted blob is caught by its hash.
+    {
+        std::fstream fsBlob(blobPath, std::ios::binary | std::ios::in | std::ios::out);
+        fsBlob.seekp(10);
+        fsBlob.put(char(blobA[10] ^ 0xFF));
+    }
+    {
+        CChunkCache cache;
+        Check(cache.Open(cacheDir.string()) &&
+              !cache.Lookup(1, 5000, 7, dst.data(), dst.size(), nDstLen, bCompressed),
+              test + ": corrupt blob misses");
+    }
+}
+
+int main()
+{
+    const fs::path scratch = fs::temp_directory_path() / ("revpk_tests_" + std::to_string(getpid()));
+    fs::create_directories(scratch);
+
+    TestPackUnpack(scratch, "uber");
+    TestPackUnpack(scratch, "zstd");
+    TestPatchUnpack(scratch);
+    TestZstdDicts(scratch);
+    TestChunkCacheReopen(scratch);
+
+    std::error_code ec;
+    fs::remove_all(scratch, ec);
+
+    if (s_nFailures)
+    {
+        std::cerr << "[ReVPK] " << s_nFailures << " check(s) failed.\n";
+        return 1;
+    }
+    std::cout << "[ReVPK] All tests passed.\n";
+    return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ * threadpool.cpp
+ *
+ * Implementation of the work-stealing thread pool and the in-flight byte
+ * budget (see threadpool.h).
+ */
+
+#include "threadpool.h"
+#include "packstats.h"
+
+// Pool and deque of the worker running on this thread, so tasks queued
+// from inside a task stay on the worker that queued them.
+static thread_local const ThreadPool* t_pCurrentPool = nullptr;
+static thread_local size_t t_iCurrentWorker = 0;
+
+// ------------------------------------------------------------------------
+//  ThreadPool
+// ------------------------------------------------------------------------
+ThreadPool::ThreadPool(size_t numThreads, size_t maxQueued)
+: m_nMaxQueued(maxQueued)
+{
+    if (numThreads == 0)
+        numThreads = 1;
+
+    m_Workers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+        m_Workers.push_back(std::make_unique<Worker_t>());
+
+    // Start them only once every deque exists; they steal from each other.
+    for (size_t i = 0; i < numThreads; i++)
+        m_Workers[i]->m_Thread = std::thread([this, i]() { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bStop = true;
+    }
+    m_WorkCV.notify_all();
+    for (std::unique_ptr<Worker_t>& worker : m_Workers)
+        worker->m_Thread.join();
+}
+
+void ThreadPool::Push(CTask&& task, CTaskGroup* pGroup)
+{
+    const bool bFromWorker = (t_pCurrentPool == this);
+
+    if (m_nMaxQueued > 0 && !bFromWorker && m_nQueued.load() >= m_nMaxQueued)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_nBlockedProducers++;
+        m_SpaceCV.wait(lock, [this]() { return m_nQueued.load() < m_nMaxQueued; });
+        m_nBlockedProducers--;
+    }
+
+    pGroup->m_nPending.fetch_add(1);
+
+    const size_t iWorker = bFromWorker ? t_iCurrentWorker
+                                       : m_nNextWorker.fetch_add(1, std::memory_order_relaxed) % m_Workers.size();
+    Worker_t& worker = *m_Workers[iWorker];
+
+    // Count the task before publishing it: a thief may take it, and count
+    // it off, as soon as it is in the deque, which must not wrap m_nQueued.
+    // m_nQueued also goes up before m_nSleepers is read, and a worker bumps
+    // m_nSleepers before it rechecks m_nQueued, so one of the two always
+    // sees the other and no wakeup is lost.
+    m_nQueued.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(worker.m_Mutex);
+        worker.m_Tasks.push_back({ std::move(task), pGroup });
+    }
+
+    if (m_nSleepers.load() > 0)
+    {
+        { std::lock_guard<std::mutex> lock(m_Mutex); }
+        m_WorkCV.notify_one();
+    }
+}
+
+bool ThreadPool::TryPop(size_t iWorker, QueuedTask_t& outTask)
+{
+    Worker_t& worker = *m_Workers[iWorker];
+    std::lock_guard<std::mutex> lock(worker.m_Mutex);
+    if (worker.m_Tasks.empty())
+        return false;
+
+    outTask = std::move(worker.m_Tasks.front());
+    worker.m_Tasks.pop_front();
+    m_nQueued.fetch_sub(1);
+    return true;
+}
+
+bool ThreadPool::TrySteal(size_t iWorker, QueuedTask_t& outTask)
+{
+    // Oldest first, like the owner: the entry the pack writer waits on
+    // is always at the front of some deque.
+    for (size_t i = 1; i < m_Workers.size(); i++)
+    {
+        if (TryPop((iWorker + i) % m_Workers.size(), outTask))
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::Run(QueuedTask_t& task)
+{
+    if (m_nBlockedProducers.load() > 0)
+    {
+        { std::lock_guard<std::mutex> lock(m_Mutex); }
+        m_SpaceCV.notify_one();
+    }
+
+    task.m_Task();
+    task.m_Task = CTask();
+
+    // Nothing may touch the group after the last task is counted off;
+    // its owner can return from wait() and destroy it right away.
+    if (task.m_pGroup->m_nPending.fetch_sub(1) == 1)
+    {
+        { std::lock_guard<std::mutex> lock(m_Mutex); }
+        m_GroupCV.notify_all();
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t iWorker)
+{
+    t_pCurrentPool = this;
+    t_iCurrentWorker = iWorker;
+
+    QueuedTask_t task;
+    while (true)
+    {
+        if (TryPop(iWorker, task) || TrySteal(iWorker, task))
+        {
+            Run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_nSleepers++;
+        m_WorkCV.wait(lock, [this]() { return m_bStop || m_nQueued.load() > 0; });
+        m_nSleepers--;
+        if (m_bStop && m_nQueued.load() == 0)
+            return;
+    }
+}
+
+void ThreadPool::wait(CTaskGroup& group)
+{
+    if (group.m_nPending.load() == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_GroupCV.wait(lock, [&group]() { return group.m_nPending.load() == 0; });
+}
+
+// ------------------------------------------------------------------------
+//  CByteBudget
+// ------------------------------------------------------------------------
+CByteBudget& InFlightBudget()
+{
+    static CByteBudget budget;
+    return budget;
+}
+
+void CByteBudget::SetLimit(uint64_t nLimit)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_nLimit = nLimit;
+    }
+    m_CV.notify_all();
+}
+
+void CByteBudget::Acquire(uint64_t nBytes)
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    auto fits = [this, nBytes]() {
+        return m_nLimit == 0 || m_nInFlight == 0 || m_nInFlight + nBytes <= m_nLimit;
+    };
+    if (!fits())
+    {
+        const CPackStats::Clock_t::time_point start = CPackStats::Clock_t::now();
+        m_CV.wait(lock, fits);
+        PackStats().AddLockWait(CPackStats::kLockBudget, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            CPackStats::Clock_t::now() - start).count()));
+    }
+    m_nInFlight += nBytes;
+}
+
+void CByteBudget::Release(uint64_t nBytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_nInFlight -= nBytes;
+    }
+    m_CV.notify_all();
+}
@@ -0,0 +1,264 @@
+/**
+ * threadpool.h
+ *
+ * Work-stealing thread pool used by the pack and unpack paths, and the
+ * in-flight byte budget shared by its workers.
+ *
+ * Every worker owns a deque of tasks with its own lock. Tasks queued from
+ * outside the pool are dealt round-robin over the deques, tasks queued by a
+ * worker go to its own, and a worker that runs dry steals from the others,
+ * so 100k+ tiny tasks (one per fragment when unpacking) don't all serialize
+ * on one queue. Each worker takes its tasks in the order they were queued
+ * and steals the oldest ones first; the in-order pack writer relies on that
+ * (an entry is never stuck behind later ones on a blocked worker).
+ *
+ * Tasks are kept in CTask, which stores small callables inline instead of
+ * allocating. Completion is counted per CTaskGroup, so waiting for a batch
+ * doesn't wait for unrelated tasks, and the pool-wide lock is only taken
+ * when a group finishes or a worker goes to sleep.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// ------------------------------------------------------------------
+// CTask:
+//  Move-only void() callable. Callables up to INLINE_SIZE bytes live
+//  inside the task; bigger ones are allocated.
+// ------------------------------------------------------------------
+class CTask
+{
+public:
+    static constexpr size_t INLINE_SIZE = 64;
+
+    CTask() = default;
+
+    template <typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, CTask>::value>>
+    CTask(Fn&& fn)
+    {
+        using Func_t = std::decay_t<Fn>;
+        if constexpr (sizeof(Func_t) <= INLINE_SIZE && alignof(Func_t) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<Func_t>::value)
+        {
+            new (m_Storage) Func_t(std::forward<Fn>(fn));
+            m_pOps = &InlineOps_t<Func_t>::s_Ops;
+        }
+        else
+        {
+            new (m_Storage) Func_t*(new Func_t(std::forward<Fn>(fn)));
+            m_pOps = &HeapOps_t<Func_t>::s_Ops;
+        }
+    }
+
+    CTask(CTask&& other) noexcept { MoveFrom(other); }
+    CTask& operator=(CTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+    ~CTask() { Reset(); }
+
+    CTask(const CTask&) = delete;
+    CTask& operator=(const CTask&) = delete;
+
+    explicit operator bool() const { return m_pOps != nullptr; }
+    void operator()() { m_pOps->m_pfnInvoke(m_Storage); }
+
+private:
+    struct Ops_t
+    {
+        void (*m_pfnInvoke)(void* pStorage);
+        void (*m_pfnMove)(void* pDst, void* pSrc); // leaves pSrc destroyed
+        void (*m_pfnDestroy)(void* pStorage);
+    };
+
+    template <typename Func_t>
+    struct InlineOps_t
+    {
+        static void Invoke(void* p) { (*static_cast<Func_t*>(p))(); }
+        static void Move(void* pDst, void* pSrc)
+        {
+            new (pDst) Func_t(std::move(*static_cast<Func_t*>(pSrc)));
+            static_cast<Func_t*>(pSrc)->~Func_t();
+        }
+        static void Destroy(void* p) { static_cast<Func_t*>(p)->~Func_t(); }
+        static constexpr Ops_t s_Ops = { &Invoke, &Move, &Destroy };
+    };
+
+    template <typename Func_t>
+    struct HeapOps_t
+    {
+        static void Invoke(void* p) { (**static_cast<Func_t**>(p))(); }
+        static void Move(void* pDst, void* pSrc) { new (pDst) Func_t*(*static_cast<Func_t**>(pSrc)); }
+        static void Destroy(void* p) { delete *static_cast<Func_t**>(p); }
+        static constexpr Ops_t s_Ops = { &Invoke, &Move, &Destroy };
+    };
+
+    void MoveFrom(CTask& other)
+    {
+        m_pOps = other.m_pOps;
+        if (m_pOps)
+            m_pOps->m_pfnMove(m_Storage, other.m_Storage);
+        other.m_pOps = nullptr;
+    }
+
+    void Reset()
+    {
+        if (m_pOps)
+            m_pOps->m_pfnDestroy(m_Storage);
+        m_pOps = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char m_Storage[INLINE_SIZE];
+    const Ops_t* m_pOps = nullptr;
+};
+
+// ------------------------------------------------------------------
+// CTaskGroup:
+//  Tasks queued with it that haven't finished yet; wait for them with
+//  ThreadPool::wait(group). Must outlive its tasks.
+// ------------------------------------------------------------------
+class CTaskGroup
+{
+public:
+    CTaskGroup() = default;
+
+    CTaskGroup(const CTaskGroup&) = delete;
+    CTaskGroup& operator=(const CTaskGroup&) = delete;
+
+    bool IsDone() const { return m_nPending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<size_t> m_nPending{0};
+};
+
+// ------------------------------------------------------------------
+// ThreadPool:
+//  With maxQueued > 0, enqueue() from outside the pool blocks while
+//  that many tasks are waiting, so producers can't run arbitrarily
+//  far ahead of the workers. Tasks queued by a worker never block.
+// ------------------------------------------------------------------
+class ThreadPool
+{
+public:
+    ThreadPool(size_t numThreads, size_t maxQueued = 0);
+    ~ThreadPool(); // runs what's still queued, then joins
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Enqueue a task into the pool.
+    template <typename Fn>
+    void enqueue(Fn&& fn) { Push(CTask(std::forward<Fn>(fn)), &m_DefaultGroup); }
+
+    template <typename Fn>
+    void enqueue(CTaskGroup& group, Fn&& fn) { Push(CTask(std::forward<Fn>(fn)), &group); }
+
+    // Block until every task queued without a group has completed.
+    void wait() { wait(m_DefaultGroup); }
+    void wait(CTaskGroup& group);
+
+private:
+    struct QueuedTask_t
+    {
+        CTask       m_Task;
+        CTaskGroup* m_pGroup = nullptr;
+    };
+
+    struct Worker_t
+    {
+        std::mutex               m_Mutex;
+        std::deque<QueuedTask_t> m_Tasks;
+        std::thread              m_Thread;
+    };
+
+    void Push(CTask&& task, CTaskGroup* pGroup);
+    bool TryPop(size_t iWorker, QueuedTask_t& outTask);
+    bool TrySteal(size_t iWorker, QueuedTask_t& outTask);
+    void Run(QueuedTask_t& task);
+    void WorkerLoop(size_t iWorker);
+
+    std::vector<std::unique_ptr<Worker_t>> m_Workers;
+    std::atomic<size_t>     m_nNextWorker{0}; // round-robin target for outside tasks
+    std::atomic<size_t>     m_nQueued{0};
+    size_t                  m_nMaxQueued;
+
+    // Sleeping workers, blocked producers and group waiters; only taken
+    // when one of them has to block or be woken.
+    std::mutex              m_Mutex;
+    std::condition_variable m_WorkCV;     // tasks queued, or stopping
+    std::condition_variable m_SpaceCV;    // room in a bounded queue
+    std::condition_variable m_GroupCV;    // a group finished
+    std::atomic<size_t>     m_nSleepers{0};
+    std::atomic<size_t>     m_nBlockedProducers{0};
+    bool                    m_bStop = false;
+
+    CTaskGroup              m_DefaultGroup;
+};
+
+// ------------------------------------------------------------------
+// CByteBudget:
+//  Caps the bytes of file data the workers hold at once, across all
+//  pools and archive writers. Acquire() blocks until nBytes fit; a
+//  request bigger than the whole budget goes ahead once nothing else
+//  is in flight. Acquire while holding nothing else from the budget,
+//  so every holder can finish and release.
+// ------------------------------------------------------------------
+class CByteBudget
+{
+public:
+    /** Holds nBytes of the budget for its lifetime. */
+    class CScopedBytes
+    {
+    public:
+        CScopedBytes(CByteBudget& budget, uint64_t nBytes)
+        : m_Budget(budget), m_nBytes(nBytes)
+        {
+            m_Budget.Acquire(m_nBytes);
+        }
+        ~CScopedBytes() { m_Budget.Release(m_nBytes); }
+
+        CScopedBytes(const CScopedBytes&) = delete;
+        CScopedBytes& operator=(const CScopedBytes&) = delete;
+
+    private:
+        CByteBudget& m_Budget;
+        uint64_t     m_nBytes;
+    };
+
+    // 0 means unlimited.
+    void     SetLimit(uint64_t nLimit);
+    uint64_t GetLimit() const { return m_nLimit; }
+
+    void Acquire(uint64_t nBytes);
+    void Release(uint64_t nBytes);
+
+private:
+    std::mutex              m_Mutex;
+    std::condition_variable m_CV;
+    uint64_t                m_nLimit = 0;
+    uint64_t                m_nInFlight = 0;
+};
+
+// The in-flight budget of this run.
+CByteBudget& InFlightBudget();
+
+#endif // THREADPOOL_H
@@ -0,0 +1,221 @@
+/**
+ * zstddict.cpp
+ *
+ * Implementation of the per-extension ZSTD dictionary set (see zstddict.h).
+ */
+
+#include "zstddict.h"
+#include "packedstore.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include <zdict.h>
+
+// On-disk layout of a dictionary file: a header, then for every dictionary
+// its ID, extension (length-prefixed) and bytes.
+static constexpr uint32_t ZSTDDICT_MAGIC   = 0x53445A52; // 'RZDS'
+static constexpr uint32_t ZSTDDICT_VERSION = 1;
+// Far above anything train-dict makes; rejects corrupt sizes before allocating.
+static constexpr uint32_t ZSTDDICT_MAX_SIZE = 16 * 1024 * 1024;
+
+struct ZstdDictHeader_t
+{
+    uint32_t m_nMagic;
+    uint32_t m_nVersion;
+    uint32_t m_nCount;
+};
+static_assert(sizeof(ZstdDictHeader_t) == 12, "dictionary file header must be 12 bytes");
+
+// ------------------------------------------------------------------------
+//  CZstdDictSet
+// ------------------------------------------------------------------------
+CZstdDictSet::~CZstdDictSet()
+{
+    for (auto& it : m_Dicts)
+    {
+        ZSTD_freeDDict(it.second.m_pDDict);
+        for (auto& cdict : it.second.m_CDicts)
+            ZSTD_freeCDict(cdict.second);
+    }
+}
+
+uint32_t CZstdDictSet::Train(const std::vector<uint8_t>& samples,
+                             const std::vector<size_t>& sampleSizes,
+                             size_t nDictCapacity, std::vector<uint8_t>& outDict)
+{
+    outDict.resize(nDictCapacity);
+    const size_t dictSize = ZDICT_trainFromBuffer(outDict.data(), outDict.size(),
+                                                  samples.data(), sampleSizes.data(),
+                                                  unsigned(sampleSizes.size()));
+    if (ZDICT_isError(dictSize))
+    {
+        outDict.clear();
+        return 0;
+    }
+    outDict.resize(dictSize);
+
+    // Fragments store the ID where a plain frame has its magic number.
+    const uint32_t dictId = ZDICT_getDictID(outDict.data(), outDict.size());
+    if (dictId == ZSTD_MAGICNUMBER)
+    {
+        outDict.clear();
+        return 0;
+    }
+    return dictId;
+}
+
+bool CZstdDictSet::Add(const std::string& ext, std::vector<uint8_t> dict)
+{
+    const uint32_t dictId = ZDICT_getDictID(dict.data(), dict.size());
+    if (dictId == 0 || dictId == ZSTD_MAGICNUMBER)
+    {
+        std::cerr << "[ReVPK] ERROR: Invalid ZSTD dictionary for ." << ext << "\n";
+        return false;
+    }
+
+    if (m_Dicts.find(dictId) == m_Dicts.end())
+    {
+        Dict_t& entry = m_Dicts[dictId];
+        entry.m_Extension = ext;
+        entry.m_Data = std::move(dict);
+        entry.m_pDDict = ZSTD_createDDict(entry.m_Data.data(), entry.m_Data.size());
+        if (!entry.m_pDDict)
+        {
+            std::cerr << "[ReVPK] ERROR: Cannot load ZSTD dictionary " << dictId << "\n";
+            m_Dicts.erase(dictId);
+            return false;
+        }
+    }
+
+    if (!ext.empty())
+        m_Extensions[ext] = dictId;
+    return true;
+}
+
+bool CZstdDictSet::Load(const std::string& filePath, bool bMapExtensions)
+{
+    std::ifstream ifs(filePath, std::ios::binary);
+    if (!ifs.is_open())
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot open dictionary file: " << filePath << "\n";
+        return false;
+    }
+
+    ifs.seekg(0, std::ios::end);
+    const uint64_t fileSize = uint64_t(ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+
+    ZstdDictHeader_t header = {};
+    ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!ifs || header.m_nMagic != ZSTDDICT_MAGIC || header.m_nVersion != ZSTDDICT_VERSION)
+    {
+        std::cerr << "[ReVPK] ERROR: Not a ReVPK dictionary file: " << filePath << "\n";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.m_nCount; i++)
+    {
+        uint32_t dictId = 0;
+        uint16_t extLen = 0;
+        ifs.read(reinterpret_cast<char*>(&dictId), sizeof(dictId));
+        ifs.read(reinterpret_cast<char*>(&extLen), sizeof(extLen));
+
+        std::string ext(extLen, '\0');
+        ifs.read(&ext[0], extLen);
+
+        uint32_t dictSize = 0;
+        ifs.read(reinterpret_cast<char*>(&dictSize), sizeof(dictSize));
+        if (!ifs)
+            break;
+
+        if (dictSize > ZSTDDICT_MAX_SIZE || dictSize > fileSize - uint64_t(ifs.tellg()))
+        {
+            std::cerr << "[ReVPK] ERROR: Dictionary " << dictId << " has an invalid size ("
+                      << dictSize << " bytes): " << filePath << "\n";
+            return false;
+        }
+
+        std::vector<uint8_t> dict(dictSize);
+        ifs.read(reinterpret_cast<char*>(dict.data()), dictSize);
+        if (!ifs)
+            break;
+
+        if (!Add(bMapExtensions ? ext : std::string(), std::move(dict)))
+            return false;
+
+        // Keep the extension with the dictionary so Save() round-trips it.
+        m_Dicts[dictId].m_Extension = ext;
+    }
+
+    if (!ifs)
+    {
+        std::cerr << "[ReVPK] ERROR: Dictionary file is truncated: " << filePath << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool CZstdDictSet::Save(const std::string& filePath) const
+{
+    std::ofstream ofs(filePath, std::ios::binary);
+    if (!ofs.is_open())
+    {
+        std::cerr << "[ReVPK] ERROR: Cannot write dictionary file: " << filePath << "\n";
+        return false;
+    }
+
+    const ZstdDictHeader_t header = { ZSTDDICT_MAGIC, ZSTDDICT_VERSION, uint32_t(m_Dicts.size()) };
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& it : m_Dicts)
+    {
+        const uint32_t dictId   = it.first;
+        const uint16_t extLen   = uint16_t(it.second.m_Extension.size());
+        const uint32_t dictSize = uint32_t(it.second.m_Data.size());
+
+        ofs.write(reinterpret_cast<const char*>(&dictId), sizeof(dictId));
+        ofs.write(reinterpret_cast<const char*>(&extLen), sizeof(extLen));
+        ofs.write(it.second.m_Extension.data(), extLen);
+        ofs.write(reinterpret_cast<const char*>(&dictSize), sizeof(dictSize));
+        ofs.write(reinterpret_cast<const char*>(it.second.m_Data.data()), dictSize);
+    }
+
+    if (!ofs)
+    {
+        std::cerr << "[ReVPK] ERROR: Failed to write dictionary file: " << filePath << "\n";
+        return false;
+    }
+    return true;
+}
+
+uint32_t CZstdDictSet::GetDictIdForPath(const std::string& entryPath) const
+{
+    if (m_Extensions.empty())
+        return 0;
+
+    auto it = m_Extensions.find(PackedStore_GetExtension(entryPath));
+    return (it != m_Extensions.end()) ? it->second : 0;
+}
+
+const ZSTD_CDict* CZstdDictSet::GetCDict(uint32_t nDictId, int nLevel) const
+{
+    auto it = m_Dicts.find(nDictId);
+    if (it == m_Dicts.end())
+        return nullptr;
+
+    // Digesting a dictionary is costly, so it's done once per level. Kept
+    // until destruction, as other threads may still be compressing with it.
+    const Dict_t& entry = it->second;
+    std::lock_guard<std::mutex> lock(m_CDictMutex);
+    ZSTD_CDict*& pCDict = entry.m_CDicts[nLevel];
+    if (!pCDict)
+        pCDict = ZSTD_createCDict(entry.m_Data.data(), entry.m_Data.size(), nLevel);
+    return pCDict;
+}
+
+const ZSTD_DDict* CZstdDictSet::GetDDict(uint32_t nDictId) const
+{
+    auto it = m_Dicts.find(nDictId);
+    return (it != m_Dicts.end()) ? it->second.m_pDDict : nullptr;
+}
@@ -0,0 +1,73 @@
+/**
+ * zstddict.h
+ *
+ * Trained ZSTD dictionaries, one per file extension. Small text-like assets
+ * (.nut, .txt, .rui, .vmt, .cfg, ...) barely compress on their own; a
+ * dictionary trained on other files of the same type fixes most of that.
+ *
+ * `revpk train-dict` writes a set to a file, the packers compress with it
+ * and store a copy next to the pack files (<pack>.pak000_dict.vpk), so
+ * extraction can load the dictionary a fragment names.
+ */
+
+#ifndef ZSTDDICT_H
+#define ZSTDDICT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include <zstd.h>
+
+class CZstdDictSet
+{
+public:
+    CZstdDictSet() = default;
+    ~CZstdDictSet();
+
+    CZstdDictSet(const CZstdDictSet&) = delete;
+    CZstdDictSet& operator=(const CZstdDictSet&) = delete;
+
+    // Train a dictionary for one extension from concatenated samples.
+    // Returns its ID, or 0 if there was not enough data to train on.
+    static uint32_t Train(const std::vector<uint8_t>& samples,
+                          const std::vector<size_t>& sampleSizes,
+                          size_t nDictCapacity, std::vector<uint8_t>& outDict);
+
+    // Add a dictionary and use it for files ending in .ext (empty: decode only).
+    bool Add(const std::string& ext, std::vector<uint8_t> dict);
+
+    // Add every dictionary in a dictionary file. With bMapExtensions false they
+    // are only available for decoding, and current extension mappings stay.
+    bool Load(const std::string& filePath, bool bMapExtensions = true);
+    bool Save(const std::string& filePath) const;
+
+    bool   Empty()    const { return m_Dicts.empty(); }
+    size_t GetCount() const { return m_Dicts.size(); }
+
+    // Dictionary to compress an entry with, or 0 for none.
+    uint32_t GetDictIdForPath(const std::string& entryPath) const;
+
+    // Digested dictionaries; nullptr if the ID is unknown. The compression
+    // dictionary is built for each level on first use.
+    const ZSTD_CDict* GetCDict(uint32_t nDictId, int nLevel) const;
+    const ZSTD_DDict* GetDDict(uint32_t nDictId) const;
+
+private:
+    struct Dict_t
+    {
+        std::string          m_Extension;
+        std::vector<uint8_t> m_Data;
+        ZSTD_DDict*          m_pDDict = nullptr;
+        mutable std::map<int, ZSTD_CDict*> m_CDicts; // by compression level
+    };
+
+    std::map<uint32_t, Dict_t>      m_Dicts;       // by dictionary ID
+    std::map<std::string, uint32_t> m_Extensions;  // lowercase extension => ID
+    mutable std::mutex              m_CDictMutex;
+};
+
+#endif // ZSTDDICT_H